@@ -12,36 +12,87 @@
 
 #include "MAX30100.h"
 
-//The MAX30100 stores up to 16 samples on the IC
-//This is additional local storage to the microcontroller
-//const int STORAGE_SIZE = MAX30100_FIFO_DEPTH;
-const int STORAGE_SIZE = 4;
-struct Record
+//Register codes for the sample rate in S/s and the pulse width in us, rounded down to what the sensor has
+static uint8_t sampleRateCode(int sampleRate)
+{
+  if (sampleRate < 100) return (MAX30100_SAMPLERATE_50); //Take 50 samples per second
+  else if (sampleRate < 167) return (MAX30100_SAMPLERATE_100);
+  else if (sampleRate < 200) return (MAX30100_SAMPLERATE_167);
+  else if (sampleRate < 400) return (MAX30100_SAMPLERATE_200);
+  else if (sampleRate < 600) return (MAX30100_SAMPLERATE_400);
+  else if (sampleRate < 800) return (MAX30100_SAMPLERATE_600);
+  else if (sampleRate < 1000) return (MAX30100_SAMPLERATE_800);
+  else if (sampleRate == 1000) return (MAX30100_SAMPLERATE_1000);
+  return (MAX30100_SAMPLERATE_50);
+}
+
+static uint8_t pulseWidthCode(int pulseWidth)
 {
-  uint16_t red[STORAGE_SIZE];
-  uint16_t IR[STORAGE_SIZE];
-  byte head;
-  byte tail;
-} sense; //This is our circular buffer of readings from the sensor
+  if (pulseWidth < 400) return (MAX30100_PULSEWIDTH_200); //Page 26, Gets us 15 bit resolution
+  else if (pulseWidth < 800) return (MAX30100_PULSEWIDTH_400); //16 bit resolution
+  else if (pulseWidth < 1600) return (MAX30100_PULSEWIDTH_800); //17 bit resolution
+  else if (pulseWidth == 1600) return (MAX30100_PULSEWIDTH_1600); //18 bit resolution
+  return (MAX30100_PULSEWIDTH_200);
+}
+
+//LED current of each MAX30100_xxLED_CURR_ step in 0.1mA
+static const uint16_t ledCurrent[16] = {0, 44, 76, 110, 142, 174, 208, 240, 271, 306, 338, 370, 402, 436, 468, 500};
 
 MAX30100::MAX30100() {
   // Constructor
-}
-
+  _transport = 0;
+  _clock = &_systemClock;
+  _lastError = MAX30100_I2C_OK;
+  _errorCount = 0;
+  _fifoOverflows = 0;
+  // Power on defaults of the sensor
+  _agcEnabled = false;
+  _agcLow = 40;
+  _agcHigh = 80;
+  _adcBits = 13;
+  _currentRed = 0;
+  _currentIR = 0;
+  _agcDCRed = 0;
+  _agcDCIR = 0;
+  _agcHoldoff = 0;
+  _pendingFlags = 0;
+  _ratePending = false;
+  _rateSkip = 0;
+  _intEnable = 0;
+  _modeConfig = 0;
+  _spo2Config = 0;
+  _ledConfig = 0;
+  _watchdogEnabled = false;
+  _watchdogDown = false;
+  _watchdogNext = 0;
+  _watchdogInterval = 1000;
+  _restarts = 0;
+  _lastSampleTime = 0;
+  _lastGoodTime = 0;
+  _lastCheckTime = 0;
+  _outageStart = 0;
+  _lastOutage = 0;
+}
+
+#ifndef MAX30100_NO_WIRE
 boolean MAX30100::begin(TwoWire &wirePort, uint32_t i2cSpeed, uint8_t i2caddr) {
+  _wire.begin(wirePort, i2cSpeed); //Grab which port the user wants us to use
+  return (begin(_wire, i2caddr));
+}
+#endif
 
-  _i2cPort = &wirePort; //Grab which port the user wants us to use
+void MAX30100::setClock(MAX30100_Clock &clock) {
+  _clock = &clock;
+}
 
-  _i2cPort->begin();
-  _i2cPort->setClock(i2cSpeed);
+boolean MAX30100::begin(MAX30100_Transport &transport, uint8_t i2caddr) {
 
+  _transport = &transport;
   _i2caddr = i2caddr;
 
   // Step 1: Initial Communication and Verification
   // Check that a MAX30100 is connected
   uint8_t id = readPartID();
-  Serial.println(id);
-  Serial.println(MAX_30100_EXPECTEDPARTID);
   if (!(id == MAX_30100_EXPECTEDPARTID)) {
     // Error -- Part ID read from MAX30100 does not match expected part ID.
     // This may mean there is a physical connectivity problem (broken wire, unpowered, etc).
@@ -97,12 +148,13 @@ void MAX30100::softReset(void) {
   bitMask(MAX30100_MODECONFIG, MAX30100_RESET_MASK, MAX30100_RESET);
   // Poll for bit to clear, reset is then complete
   // Timeout after 100ms
-  unsigned long startTime = millis();
-  while (millis() - startTime < 100)
+  unsigned long startTime = _clock->millis();
+  while (_clock->millis() - startTime < 100)
   {
-    uint8_t response = readRegister8(_i2caddr, MAX30100_MODECONFIG);
-    if ((response & MAX30100_RESET) == 0) break; //We're done!
-    delay(1); //Let's not over burden the I2C bus
+    uint8_t response;
+    if (readRegister8(_i2caddr, MAX30100_MODECONFIG, response) == MAX30100_I2C_OK &&
+        (response & MAX30100_RESET) == 0) break; //We're done!
+    _clock->delay(1); //Let's not over burden the I2C bus
   }
 }
 
@@ -134,14 +186,17 @@ void MAX30100::setSampleRate(uint8_t sampleRate) {
 void MAX30100::setPulseWidth(uint8_t pulseWidth) {
   // pulseWidth: one of MAX30100_PULSEWIDTH_200, _400, _800, _1600
   bitMask(MAX30100_SPO2CONFIG, MAX30100_PULSEWIDTH_MASK, pulseWidth);
+  _adcBits = 13 + (pulseWidth & ~MAX30100_PULSEWIDTH_MASK); //13 to 16 bit
 }
 
 void MAX30100::setPulseAmplitudeRed(uint8_t amplitude) {
   // NOTE: Amplitude values: 0b0000 = 0mA, 0b0111 = 24.0mA, 0b1111 = 50mA (typical)
   bitMask(MAX30100_LEDCONFIG, MAX30100_REDLED_CURR_MASK, amplitude);
+  _currentRed = (amplitude & ~MAX30100_REDLED_CURR_MASK) >> 4;
 }
 void MAX30100::setPulseAmplitudeIR(uint8_t amplitude) {
   bitMask(MAX30100_LEDCONFIG, MAX30100_IRLED_CURR_MASK, amplitude);
+  _currentIR = amplitude & ~MAX30100_IRLED_CURR_MASK;
 }
 
 void MAX30100::setHighresModeEnabled(void)
@@ -153,6 +208,259 @@ void MAX30100::setHighresModeDisabled(void)
   bitMask(MAX30100_SPO2CONFIG, MAX30100_SPO2HIRESEN_MASK, MAX30100_SPO2HIRES_DISABLE);
 }
 
+//Everything in SPO2CONFIG at once, without stopping the sensor
+//The pointers tell how many samples of the old setting wait in the FIFO, the flag goes to the one after
+bool MAX30100::setAcquisition(int sampleRate, int pulseWidth, bool highresMode)
+{
+  uint8_t pointers[3];
+  if (readBurst(_i2caddr, MAX30100_FIFOWRITEPTR, pointers, 3) != MAX30100_I2C_OK) return (false);
+  uint8_t width = pulseWidthCode(pulseWidth);
+  uint8_t config = sampleRateCode(sampleRate) | width | (highresMode ? MAX30100_SPO2HIRES_ENABLE : MAX30100_SPO2HIRES_DISABLE);
+  if (writeRegister8(_i2caddr, MAX30100_SPO2CONFIG, config) != MAX30100_I2C_OK) return (false);
+  _rateSkip = (pointers[0] - pointers[2]) & (MAX30100_FIFO_DEPTH - 1);
+  if (_rateSkip == 0 && pointers[1] > 0) _rateSkip = MAX30100_FIFO_DEPTH; //Overflow, the FIFO is full, as in readFIFO()
+  _ratePending = true;
+
+  //Same light, different ADC range: rescale the auto gain estimates and let them settle again
+  uint8_t bits = 13 + (width & ~MAX30100_PULSEWIDTH_MASK);
+  if (bits > _adcBits)
+  {
+    _agcDCRed <<= (bits - _adcBits);
+    _agcDCIR <<= (bits - _adcBits);
+  }
+  else
+  {
+    _agcDCRed >>= (_adcBits - bits);
+    _agcDCIR >>= (_adcBits - bits);
+  }
+  _adcBits = bits;
+  _agcHoldoff = MAX30100_AGC_SETTLE_SAMPLES;
+  return (true);
+}
+
+//
+// Automatic LED current control
+//
+
+void MAX30100::enableAutoGain(uint8_t lowPercent, uint8_t highPercent)
+{
+  _agcLow = lowPercent;
+  _agcHigh = highPercent;
+  _agcDCRed = 0;
+  _agcDCIR = 0;
+  _agcHoldoff = MAX30100_AGC_SETTLE_SAMPLES; //Let the DC estimates converge first
+  _agcEnabled = true;
+}
+
+void MAX30100::disableAutoGain(void)
+{
+  _agcEnabled = false;
+}
+
+uint8_t MAX30100::getCurrentRed(void)
+{
+  return (_currentRed);
+}
+
+uint8_t MAX30100::getCurrentIR(void)
+{
+  return (_currentIR);
+}
+
+//One controller step for one channel, returns the new LED current step
+//Steps down whenever the DC level is above the band, clipping is worse than a weak signal.
+//Steps up only if the DC level scaled by the current ratio stays below the band,
+//the low current steps are far apart and would otherwise oscillate.
+uint8_t MAX30100::adjustCurrent(uint8_t step, int32_t dc, int32_t low, int32_t high)
+{
+  if (dc > high && step > 1) return (step - 1);
+  if (dc < low && step < 15)
+  {
+    if (step == 0 || dc * ledCurrent[step + 1] / ledCurrent[step] <= high) return (step + 1);
+  }
+  return (step);
+}
+
+//Called by check() after new samples were stored
+void MAX30100::updateAutoGain(void)
+{
+  if (_agcHoldoff > 0) return;
+  int32_t fullScale = (1L << _adcBits) - 1;
+  int32_t low = fullScale * _agcLow / 100;
+  int32_t high = fullScale * _agcHigh / 100;
+  uint8_t red = adjustCurrent(_currentRed, _agcDCRed >> 8, low, high);
+  uint8_t ir = adjustCurrent(_currentIR, _agcDCIR >> 8, low, high);
+  if (red == _currentRed && ir == _currentIR) return;
+  //Both currents share one register, a single write needs no read back
+  if (writeRegister8(_i2caddr, MAX30100_LEDCONFIG, (red << 4) | ir) != MAX30100_I2C_OK) return;
+  if (red != _currentRed) _pendingFlags |= MAX30100_FLAG_RED_CURRENT;
+  if (ir != _currentIR) _pendingFlags |= MAX30100_FLAG_IR_CURRENT;
+  _currentRed = red;
+  _currentIR = ir;
+  _agcHoldoff = MAX30100_AGC_SETTLE_SAMPLES;
+}
+
+//
+// Sensor health watchdog
+//
+
+//Sample period of each SPO2CONFIG rate code in us
+static const uint16_t samplePeriod[8] = {20000, 10000, 5988, 5000, 2500, 1667, 1250, 1000};
+
+void MAX30100::enableWatchdog(uint16_t intervalMs)
+{
+  unsigned long now = _clock->millis();
+  _watchdogEnabled = true;
+  _watchdogInterval = intervalMs;
+  _watchdogDown = false;
+  _lastSampleTime = now;
+  _lastGoodTime = now;
+  _lastCheckTime = now;
+}
+
+void MAX30100::disableWatchdog(void)
+{
+  _watchdogEnabled = false;
+}
+
+uint16_t MAX30100::getRestarts(void)
+{
+  return (_restarts);
+}
+
+uint32_t MAX30100::getLastOutage(void)
+{
+  return (_lastOutage);
+}
+
+//Keep what was written to the configuration registers, the watchdog writes it again after a reset
+void MAX30100::remember(uint8_t reg, uint8_t value)
+{
+  switch (reg)
+  {
+    case MAX30100_MODECONFIG:
+      if (value & MAX30100_RESET)
+      {
+        //Everything back to the power on defaults
+        _intEnable = 0;
+        _modeConfig = 0;
+        _spo2Config = 0;
+        _ledConfig = 0;
+      }
+      else _modeConfig = value & ~MAX30100_TEMPREAD; //Self clearing
+      break;
+    case MAX30100_SPO2CONFIG: _spo2Config = value; break;
+    case MAX30100_LEDCONFIG: _ledConfig = value; break;
+    case MAX30100_INTENABLE: _intEnable = value; break;
+    default: return;
+  }
+  _lastSampleTime = _clock->millis(); //The sensor starts its sample clock over
+}
+
+//Read back one of part ID and configuration, true if it is what it should be
+//Read failures count as a fault, the transport already retried them
+bool MAX30100::watchdogCheck(uint8_t item)
+{
+  uint8_t reg, expected, mask;
+  switch (item)
+  {
+    case 0: reg = MAX30100_PARTID; expected = MAX_30100_EXPECTEDPARTID; mask = 0xFF; break;
+    case 1: reg = MAX30100_MODECONFIG; expected = _modeConfig; mask = ~(MAX30100_RESET | MAX30100_TEMPREAD); break;
+    case 2: reg = MAX30100_SPO2CONFIG; expected = _spo2Config; mask = 0x5F; break; //Bit 5 is reserved
+    case 3: reg = MAX30100_LEDCONFIG; expected = _ledConfig; mask = 0xFF; break;
+    default: reg = MAX30100_INTENABLE; expected = _intEnable; mask = 0xF0; break;
+  }
+  uint8_t value;
+  if (readRegister8(_i2caddr, reg, value) != MAX30100_I2C_OK) return (false);
+  return (((value ^ expected) & mask) == 0);
+}
+
+//Reset the sensor and write the configuration again, takes at most about 100ms
+//Returns false if the sensor did not answer, the cached configuration is kept for the next try
+bool MAX30100::restart(void)
+{
+  uint8_t intEnable = _intEnable;
+  uint8_t modeConfig = _modeConfig;
+  uint8_t spo2Config = _spo2Config;
+  uint8_t ledConfig = _ledConfig;
+
+  bool ok = (readPartID() == MAX_30100_EXPECTEDPARTID);
+  if (!ok) ok = recoverBus() && readPartID() == MAX_30100_EXPECTEDPARTID; //Someone holds SDA low
+  if (ok)
+  {
+    softReset();
+    //Same order as setup()
+    ok = writeRegister8(_i2caddr, MAX30100_MODECONFIG, modeConfig) == MAX30100_I2C_OK &&
+         writeRegister8(_i2caddr, MAX30100_SPO2CONFIG, spo2Config) == MAX30100_I2C_OK &&
+         writeRegister8(_i2caddr, MAX30100_LEDCONFIG, ledConfig) == MAX30100_I2C_OK &&
+         writeRegister8(_i2caddr, MAX30100_INTENABLE, intEnable) == MAX30100_I2C_OK;
+    if (ok) clearFIFO();
+  }
+  if (!ok)
+  {
+    _intEnable = intEnable;
+    _modeConfig = modeConfig;
+    _spo2Config = spo2Config;
+    _ledConfig = ledConfig;
+  }
+  return (ok);
+}
+
+//Called from check() with the samples it got
+//A fault resets the sensor at once, then at most once per stall time or check interval until samples come again
+void MAX30100::watchdog(uint16_t samples)
+{
+  unsigned long now = _clock->millis();
+  if (samples > 0)
+  {
+    _lastSampleTime = now;
+    if (_watchdogDown)
+    {
+      _watchdogDown = false;
+      _lastOutage = now - _outageStart;
+      if (_restarts < 0xFFFF) _restarts++;
+    }
+  }
+
+  //Sampling, write pointer should move at the configured rate
+  bool sampling = (_modeConfig & MAX30100_SHUTDOWN) == 0 &&
+                  ((_modeConfig & ~MAX30100_MODE_MASK) == MAX30100_MODE_HR || (_modeConfig & ~MAX30100_MODE_MASK) == MAX30100_MODE_SPO2);
+  unsigned long stallTime = ((uint32_t)MAX30100_WATCHDOG_STALL_SAMPLES * samplePeriod[(_spo2Config & ~MAX30100_SAMPLERATE_MASK) >> 2]) / 1000 + 1;
+
+  unsigned long since;
+  if (sampling && now - _lastSampleTime > stallTime)
+  {
+    since = _lastSampleTime;
+  }
+  else if (now - _lastCheckTime >= _watchdogInterval)
+  {
+    //One register per interval, one bus transaction
+    _lastCheckTime = now;
+    bool good = watchdogCheck(_watchdogNext);
+    _watchdogNext = (_watchdogNext + 1) % 5;
+    if (good)
+    {
+      _lastGoodTime = now;
+      return;
+    }
+    since = _lastGoodTime;
+  }
+  else return;
+
+  if (!_watchdogDown)
+  {
+    _watchdogDown = true;
+    _outageStart = since;
+  }
+  restart();
+  //Samples at the restored rate before the next try, no sample goes out without the flag
+  now = _clock->millis();
+  _lastSampleTime = now;
+  _lastCheckTime = now;
+  _pendingFlags |= MAX30100_FLAG_RESTART;
+  if (_ratePending) _rateSkip = 0; //The rate change is done, flag the first sample
+}
+
 //
 // FIFO Configuration
 //
@@ -182,12 +490,13 @@ float MAX30100::readTemperature(void) {
   bitMask(MAX30100_MODECONFIG, MAX30100_TEMPREAD_MASK, MAX30100_TEMPREAD);
   // Poll for bit to clear, reading is then complete
   // Timeout after 100ms
-  unsigned long startTime = millis();
-  while (millis() - startTime < 100)
+  unsigned long startTime = _clock->millis();
+  while (_clock->millis() - startTime < 100)
   {
-    uint8_t response = readRegister8(_i2caddr, MAX30100_MODECONFIG);
-    if ((response & MAX30100_TEMPREAD_MASK) == 0) break; //We're done!
-    delay(1); //Let's not over burden the I2C bus
+    uint8_t response;
+    if (readRegister8(_i2caddr, MAX30100_MODECONFIG, response) == MAX30100_I2C_OK &&
+        (response & MAX30100_TEMPREAD) == 0) break; //We're done!
+    _clock->delay(1); //Let's not over burden the I2C bus
   }
   //TODO How do we want to fail? With what type of error?
   //? if(millis() - startTime >= 100) return(-999.0);
@@ -232,36 +541,20 @@ void MAX30100::setup(byte powerLevel, byte ledMode, int sampleRate, int pulseWid
   //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
   // MAX30100_MODE_HR
   // MAX30100_MODE_SPO2
-  Serial.println(ledMode);
   setLEDMode(ledMode); 
   //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
   //The longer the pulse width the longer range of detection you'll have
   //At 69us and 0.4mA it's about 2 inches
   //At 411us and 0.4mA it's about 6 inches
-  Serial.println(pulseWidth);
-  if (pulseWidth < 400) setPulseWidth(MAX30100_PULSEWIDTH_200); //Page 26, Gets us 15 bit resolution
-  else if (pulseWidth < 800) setPulseWidth(MAX30100_PULSEWIDTH_400); //16 bit resolution
-  else if (pulseWidth < 1600) setPulseWidth(MAX30100_PULSEWIDTH_800); //17 bit resolution
-  else if (pulseWidth == 1600) setPulseWidth(MAX30100_PULSEWIDTH_1600); //18 bit resolution
-  else setPulseWidth(MAX30100_PULSEWIDTH_200);
+  setPulseWidth(pulseWidthCode(pulseWidth));
   //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-  Serial.println(sampleRate);
-  if (sampleRate < 100) setSampleRate(MAX30100_SAMPLERATE_50); //Take 50 samples per second
-  else if (sampleRate < 167) setSampleRate(MAX30100_SAMPLERATE_100);
-  else if (sampleRate < 200) setSampleRate(MAX30100_SAMPLERATE_167);
-  else if (sampleRate < 400) setSampleRate(MAX30100_SAMPLERATE_200);
-  else if (sampleRate < 600) setSampleRate(MAX30100_SAMPLERATE_400);
-  else if (sampleRate < 800) setSampleRate(MAX30100_SAMPLERATE_600);
-  else if (sampleRate < 1000) setSampleRate(MAX30100_SAMPLERATE_800);
-  else if (sampleRate == 1000) setSampleRate(MAX30100_SAMPLERATE_1000);
-  else setSampleRate(MAX30100_SAMPLERATE_50);
+  setSampleRate(sampleRateCode(sampleRate));
   //LED Pulse Amplitude Configuration
   //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
   //powerLevel = 0.4mA  - Presence detection of ~4 inch
   //powerLevel = 6.4mA  - Presence detection of ~8 inch
   //powerLevel = 25.4mA - Presence detection of ~8 inch
   //powerLevel = 50.0mA - Presence detection of ~12 inch
-  Serial.println(powerLevel);
   if (powerLevel < 0x01) {
     powerLevelRed=MAX30100_REDLED_CURR_0MA;
     powerLevelIR=MAX30100_IRLED_CURR_0MA;
@@ -314,9 +607,7 @@ void MAX30100::setup(byte powerLevel, byte ledMode, int sampleRate, int pulseWid
   setPulseAmplitudeRed(powerLevelRed);
   setPulseAmplitudeIR(powerLevelIR);
   //-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
-  Serial.println("Clear FIFO");
   clearFIFO(); //Reset the FIFO before we begin checking the sensor
-  Serial.println(highresMode);
   if (highresMode) { setHighresModeEnabled(); }
   else { setHighresModeDisabled();  }
 }
@@ -325,123 +616,160 @@ void MAX30100::setup(byte powerLevel, byte ledMode, int sampleRate, int pulseWid
 // Data Collection
 //
 
+//The MAX30100 stores up to 16 samples on the IC
+//_sense is additional local storage on the microcontroller, MAX30100_STORAGE_SIZE samples
+//read through a cursor per consumer
+
+//Another reader of every sample, e.g. a telemetry writer next to the processing
+uint8_t MAX30100::addConsumer(void)
+{
+  return (_sense.addConsumer());
+}
+
 //Tell caller how many samples are available
-uint8_t MAX30100::available(void)
+uint8_t MAX30100::available(uint8_t consumer)
 {
-  uint8_t numberOfSamples = sense.head - sense.tail;
-  if (numberOfSamples < 0) numberOfSamples += STORAGE_SIZE;
-  return (numberOfSamples);
+  return (_sense.available(consumer));
 }
 
 //Report the most recent red value
-uint16_t MAX30100::getRed(void)
+MAX30100::sample_t MAX30100::getRed(void)
 {
   //Check the sensor for new data for 250ms
   if(safeCheck(250))
-    return (sense.red[sense.head]);
+    return (_sense.red[_sense.newest()]);
   else
     return(0); //Sensor failed to find new data
 }
 
 //Report the most recent IR value
-uint16_t MAX30100::getIR(void)
+MAX30100::sample_t MAX30100::getIR(void)
 {
   //Check the sensor for new data for 250ms
   if(safeCheck(250))
-    return (sense.IR[sense.head]);
+    return (_sense.IR[_sense.newest()]);
   else
     return(0); //Sensor failed to find new data
 }
 
 //Report the next Red value in the FIFO
-uint16_t MAX30100::getFIFORed(void)
+MAX30100::sample_t MAX30100::getFIFORed(uint8_t consumer)
 {
-  return (sense.red[sense.tail]);
+  return (_sense.red[_sense.oldest(consumer)]);
 }
 
 //Report the next IR value in the FIFO
-uint16_t MAX30100::getFIFOIR(void)
+MAX30100::sample_t MAX30100::getFIFOIR(uint8_t consumer)
 {
-  return (sense.IR[sense.tail]);
+  return (_sense.IR[_sense.oldest(consumer)]);
 }
 
-//Advance the tail
-void MAX30100::nextSample(void)
+//Report the flags of the next sample in the FIFO
+uint8_t MAX30100::getFIFOFlags(uint8_t consumer)
 {
-  if(available()) //Only advance the tail if new data is available
-  {
-    sense.tail++;
-    sense.tail %= STORAGE_SIZE; //Wrap condition
-  }
+  return (_sense.flags[_sense.oldest(consumer)]);
+}
+
+//Samples lost in the sensor FIFO because check() was not called in time
+uint16_t MAX30100::getFIFOOverflows(void)
+{
+  return (_fifoOverflows);
+}
+
+//Advance the consumer to its next sample
+void MAX30100::nextSample(uint8_t consumer)
+{
+  _sense.next(consumer);
+}
+
+//Samples the consumer lost because it was MAX30100_STORAGE_SIZE behind when new ones came
+uint16_t MAX30100::getOverruns(uint8_t consumer)
+{
+  return (_sense.overruns[consumer]);
 }
 
 // Polls the sensor for new data
 // Call regularly
-// If new data is available, it updates the head and tail in the main struct
+// If new data is available, it stores it in _sense, overrunning consumers too far behind
 // Returns number of new samples obtained
 uint16_t MAX30100::check(void)
+{
+  uint16_t numberOfSamples = readFIFO();
+  if (_watchdogEnabled) watchdog(numberOfSamples);
+  return (numberOfSamples);
+}
+
+uint16_t MAX30100::readFIFO(void)
 {
   //Read register FIDO_DATA in (2-byte * number of active LED (always 2 in MAX30100) chunks
   //Until FIFO_RD_PTR = FIFO_WR_PTR
 
-  byte readPointer = getReadPointer();
-  byte writePointer = getWritePointer();
-  Serial.print(readPointer);  
-  Serial.print(", ");  
-  Serial.println(writePointer);  
+  //Write pointer, overflow counter and read pointer are adjacent registers, get them in one transaction
+  uint8_t pointers[3];
+  if (readBurst(_i2caddr, MAX30100_FIFOWRITEPTR, pointers, 3) != MAX30100_I2C_OK) return (0);
+  byte writePointer = pointers[0];
+  byte overflowCounter = pointers[1];
+  byte readPointer = pointers[2];
+
+  //Samples the sensor dropped since the last read, the counter saturates at 15
+  if (overflowCounter > 0 && _fifoOverflows < 0xFFFF - overflowCounter) _fifoOverflows += overflowCounter;
 
   int numberOfSamples = 0;
 
   //Do we have new data?
-  if (readPointer != writePointer)
+  if (readPointer != writePointer || overflowCounter > 0)
   {
     //Calculate the number of readings we need to get from sensor
-    //numberOfSamples = (writePointer - readPointer) & (MAX30100_FIFO_DEPTH-1);
-    if (numberOfSamples < 0) numberOfSamples += MAX30100_FIFO_DEPTH; //Wrap condition
+    numberOfSamples = (writePointer - readPointer) & (MAX30100_FIFO_DEPTH-1);
+    if (numberOfSamples == 0) numberOfSamples = MAX30100_FIFO_DEPTH; //Overflow, the FIFO is full
 
     //We now have the number of readings, now calc bytes to read
-    //For this example we are doing Red and IR (2 bytes each)
-    int bytesLeftToRead = numberOfSamples * 4;
-
-    //Get ready to read a burst of data from the FIFO register
-    _i2cPort->beginTransmission(MAX30100_ADDRESS);
-    _i2cPort->write(MAX30100_FIFODATA);
-    _i2cPort->endTransmission();
-
-    //We may need to read as many as 16*4 (64) bytes so we read in blocks no larger than I2C_BUFFER_LENGTH
-    //I2C_BUFFER_LENGTH changes based on the platform. 64 bytes for SAMD21, 32 bytes for Uno.
-    //Wire.requestFrom() is limited to BUFFER_LENGTH which is 32 on the Uno
+    //Red and IR, Format::BYTES_PER_SAMPLE each
+    const uint8_t slotBytes = Ring::SLOT_BYTES;
+    int bytesLeftToRead = numberOfSamples * slotBytes;
+    numberOfSamples = 0;
+
+    //We may need to read as many as 16*4 (64) bytes so we read in blocks no larger than the transport allows
+    //Wire.requestFrom() is limited to BUFFER_LENGTH which is 32 on the Uno, Linux i2c-dev takes the whole FIFO at once
+    uint8_t burst[MAX30100_FIFO_DEPTH * Ring::SLOT_BYTES];
+    int maxBurst = _transport->maxBurst();
+    if (maxBurst > (int)sizeof(burst)) maxBurst = sizeof(burst);
+    maxBurst -= maxBurst % slotBytes; //Trim to be a multiple of the samples we need to read
     while (bytesLeftToRead > 0)
     {
       int toGet = bytesLeftToRead;
-      if (toGet > I2C_BUFFER_LENGTH)
-      {
-        toGet = I2C_BUFFER_LENGTH - (I2C_BUFFER_LENGTH % 4); //Trim toGet to be a multiple of the samples we need to read
-      }
+      if (toGet > maxBurst) toGet = maxBurst;
       bytesLeftToRead -= toGet;
       //Request toGet number of bytes from sensor
-      _i2cPort->requestFrom(MAX30100_ADDRESS, toGet);
-      while (toGet > 0)
+      //On failure keep what we have, the remaining samples stay in the sensor FIFO
+      if (readBurst(_i2caddr, MAX30100_FIFODATA, burst, toGet) != MAX30100_I2C_OK) break;
+      for (int i = 0; i < toGet; i += slotBytes)
       {
-        sense.head++; //Advance the head of the storage struct
-        sense.head %= STORAGE_SIZE;  // Wrap condition
-        byte temp[sizeof(uint16_t)]; // Array of 2 bytes that we will convert into short
-        uint16_t tempShort;
-        //Burst read three bytes - IR
-        temp[1] = _i2cPort->read();
-        temp[0] = _i2cPort->read();
-        //Convert array to long
-        memcpy(&tempShort, temp, sizeof(tempShort));
-        sense.IR[sense.head] = tempShort; //Store this reading into the sense array
-        //Burst read three more bytes - RED
-        temp[1] = _i2cPort->read();
-        temp[0] = _i2cPort->read();
-        //Convert array to long
-        memcpy(&tempShort, temp, sizeof(tempShort));
-        sense.red[sense.head] = tempShort;
-        toGet -= 4;
+        //The first sample after a LED current change carries the flag
+        uint8_t flags = _pendingFlags;
+        _pendingFlags = 0;
+        if (_ratePending)
+        {
+          if (_rateSkip == 0)
+          {
+            flags |= MAX30100_FLAG_RATE;
+            _ratePending = false;
+          }
+          else _rateSkip--;
+        }
+        _sense.pushSlot(&burst[i], flags);
+        if (_agcEnabled)
+        {
+          //Same exponential average as averageDCEstimator()
+          uint8_t newest = _sense.newest();
+          _agcDCIR  += ((((int32_t)_sense.IR[newest])  << 8) - _agcDCIR)  >> 4;
+          _agcDCRed += ((((int32_t)_sense.red[newest]) << 8) - _agcDCRed) >> 4;
+          if (_agcHoldoff > 0) _agcHoldoff--;
+        }
+        numberOfSamples++;
       }
     } //End while (bytesLeftToRead > 0)
+    if (_agcEnabled && numberOfSamples > 0) updateAutoGain();
   } //End readPtr != writePtr
   return (numberOfSamples); //Let the world know how much new data we found
 }
@@ -451,50 +779,88 @@ uint16_t MAX30100::check(void)
 //Returns false if new data was not found
 bool MAX30100::safeCheck(uint8_t maxTimeToCheck)
 {
-  uint32_t markTime = millis();
+  uint32_t markTime = _clock->millis();
   while(1)
   {
-	  if(millis() - markTime > maxTimeToCheck) return(false);
-	  if(check() == true) //We found new data!
+	  if(_clock->millis() - markTime > maxTimeToCheck) return(false);
+	  if(check() > 0) //We found new data!
 	    return(true);
-	  delay(1);
+	  _clock->delay(1);
   }
 }
 
 //Given a register, read it, mask it, and then set the thing
-void MAX30100::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
+uint8_t MAX30100::bitMask(uint8_t reg, uint8_t mask, uint8_t thing)
 {
   // Grab current register context
-  uint8_t originalContents = readRegister8(_i2caddr, reg);
+  uint8_t originalContents;
+  uint8_t status = readRegister8(_i2caddr, reg, originalContents);
+  if (status != MAX30100_I2C_OK) return (status); //Never write back a value we failed to read
   // Zero-out the portions of the register we're interested in
   originalContents = originalContents & mask;
   // Change contents
-  writeRegister8(_i2caddr, reg, originalContents | thing);
+  return (writeRegister8(_i2caddr, reg, originalContents | thing));
 }
 
 //
 // Low-level I2C Communication
 //
-uint8_t MAX30100::readRegister8(uint8_t address, uint8_t reg) {
-  _i2cPort->beginTransmission(address);
-  _i2cPort->write(reg);
-  _i2cPort->endTransmission(false);
-  _i2cPort->requestFrom(address, 1);   // Request 1 byte
 
-  int tries = 0;
-  while (!_i2cPort->available())
+//Book keeping of failed transactions
+uint8_t MAX30100::i2cResult(uint8_t status)
+{
+  if (status != MAX30100_I2C_OK)
   {
-    delay(1);
-    if (tries++ > 200) break;
+    _lastError = status;
+    if (_errorCount < 0xFFFF) _errorCount++;
   }
-  if (tries == 200) return (0); //Fail
+  return (status);
+}
 
-  return (_i2cPort->read());
+//Read a register or a burst starting at a register
+//Retries and bus recovery are up to the transport
+uint8_t MAX30100::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len)
+{
+  return (i2cResult(_transport->readBurst(address, reg, buffer, len)));
+}
+
+uint8_t MAX30100::readRegister8(uint8_t address, uint8_t reg, uint8_t &value) {
+  return (readBurst(address, reg, &value, 1));
 }
 
-void MAX30100::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
-  _i2cPort->beginTransmission(address);
-  _i2cPort->write(reg);
-  _i2cPort->write(value);
-  _i2cPort->endTransmission();
+uint8_t MAX30100::readRegister8(uint8_t address, uint8_t reg) {
+  uint8_t value;
+  if (readBurst(address, reg, &value, 1) != MAX30100_I2C_OK) return (0); //Fail
+  return (value);
+}
+
+uint8_t MAX30100::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
+  uint8_t status = i2cResult(_transport->writeRegister8(address, reg, value));
+  if (status == MAX30100_I2C_OK && address == _i2caddr) remember(reg, value);
+  return (status);
+}
+
+uint8_t MAX30100::getLastError(void) {
+  return (_lastError);
+}
+
+uint16_t MAX30100::getErrorCount(void) {
+  return (_errorCount);
+}
+
+void MAX30100::clearErrors(void) {
+  _lastError = MAX30100_I2C_OK;
+  _errorCount = 0;
+}
+
+#ifndef MAX30100_NO_WIRE
+void MAX30100::setBusRecoveryPins(int8_t sdaPin, int8_t sclPin) {
+  _wire.setBusRecoveryPins(sdaPin, sclPin);
+}
+#endif
+
+//Free a stuck bus, returns true if the bus is usable afterwards
+bool MAX30100::recoverBus(void)
+{
+  return (_transport->recoverBus());
 }
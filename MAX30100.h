@@ -17,40 +17,51 @@
  #include "WProgram.h"
 #endif
 
-#include <Wire.h>
 #include "MAX30100_Registers.h"
+#include "MAX30100_Sample.h"
+#include "MAX30100_Transport.h"
+#include "MAX30100_Clock.h"
+#ifndef MAX30100_NO_WIRE
+ #include "MAX30100_Wire.h"
+#endif
 
-#define I2C_SPEED_STANDARD        100000
-#define I2C_SPEED_FAST            400000
-
-//Define the size of the I2C buffer based on the platform the user has
-#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-
-  //I2C_BUFFER_LENGTH is defined in Wire.H
-  #define I2C_BUFFER_LENGTH BUFFER_LENGTH
-
-#elif defined(__SAMD21G18A__)
-
-  //SAMD21 uses RingBuffer.h
-  #define I2C_BUFFER_LENGTH SERIAL_BUFFER_SIZE
-
-#else
+// Samples kept on the microcontroller, a power of two, and the consumers reading them
+// Each consumer has its own cursor, consumer 0 is the one of the calls without a consumer
+#ifndef MAX30100_STORAGE_SIZE
+ #define MAX30100_STORAGE_SIZE  32
+#endif
+#ifndef MAX30100_CONSUMERS
+ #define MAX30100_CONSUMERS     3
+#endif
+#define MAX30100_NO_CONSUMER    0xFF // addConsumer() when all are taken
 
-  //The catch-all default is 32
-  #define I2C_BUFFER_LENGTH 32
+// Automatic LED current control
+// The DC estimate settles in about 4x16 samples, the controller waits that long after a change
+#define MAX30100_AGC_SETTLE_SAMPLES  64
 
-#endif
+// Sensor health watchdog
+// A sensor that delivers no sample for this many sample periods has stopped, a full FIFO's worth
+#define MAX30100_WATCHDOG_STALL_SAMPLES  16
 
 class MAX30100 {
  public: 
+  typedef MAX30100_Format Format;     //16 bit samples, IR then red
+  typedef Format::sample_t sample_t;
+
   MAX30100(void);
 
+#ifndef MAX30100_NO_WIRE
   boolean begin(TwoWire &wirePort = Wire, uint32_t i2cSpeed = I2C_SPEED_STANDARD, uint8_t i2caddr = MAX30100_ADDRESS);
-
-  uint16_t getRed(void); //Returns immediate red value
-  uint16_t getIR(void); //Returns immediate IR value
-  uint16_t getFIFORed(void); //Returns the FIFO sample pointed to by tail
-  uint16_t getFIFOIR(void); //Returns the FIFO sample pointed to by tail
+#endif
+  boolean begin(MAX30100_Transport &transport, uint8_t i2caddr = MAX30100_ADDRESS);
+  // Time base of the timeouts, waits and the watchdog, the Arduino clock by default
+  void setClock(MAX30100_Clock &clock);
+
+  sample_t getRed(void); //Returns immediate red value
+  sample_t getIR(void); //Returns immediate IR value
+  sample_t getFIFORed(uint8_t consumer = 0); //Returns the oldest sample the consumer has not taken
+  sample_t getFIFOIR(uint8_t consumer = 0);  //Read it, then nextSample()
+  uint8_t getFIFOFlags(uint8_t consumer = 0); //Returns the MAX30100_FLAG_ bits of that sample
  
   // Configuration
   void softReset(void);
@@ -70,6 +81,32 @@ class MAX30100 {
   void setHighresModeEnabled(void);
   void setHighresModeDisabled(void);
 
+  // Switch sample rate, pulse width and high resolution while running, values as for setup()
+  // One write to SPO2CONFIG, the FIFO keeps running. The first sample taken with the new
+  // setting carries MAX30100_FLAG_RATE, the ones before still come at the old one.
+  bool setAcquisition(int sampleRate, int pulseWidth, bool highresMode);
+
+  // Automatic LED current control
+  // Adjusts red and IR current independently to keep the DC level of each channel
+  // between lowPercent and highPercent of the ADC range. Runs inside check().
+  // Samples taken after a current change carry MAX30100_FLAG_RED_CURRENT/_IR_CURRENT.
+  void enableAutoGain(uint8_t lowPercent = 40, uint8_t highPercent = 80);
+  void disableAutoGain(void);
+  uint8_t getCurrentRed(void); // LED current step 0..15, see MAX30100_REDLED_CURR_
+  uint8_t getCurrentIR(void);  // LED current step 0..15, see MAX30100_IRLED_CURR_
+
+  // Sensor health watchdog
+  // Runs inside check(). A brownout or bus glitch can leave the sensor at its power on
+  // defaults or frozen. The watchdog notices a write pointer that stopped moving, no sample
+  // for MAX30100_WATCHDOG_STALL_SAMPLES periods at the configured rate, and reads back one
+  // of part ID and configuration registers every intervalMs. On a fault it resets the
+  // sensor and writes the configuration last written again, retrying until samples come.
+  // The first sample after that carries MAX30100_FLAG_RESTART.
+  void enableWatchdog(uint16_t intervalMs = 1000);
+  void disableWatchdog(void);
+  uint16_t getRestarts(void);      // Outages the watchdog ended
+  uint32_t getLastOutage(void);    // ms from the last good sample or check to the first sample after the last one
+
   //Interrupts 
   uint8_t getINT(void);    //Returns the main interrupt group
   void enableAFULL(void);  //Enable/disable individual interrupts
@@ -87,9 +124,12 @@ class MAX30100 {
   
   //FIFO Reading
   uint16_t check(void);    //Checks for new data and fills FIFO
-  uint8_t available(void); //Tells caller how many new samples are available (head - tail)
-  void nextSample(void);   //Advances the tail of the sense array
+  uint8_t addConsumer(void); //Another cursor for a reader of its own, from the next sample on, or MAX30100_NO_CONSUMER
+  uint8_t available(uint8_t consumer = 0); //Tells caller how many new samples are available, the consumer's lag
+  void nextSample(uint8_t consumer = 0);   //Moves the consumer's cursor on to its next sample
+  uint16_t getOverruns(uint8_t consumer = 0); //Samples the consumer lost by falling MAX30100_STORAGE_SIZE behind
   bool safeCheck(uint8_t maxTimeToCheck); //Given a max amount of time, check for new data
+  uint16_t getFIFOOverflows(void); //Samples the sensor dropped because its FIFO was full
 
   uint8_t getWritePointer(void);
   uint8_t getReadPointer(void);
@@ -120,13 +160,74 @@ class MAX30100 {
   void setup(byte powerLevel = 0x0F, byte ledMode = MAX30100_MODE_HR, int sampleRate = 50, int pulseWidth = 1600, bool highresMode = false);
 
   // Low-level I2C communication
-  uint8_t readRegister8(uint8_t address, uint8_t reg);
-  void   writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  // Transactions return one of the MAX30100_I2C_ status codes
+  uint8_t readRegister8(uint8_t address, uint8_t reg, uint8_t &value);
+  uint8_t readRegister8(uint8_t address, uint8_t reg); // Returns 0 on failure, see getLastError()
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+
+  // I2C error reporting
+  uint8_t getLastError(void);   //Status of the most recent failed transaction, 0 if none
+  uint16_t getErrorCount(void); //Number of transactions that failed after all retries
+  void clearErrors(void);
+
+  // I2C bus recovery, see MAX30100_WireTransport
+#ifndef MAX30100_NO_WIRE
+  void setBusRecoveryPins(int8_t sdaPin, int8_t sclPin);
+#endif
+  bool recoverBus(void);
 
  private:
-  TwoWire *_i2cPort; //The generic connection to user's chosen I2C hardware
+  typedef MAX30100_Ring<Format, MAX30100_STORAGE_SIZE, MAX30100_CONSUMERS> Ring;
+  Ring _sense;   //Readings from the sensor, each stored once for all consumers
+  MAX30100_Transport *_transport; //Register access, Wire or whatever the user passed to begin()
+  MAX30100_Clock _systemClock;
+  MAX30100_Clock *_clock;         //millis() and delay(), _systemClock unless setClock()
+#ifndef MAX30100_NO_WIRE
+  MAX30100_WireTransport _wire;
+#endif
   uint8_t _i2caddr;
+  uint8_t _lastError;
+  uint16_t _errorCount;
+  uint16_t _fifoOverflows; //Sum of the sensor's overflow counter
   uint8_t revisionID; 
+  // Automatic LED current control
+  bool _agcEnabled;
+  uint8_t _agcLow;        //Target band in percent of the ADC range
+  uint8_t _agcHigh;
+  uint8_t _adcBits;       //ADC resolution set by the pulse width
+  uint8_t _currentRed;    //LED current steps as written to the sensor
+  uint8_t _currentIR;
+  int32_t _agcDCRed;      //DC estimates, 8 fractional bits
+  int32_t _agcDCIR;
+  uint8_t _agcHoldoff;    //Samples until the DC estimates reflect the last change
+  uint8_t _pendingFlags;  //Flags for the next sample stored
+  bool _ratePending;      //MAX30100_FLAG_RATE still to be given to a sample
+  uint8_t _rateSkip;      //Samples of the old setting ahead of it
+  // Configuration as last written, what the watchdog restores
+  uint8_t _intEnable;
+  uint8_t _modeConfig;
+  uint8_t _spo2Config;
+  uint8_t _ledConfig;
+  // Watchdog
+  bool _watchdogEnabled;
+  bool _watchdogDown;            //Fault seen, no sample since
+  uint8_t _watchdogNext;         //Register to read back next
+  uint16_t _watchdogInterval;
+  uint16_t _restarts;
+  unsigned long _lastSampleTime; //Last sample or configuration change
+  unsigned long _lastGoodTime;   //Last register read back that matched
+  unsigned long _lastCheckTime;
+  unsigned long _outageStart;
+  uint32_t _lastOutage;
+  uint16_t readFIFO(void);
+  void watchdog(uint16_t samples);
+  bool watchdogCheck(uint8_t item);
+  bool restart(void);
+  void remember(uint8_t reg, uint8_t value);
+  void updateAutoGain(void);
+  uint8_t adjustCurrent(uint8_t step, int32_t dc, int32_t low, int32_t high);
   void readRevisionID();
-  void bitMask(uint8_t reg, uint8_t mask, uint8_t thing);
+  uint8_t bitMask(uint8_t reg, uint8_t mask, uint8_t thing);
+  uint8_t i2cResult(uint8_t status);
 };
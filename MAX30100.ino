@@ -29,33 +29,78 @@
 
 #include <Wire.h>
 #include "MAX30100.h"
-#include "algorithm.h"
+#include "pipeline.h"
+#include "spscQueue.h"
+#include "ppgCodec.h"
+#include "acquisitionProfile.h"
 
 MAX30100 sensor;
 
-#if defined(ARDUINO_AVR_NANO)
-//Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
-//To solve this problem, 16-bit MSB of the sampled data will be truncated. Samples become 16-bit data.
-uint16_t irBuffer[100];   //infrared LED sensor data
-uint16_t redBuffer[100];  //red LED sensor data
+//Samples in the sensor's native width, 16 bit for the MAX30100
+typedef MAX30100::sample_t sample_t;
+
+//Processing steps, every sample from the FIFO runs through them in this order
+typedef ppgPipeline<
+  ppgDecimateTo<50>,            //FAST profile averaged down to 50 samples/s, SLOW passes through
+  ppgQuality<MAX30100::Format>, //finger presence, clipping, motion and perfusion
+  ppgDCRemoveWarm,              //PBA beat detector: DC estimator seeded at the start,
+  ppgLowPass,                   //  low pass FIR (ppgLowPassShort for beats 4 samples sooner)
+  ppgBeat,                      //  and zero crossings
+  ppgSampleSink,                //print each sample
+  ppgDecimate<2>,               //50 to 25 samples/s for the SpO2 calculation
+  ppgSpO2<100, 25, sample_t>    //4 second window, a new result every second
+> Pipeline;
+enum { RATE, QUALITY, DC, LOWPASS, BEAT, PRINT, DECIMATE, SPO2 }; //stage numbers
+
+Pipeline pipeline;
+
+//Acquisition switches between SLOW and FAST (acquisitionProfile.h) on motion. Processing
+//asks for a profile, acquisition applies it between two FIFO reads and the first sample
+//at the new setting restarts the stages.
+#define ADAPTIVE_PROFILE 1
+profileManager_t profile;
+volatile uint8_t requestedProfile = PROFILE_SLOW; //written by processing
+uint8_t appliedProfile = PROFILE_SLOW;            //owned by acquisition
+
+//Acquisition hands samples to processing through this queue. A slow SpO2 window or a
+//blocked Serial.print then only fills the queue instead of overflowing the sensor FIFO.
+//On ESP32 acquisition runs in its own task, elsewhere once per loop() between batches of
+//DRAIN_SAMPLES, so the prints of a batch take less time than the FIFO takes to fill.
+//Items are in the sensor's sample width. On AVR the queue only has to cover one SpO2
+//window calculation, the sensor FIFO and the driver's ring hold more, and a deeper one
+//would not leave a 2 KB Uno or Nano enough RAM.
+typedef ppgSampleOf<sample_t> queuedSample;
+#if defined(__AVR__)
+spscQueue<queuedSample, 16> samples;
 #else
-uint32_t irBuffer[100];   //infrared LED sensor data
-uint32_t redBuffer[100];  //red LED sensor data
+spscQueue<queuedSample, 64> samples;
 #endif
+#define DRAIN_SAMPLES 16 //processed per loop(), one sensor FIFO, at most one print at 1000 samples/s
+#define STATS_INTERVAL_MS 10000 //report queue statistics this often, 0 never
+unsigned long lastStatsTime = 0;
+ppgResult lastResult; //most recent SpO2 and heart rate
 
-int32_t bufferLength; //data length
-int32_t spo2; //SPO2 value
-int8_t  validSPO2; //indicator to show if the SPO2 calculation is valid
-int32_t heartRate; //heart rate value
-int8_t  validHeartRate; //indicator to show if the heart rate calculation is valid
+//Send the samples as compressed binary blocks (ppgCodec.h) instead of R: lines, about 2.5
+//instead of 36 bytes per sample. Results follow as H: text lines. Decode with host/ppg_decode.
+#define STREAM_COMPRESSED 0
+#if STREAM_COMPRESSED
+ppgEncoder_t encoder;
+#endif
+
+//Put the sensor to sleep when no finger was seen for this long, 0 keeps it running
+#define NO_FINGER_SHUTDOWN_MS 30000
+#define NO_FINGER_PROBE_MS    2000  //time asleep before looking for a finger again
+unsigned long lastFingerTime = 0;
+uint8_t lastQuality = SQ_SETTLING;
 
 byte readLED = 13; //Blinks with each data read
+byte pulseLED = 11; //Toggles with each heart beat
 
 void setup()
 {
   Serial.begin(115200); // initialize serial communication at 115200 bits per second:
 
-  //pinMode(pulseLED, OUTPUT);
+  pinMode(pulseLED, OUTPUT);
   pinMode(readLED, OUTPUT);
 
   // Initialize sensor
@@ -73,97 +118,207 @@ void setup()
  // while (Serial.available() == 0) ; //wait until user presses a key
  // Serial.read();
 
-  //SLOW
-  byte ledBrightness  = 0x0F;                // MAX30100_IRLED_CURR_50MA
+  //Start SLOW: 50 samples/s, 1600us, high resolution. FAST is 1000 samples/s, 200us.
+  byte ledBrightness  = 0x07;                // MAX30100_IRLED_CURR_24MA, starting point for auto gain
   byte ledMode = MAX30100_MODE_SPO2;         // Options: SPO2, HR
-  int sampleRate = 50;                       // Options: 50, 100, 167, 200, 400, 600, 800, 1000,
-  int pulseWidth = MAX30100_PULSEWIDTH_1600; // Options: 200, 400, 800, 1600[us] 
-  bool highresMode = true;
-  
-  //FAST
-  //byte ledBrightness  = 0x0F;               // MAX30100_IRLED_CURR_50MA
-  //byte ledMode = MAX30100_MODE_SPO2;        // Options: SPO2, HR
-  //int sampleRate = 1000 ;                   // Options: 50, 100, 167, 200, 400, 600, 800, 1000,
-  //int pulseWidth = MAX30100_PULSEWIDTH_200; // Options: 200, 400, 800, 1600[us] 
-  //bool highresMode = false;
-  
+  const acquisitionProfile_t &start = acquisitionProfiles[PROFILE_SLOW];
+
   //Configure sensor with these settings
-  sensor.setup(ledBrightness, ledMode, sampleRate, pulseWidth, highresMode);
+  sensor.setup(ledBrightness, ledMode, start.sampleRate, start.pulseWidth, start.highres);
+  //Let the driver adjust red and IR current to the skin, samples after a change are flagged
+  sensor.enableAutoGain();
+  //Reset and reconfigure the sensor when it stops sampling or loses its settings, a brownout
+  //or bus glitch, the first sample after that is flagged
+  sensor.enableWatchdog();
+
+  //Results come back through these as the samples are processed
+  pipeline.stage<BEAT>().onBeat(beatDetected);
+  pipeline.stage<PRINT>().onSample(printSample);
+  pipeline.stage<SPO2>().onResult(newResult);
+  pipeline.stage<SPO2>().provisional(true); //first results from the partial window, after about 2 instead of 4 seconds
+  pipeline.onRetune(MAX30100_FLAG_RATE | MAX30100_FLAG_RESTART, restartStages);
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - start.bits;
+  pipeline.begin(start.sampleRate);
+  profileManagerInit(&profile, PROFILE_SLOW, 50);
+  lastResult = pipeline.stage<SPO2>().result;
+#if STREAM_COMPRESSED
+  ppgEncoderInit(&encoder);
+#endif
+
+#if defined(ESP32)
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", 2048, NULL, 2, NULL, 0);
+#endif
+
   Serial.println(F("Sensor Configured."));
 }
 
 void loop()
 {
-  bufferLength = 100; //buffer length of 100 stores 4 seconds of samples running at 25sps
+#if !defined(ESP32)
+  acquire();
+#endif
+  //Run what was acquired through the pipeline, callbacks report
+#if defined(ESP32)
+  pipeline.drainQueue(samples);
+#else
+  pipeline.drainQueue(samples, DRAIN_SAMPLES); //the rest after the next acquire()
+#endif
 
-  //read the first 100 samples, and determine the signal range
-  for (byte i = 0 ; i < bufferLength ; i++)
+#if STATS_INTERVAL_MS > 0
+  if (millis() - lastStatsTime > STATS_INTERVAL_MS)
   {
-    while (sensor.available() == false) //do we have new data?
-    {
-      // Serial.println(F("Checking for Data."));  
-      sensor.check(); //Check the sensor for new data
-    }
-    Serial.println(F("Reading Red Data."));  
-    redBuffer[i] = sensor.getRed();
-    Serial.println(F("Reading IR Data."));  
-    irBuffer[i]  = sensor.getIR();
-    sensor.nextSample(); //We're finished with this sample so move to next sample
-
-    // Serial.print(F("R:"));
-    // Serial.print(redBuffer[i], DEC);
-    // Serial.print(F(","));
-    // Serial.println(irBuffer[i], DEC);
+    lastStatsTime = millis();
+    printStats();
   }
+#endif
 
-  //calculate heart rate and SpO2 after first 100 samples (first 4 seconds of samples)
-  //maxim_heart_rate_and_oxygen_saturation(irBuffer, bufferLength, redBuffer, &spo2, &validSPO2, &heartRate, &validHeartRate);
+#if NO_FINGER_SHUTDOWN_MS > 0 && !defined(ESP32) //the acquisition task owns the sensor on ESP32
+  if (lastQuality == SQ_NO_FINGER && millis() - lastFingerTime > NO_FINGER_SHUTDOWN_MS)
+  {
+    queuedSample dropped;
+    //Nobody there, sleep and then take a settle period of samples to look again
+    sensor.shutDown();
+    delay(NO_FINGER_PROBE_MS);
+    sensor.wakeUp();
+    sensor.clearFIFO();
+    while (samples.pop(dropped)) ; //stale samples from before the sleep
+    pipeline.reset();
+    lastQuality = SQ_SETTLING;
+  }
+#endif
+}
 
-  //Continuously taking samples from MAX3010x.  Heart rate and SpO2 are calculated every 1 second
-  while (1)
+//Producer: move new sensor samples into the queue
+void acquire()
+{
+  sensor.check();
+  while (sensor.available())
   {
-    //dumping the first 25 sets of samples in the memory and shift the last sets of samples to the top
-    for (byte i = 25; i < bufferLength; i++)
-    {
-      redBuffer[i - 25] = redBuffer[i];
-      irBuffer[i - 25] = irBuffer[i];
-    }
+    queuedSample s = { sensor.getFIFORed(), sensor.getFIFOIR(), sensor.getFIFOFlags() };
+    sensor.nextSample();
+    samples.push(s); //counted as a stall when the queue is full
+  }
 
-    //take 25 sets of samples before calculating the heart rate.
-    for (byte i = bufferLength-25; i < bufferLength; i++)
-    {
-      while (sensor.available() == false) //do we have new data?
-        sensor.check(); //Check the sensor for new data
+  //Switch right after emptying the FIFO, the sensor keeps sampling throughout
+  uint8_t wanted = requestedProfile;
+  if (wanted != appliedProfile)
+  {
+    const acquisitionProfile_t &p = acquisitionProfiles[wanted];
+    if (sensor.setAcquisition(p.sampleRate, p.pulseWidth, p.highres)) appliedProfile = wanted;
+  }
+}
 
-      digitalWrite(readLED, !digitalRead(readLED)); //Blink onboard LED with every data read
+#if defined(ESP32)
+void acquisitionTask(void *parameter)
+{
+  for (;;)
+  {
+    acquire();
+    vTaskDelay(1);
+  }
+}
+#endif
+
+//Queue depth and losses, nothing is lost while stalls and FIFO overflows stay 0
+void printStats()
+{
+  Serial.print(F("S:queued "));
+  Serial.print(samples.stats.pushed);
+  Serial.print(F(",highwater "));
+  Serial.print(samples.stats.highWater);
+  Serial.print(F(",stalls "));
+  Serial.print(samples.stats.stalls);
+  Serial.print(F(",overflows "));
+  Serial.println(sensor.getFIFOOverflows());
+}
 
-      redBuffer[i] = sensor.getRed();
-      irBuffer[i] = sensor.getIR();
-      sensor.nextSample(); //We're finished with this sample so move to next sample
+//Called by the pipeline for every sample
+void printSample(const ppgFrame &f)
+{
+  digitalWrite(readLED, !digitalRead(readLED)); //Blink onboard LED with every data read
 
-      // Send samples and calculation result to terminal program through UART
-      Serial.print(F("R:"));
-      Serial.print(redBuffer[i], DEC);
-      Serial.print(F(","));
-      Serial.print(irBuffer[i], DEC);
+  lastQuality = f.quality;
+#if ADAPTIVE_PROFILE
+  if (profileManagerUpdate(&profile, f.quality, f.flags)) requestedProfile = profile.wanted;
+#endif
+  if (f.quality != SQ_SETTLING && f.quality != SQ_NO_FINGER) lastFingerTime = millis(); //finger on the sensor
 
-      //Serial.print(F(",T:"));
-      //Serial.print(millis());
+#if STREAM_COMPRESSED
+  uint8_t length = ppgEncode(&encoder, f.red, f.ir);
+  if (length > 0) Serial.write(encoder.block, length);
+#else
+  // Send samples and calculation result to terminal program through UART
+  Serial.print(F("R:"));
+  Serial.print(f.red, DEC);
+  Serial.print(F(","));
+  Serial.print(f.ir, DEC);
 
-      //Serial.print(F(",H:"));
-      //Serial.print(heartRate, DEC);
+  //Serial.print(F(",T:"));
+  //Serial.print(millis());
 
-      //Serial.print(F(",B:"));
-      //Serial.print(validHeartRate, DEC);
+  Serial.print(F(",H:"));
+  Serial.print(lastResult.heartRate, DEC);
+
+  Serial.print(F(",B:"));
+  Serial.print(lastResult.validHeartRate, DEC);
+
+  Serial.print(F(",O:"));
+  Serial.print(lastResult.spo2, DEC);
+  
+  Serial.print(F(",V:"));
+  Serial.print(lastResult.validSPO2, DEC);
 
-      //Serial.print(F(",O:"));
-      //Serial.print(spo2, DEC);
-      
-	    //Serial.print(F(",V:"));
-      //Serial.println(validSPO2, DEC);
-	  }
+  Serial.print(F(",Q:"));
+  Serial.println(f.quality, DEC);
+#endif
+}
 
-    //After gathering 25 new samples recalculate HR and SP02
-    //maxim_heart_rate_and_oxygen_saturation(irBuffer, bufferLength, redBuffer, &spo2, &validSPO2, &heartRate, &validHeartRate);
+//Called by the pipeline before the first sample taken at a new profile or after the watchdog
+//restarted the sensor, samples are missing before that one
+void restartStages(uint8_t flags)
+{
+  if (flags & MAX30100_FLAG_RATE) profileManagerSwitched(&profile);
+  const acquisitionProfile_t &p = acquisitionProfiles[profile.current];
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - p.bits;
+  //The stages behind RATE run at its rate whatever the profile, they start over only after a gap
+  if (flags & MAX30100_FLAG_RESTART) pipeline.retune(p.sampleRate);
+  else pipeline.retune<RATE>(p.sampleRate);
+  if (flags & MAX30100_FLAG_RATE)
+  {
+    Serial.print(F("S:rate "));
+    Serial.println(p.sampleRate);
   }
-} 
+  if (flags & MAX30100_FLAG_RESTART)
+  {
+    Serial.print(F("S:watchdog restart "));
+    Serial.print(sensor.getRestarts());
+    Serial.print(F(",outage ms "));
+    Serial.println(sensor.getLastOutage());
+  }
+}
+
+//Called by the pipeline with every heart beat
+void beatDetected(const ppgBeatEvent &beat)
+{
+  digitalWrite(pulseLED, !digitalRead(pulseLED));
+}
+
+//Called by the pipeline every second with the SpO2 and heart rate of the last 4 seconds,
+//invalid with the reason in quality when the window was not worth calculating.
+//After a reset provisional results from the filling window come first, confidence below 100.
+void newResult(const ppgResult &result)
+{
+  lastResult = result;
+#if STREAM_COMPRESSED
+  Serial.print(F("H:"));
+  Serial.print(result.heartRate, DEC);
+  Serial.print(F(",B:"));
+  Serial.print(result.validHeartRate, DEC);
+  Serial.print(F(",O:"));
+  Serial.print(result.spo2, DEC);
+  Serial.print(F(",V:"));
+  Serial.print(result.validSPO2, DEC);
+  Serial.print(F(",Q:"));
+  Serial.println(result.quality, DEC);
+#endif
+}
@@ -0,0 +1,23 @@
+/*
+MAX30100 time base
+
+The driver waits and times out through a clock, millis() and delay() of the
+Arduino core unless setClock() hands it another one. The host tools pass a
+virtual clock that moves with the simulated sensor (MAX30100_Mock.h), so a
+session of hours runs in seconds.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+class MAX30100_Clock {
+ public:
+  virtual unsigned long millis(void) { return (::millis()); }
+  // Waiting, the sensor keeps sampling meanwhile
+  virtual void delay(unsigned long ms) { ::delay(ms); }
+};
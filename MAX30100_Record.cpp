@@ -0,0 +1,77 @@
+/*
+MAX30100 transaction recorder
+*/
+
+#include "MAX30100_Record.h"
+
+MAX30100_RecordTransport::MAX30100_RecordTransport(MAX30100_Transport &transport, Print &log) {
+  _transport = &transport;
+  _log = &log;
+  _lastUs = micros();
+  _timeMs = 0;
+  _timeFraction = 0;
+  records = 0;
+  bytes = 0;
+}
+
+void MAX30100_RecordTransport::begin(void) {
+  uint8_t header[MAX30100_LOG_HEADER] = { 'M', 'X', 'R', 'L', MAX30100_LOG_VERSION, _transport->maxBurst() };
+  bytes += _log->write(header, sizeof(header));
+  _lastUs = micros();
+  _timeMs = 0;
+  _timeFraction = 0;
+}
+
+//The replay adds up the same dt
+unsigned long MAX30100_RecordTransport::millis(void) {
+  return (_timeMs);
+}
+
+//Header of a record in one write, the data in a second
+void MAX30100_RecordTransport::record(uint8_t type, uint8_t address, uint8_t reg, uint8_t value, uint8_t status, const uint8_t *data, uint8_t len)
+{
+  uint8_t head[10];
+  uint8_t n = 0;
+  uint32_t now = micros();
+  uint32_t dt = now - _lastUs;
+  _lastUs = now;
+  _timeFraction += dt % 1000;
+  _timeMs += dt / 1000 + _timeFraction / 1000;
+  _timeFraction %= 1000;
+  head[n++] = type;
+  while (dt >= 0x80)
+  {
+    head[n++] = (uint8_t)(dt | 0x80);
+    dt >>= 7;
+  }
+  head[n++] = (uint8_t)dt;
+  head[n++] = address;
+  head[n++] = reg;
+  head[n++] = value;
+  head[n++] = status;
+  bytes += _log->write(head, n);
+  if (len > 0) bytes += _log->write(data, len);
+  records++;
+}
+
+uint8_t MAX30100_RecordTransport::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len) {
+  uint8_t status = _transport->readBurst(address, reg, buffer, len);
+  record(MAX30100_LOG_READ, address, reg, len, status, buffer, (status == MAX30100_I2C_OK) ? len : 0);
+  return (status);
+}
+
+uint8_t MAX30100_RecordTransport::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
+  uint8_t status = _transport->writeRegister8(address, reg, value);
+  record(MAX30100_LOG_WRITE, address, reg, value, status, NULL, 0);
+  return (status);
+}
+
+uint8_t MAX30100_RecordTransport::maxBurst(void) {
+  return (_transport->maxBurst());
+}
+
+bool MAX30100_RecordTransport::recoverBus(void) {
+  bool released = _transport->recoverBus();
+  record(MAX30100_LOG_RECOVER, 0, 0, 0, released ? 1 : 0, NULL, 0);
+  return (released);
+}
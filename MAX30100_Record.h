@@ -0,0 +1,74 @@
+/*
+MAX30100 transaction recorder
+
+Wraps the transport the driver uses and logs every transaction it passes on,
+pointer reads, FIFO bursts, register writes and bus recoveries, with the time
+since the previous one. Replaying the log on the host (host/MAX30100_Replay.h)
+feeds a MAX30100 instance exactly what check() saw in the field.
+
+It is also the driver's clock: millis() is the logged time of the last
+transaction, which is what the replay's clock gives at the same point, so
+the watchdog decides the same way in both.
+
+  MAX30100_WireTransport wire;              // or any other transport
+  File log = SD.open("i2c.log", FILE_WRITE);
+  MAX30100_RecordTransport recorder(wire, log);
+
+  wire.begin(Wire, I2C_SPEED_FAST);
+  recorder.begin();
+  sensor.setClock(recorder);
+  sensor.begin(recorder);
+
+Log:
+
+  header  "MXRL" version maxBurst
+  record  type  dt  address  reg  len|value  status  [data]
+
+  type     MAX30100_LOG_READ, _WRITE or _RECOVER
+  dt       us since the previous record, LEB128 varint
+  len      bytes read, for a write the value written
+  status   MAX30100_I2C_ status, for a recovery 1 if the bus was freed
+  data     len bytes, reads that succeeded only
+
+A FIFO burst costs its data plus 6 to 9 bytes.
+*/
+
+#pragma once
+
+#include "MAX30100_Transport.h"
+#include "MAX30100_Clock.h"
+
+#define MAX30100_LOG_MAGIC       "MXRL"
+#define MAX30100_LOG_VERSION     1
+#define MAX30100_LOG_HEADER      6     // magic, version, maxBurst
+
+#define MAX30100_LOG_READ        1
+#define MAX30100_LOG_WRITE       2
+#define MAX30100_LOG_RECOVER     3
+
+class MAX30100_RecordTransport : public MAX30100_Transport, public MAX30100_Clock {
+ public:
+  MAX30100_RecordTransport(MAX30100_Transport &transport, Print &log);
+
+  // Writes the log header, call once the wrapped transport is ready
+  void begin(void);
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t maxBurst(void);
+  bool recoverBus(void);
+
+  // Time of the last transaction since begin(), delay() waits in real time
+  unsigned long millis(void);
+
+  uint32_t records;  // transactions logged
+  uint32_t bytes;    // log size
+
+ private:
+  MAX30100_Transport *_transport;
+  Print *_log;
+  uint32_t _lastUs;
+  uint32_t _timeMs;        //Logged time, whole ms and the us over
+  uint16_t _timeFraction;
+  void record(uint8_t type, uint8_t address, uint8_t reg, uint8_t value, uint8_t status, const uint8_t *data, uint8_t len);
+};
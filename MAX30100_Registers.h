@@ -2,6 +2,8 @@
 MAX30100 register
 */
 
+#pragma once
+
 #define MAX30100_ADDRESS          0x57 //7-bit I2C Address
 #define MAX30100_FIFO_DEPTH       0x10
 
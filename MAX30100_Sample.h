@@ -0,0 +1,116 @@
+/*
+MAX3010x sample formats and sample ring
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+// Sample format traits
+// Describe one channel sample as it comes out of the FIFO data register:
+//  sample_t          smallest integer type holding a sample
+//  BITS              ADC resolution at the longest pulse width
+//  BYTES_PER_SAMPLE  bytes per channel in the FIFO, most significant byte first
+//  IR_FIRST          IR precedes red in a FIFO slot
+//  decode()          assembles one channel sample from the FIFO bytes
+
+// MAX30100, 16 bit, IR then red
+struct MAX30100_Format {
+  typedef uint16_t sample_t;
+  static const uint8_t BITS = 16;
+  static const uint8_t BYTES_PER_SAMPLE = 2;
+  static const bool IR_FIRST = true;
+  static inline sample_t decode(const uint8_t *p) {
+    return ((uint16_t)p[0] << 8) | p[1];
+  }
+};
+
+// MAX30102, 18 bit left in 3 bytes, red (LED1) then IR (LED2)
+struct MAX30102_Format {
+  typedef uint32_t sample_t;
+  static const uint8_t BITS = 18;
+  static const uint8_t BYTES_PER_SAMPLE = 3;
+  static const bool IR_FIRST = false;
+  static inline sample_t decode(const uint8_t *p) {
+    return (((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]) & 0x3FFFF;
+  }
+};
+
+// Sample flags, reported with each sample by getFIFOFlags()
+#define MAX30100_FLAG_RED_CURRENT    0x01 // red LED current changed, red DC level steps
+#define MAX30100_FLAG_IR_CURRENT     0x02 // IR LED current changed, IR DC level steps
+#define MAX30100_FLAG_RATE           0x04 // first sample after setAcquisition(), rate and resolution changed
+#define MAX30100_FLAG_RESTART        0x08 // first sample after the watchdog restarted the sensor, samples are missing before it
+
+// Circular buffer of readings from the sensor, read through one cursor per consumer
+// head counts the samples stored, a cursor the samples its consumer took. Both run freely
+// and are masked on access, SIZE must be a power of two no larger than 128. Every sample
+// is stored once whatever the number of consumers. The ring keeps what the slowest cursor
+// has not taken, up to SIZE samples; a consumer further behind loses its oldest sample to
+// each new one, counted in its overruns.
+template<class Format, uint8_t SIZE, uint8_t CONSUMERS = 1>
+struct MAX30100_Ring {
+  typedef typename Format::sample_t sample_t;
+  static const uint8_t SLOT_BYTES = 2 * Format::BYTES_PER_SAMPLE; //Red and IR
+  static const uint8_t MASK = SIZE - 1;
+  static const uint8_t NO_CONSUMER = 0xFF;
+  static_assert((SIZE & MASK) == 0 && SIZE <= 128, "ring size must be a power of two up to 128");
+
+  sample_t red[SIZE];
+  sample_t IR[SIZE];
+  byte flags[SIZE];
+  byte head;                     //Samples stored, the newest is at head - 1
+  byte cursor[CONSUMERS];        //Next sample of each consumer
+  uint16_t overruns[CONSUMERS];  //Samples each consumer lost
+  byte consumers;                //Cursors in use, cursor 0 always is
+
+  MAX30100_Ring() : head(0), consumers(1) {
+    cursor[0] = 0;
+    overruns[0] = 0;
+  }
+
+  //Another cursor, starting at the next sample stored, NO_CONSUMER when all are taken
+  uint8_t addConsumer(void) {
+    if (consumers >= CONSUMERS) return (NO_CONSUMER);
+    cursor[consumers] = head;
+    overruns[consumers] = 0;
+    return (consumers++);
+  }
+
+  //Samples the consumer has not taken yet, its lag behind the sensor
+  uint8_t available(uint8_t consumer = 0) const {
+    return ((uint8_t)(head - cursor[consumer]));
+  }
+
+  //Position of the newest sample and of the next sample of a consumer
+  uint8_t newest(void) const { return ((head - 1) & MASK); }
+  uint8_t oldest(uint8_t consumer = 0) const { return (cursor[consumer] & MASK); }
+
+  //Decode one FIFO slot and store it as the newest sample
+  void pushSlot(const uint8_t *slot, byte sampleFlags) {
+    for (uint8_t c = 0; c < consumers; c++)
+    {
+      if (available(c) < SIZE) continue;
+      cursor[c]++; //The slot it was about to read is reused
+      if (overruns[c] < 0xFFFF) overruns[c]++;
+    }
+    uint8_t i = head & MASK;
+    if (Format::IR_FIRST) {
+      IR[i]  = Format::decode(slot);
+      red[i] = Format::decode(slot + Format::BYTES_PER_SAMPLE);
+    } else {
+      red[i] = Format::decode(slot);
+      IR[i]  = Format::decode(slot + Format::BYTES_PER_SAMPLE);
+    }
+    flags[i] = sampleFlags;
+    head++;
+  }
+
+  void next(uint8_t consumer = 0) {
+    if (available(consumer)) cursor[consumer]++; //Only advance if new data is available
+  }
+};
@@ -0,0 +1,38 @@
+/*
+MAX30100 register access
+
+The driver reaches the sensor through a transport, so the same MAX30100 class
+runs on Arduino Wire (MAX30100_Wire.h), Linux i2c-dev and the simulated sensor
+of the host tools.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+// I2C transaction status
+// Codes 0..5 match the return values of Wire.endTransmission()
+#define MAX30100_I2C_OK              0 // success
+#define MAX30100_I2C_ERR_TOO_LONG    1 // data too long for the transmit buffer
+#define MAX30100_I2C_ERR_NACK_ADDR   2 // address not acknowledged, sensor absent or busy
+#define MAX30100_I2C_ERR_NACK_DATA   3 // data byte not acknowledged
+#define MAX30100_I2C_ERR_BUS         4 // other error, arbitration lost or bus fault
+#define MAX30100_I2C_ERR_TIMEOUT     5 // transaction did not complete within its time budget
+#define MAX30100_I2C_ERR_SHORT_READ  6 // fewer bytes received than requested
+
+class MAX30100_Transport {
+ public:
+  // Write the register address, then read len bytes after a repeated start
+  // Registers auto increment, except the FIFO data register
+  // Returns one of the MAX30100_I2C_ status codes
+  virtual uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len) = 0;
+  virtual uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value) = 0;
+  // Longest readBurst() the transport can do in one transaction
+  virtual uint8_t maxBurst(void) = 0;
+  // Free a stuck bus, returns true if the bus is usable afterwards
+  virtual bool recoverBus(void) { return (true); }
+};
@@ -0,0 +1,138 @@
+/*
+MAX30100 transport over Arduino Wire
+*/
+
+#include "MAX30100_Wire.h"
+
+MAX30100_WireTransport::MAX30100_WireTransport(void) {
+  _i2cPort = NULL;
+  _i2cSpeed = I2C_SPEED_STANDARD;
+  _byteTimeUs = 90;
+#if defined(SDA) && defined(SCL)
+  _sdaPin = SDA;
+  _sclPin = SCL;
+#else
+  _sdaPin = -1;
+  _sclPin = -1;
+#endif
+}
+
+void MAX30100_WireTransport::begin(TwoWire &wirePort, uint32_t i2cSpeed) {
+  _i2cPort = &wirePort; //Grab which port the user wants us to use
+
+  _i2cPort->begin();
+  _i2cPort->setClock(i2cSpeed);
+
+  _i2cSpeed = i2cSpeed;
+  // 8 data bits and ACK per byte
+  _byteTimeUs = (9 * 1000000UL + i2cSpeed - 1) / i2cSpeed;
+#if defined(WIRE_HAS_TIMEOUT)
+  // Let Wire abort and reset itself rather than hang on a stuck bus
+  _i2cPort->setWireTimeout(transactionTimeout(I2C_BUFFER_LENGTH), true);
+#endif
+}
+
+//Wire.requestFrom() is limited to the Wire buffer
+uint8_t MAX30100_WireTransport::maxBurst(void) {
+  return (I2C_BUFFER_LENGTH);
+}
+
+//Time budget for a transaction moving the given number of data bytes
+//Address byte and start/stop conditions count as two more bytes
+uint32_t MAX30100_WireTransport::transactionTimeout(uint8_t bytes)
+{
+  return ((uint32_t)(bytes + 2) * _byteTimeUs * MAX30100_I2C_TIMEOUT_FACTOR);
+}
+
+//Read a register or a burst starting at a register
+//Only the register pointer write is retried. Once bytes have been clocked out of
+//the FIFO data register they are gone, repeating the read would skip samples.
+uint8_t MAX30100_WireTransport::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len)
+{
+  uint8_t status = MAX30100_I2C_OK;
+  for (uint8_t attempt = 0; attempt < MAX30100_I2C_RETRIES; attempt++)
+  {
+    if (status == MAX30100_I2C_ERR_TIMEOUT || status == MAX30100_I2C_ERR_BUS) recoverBus();
+    _i2cPort->beginTransmission(address);
+    _i2cPort->write(reg);
+    status = _i2cPort->endTransmission(false); //Repeated start, keep the bus
+    if (status != MAX30100_I2C_OK) continue;
+
+    _i2cPort->requestFrom(address, len);
+    //Most cores return from requestFrom() with the data in place,
+    //others fill the receive buffer in the background, wait no longer than the bus needs
+    uint32_t timeout = transactionTimeout(len);
+    uint32_t startTime = micros();
+    while (_i2cPort->available() < len)
+    {
+      if (micros() - startTime > timeout) break;
+    }
+    int received = _i2cPort->available();
+    if (received < len)
+    {
+      while (_i2cPort->available()) _i2cPort->read(); //Drop the partial read
+      return (received > 0 ? MAX30100_I2C_ERR_SHORT_READ : MAX30100_I2C_ERR_TIMEOUT);
+    }
+    for (uint8_t i = 0; i < len; i++) buffer[i] = _i2cPort->read();
+    return (MAX30100_I2C_OK);
+  }
+  return (status);
+}
+
+uint8_t MAX30100_WireTransport::writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
+  uint8_t status = MAX30100_I2C_OK;
+  for (uint8_t attempt = 0; attempt < MAX30100_I2C_RETRIES; attempt++)
+  {
+    if (status == MAX30100_I2C_ERR_TIMEOUT || status == MAX30100_I2C_ERR_BUS) recoverBus();
+    _i2cPort->beginTransmission(address);
+    _i2cPort->write(reg);
+    _i2cPort->write(value);
+    status = _i2cPort->endTransmission();
+    if (status == MAX30100_I2C_OK) return (MAX30100_I2C_OK);
+  }
+  return (status);
+}
+
+void MAX30100_WireTransport::setBusRecoveryPins(int8_t sdaPin, int8_t sclPin) {
+  _sdaPin = sdaPin;
+  _sclPin = sclPin;
+}
+
+//Free a bus that a slave holds low after a transfer was interrupted mid byte
+//Returns true if both lines are high afterwards
+bool MAX30100_WireTransport::recoverBus(void)
+{
+  bool released = true;
+  if (_sdaPin >= 0 && _sclPin >= 0)
+  {
+#if !defined(ESP8266)
+    _i2cPort->end(); //Hand the pins back to GPIO
+#endif
+    //Half a clock period at the configured bus speed
+    uint16_t halfPeriodUs = 500000UL / _i2cSpeed + 1;
+    pinMode(_sdaPin, INPUT_PULLUP);
+    pinMode(_sclPin, INPUT_PULLUP);
+    //Up to 9 clocks let the slave finish the byte it is sending
+    for (uint8_t i = 0; i < 9 && digitalRead(_sdaPin) == LOW; i++)
+    {
+      pinMode(_sclPin, OUTPUT);
+      digitalWrite(_sclPin, LOW);
+      delayMicroseconds(halfPeriodUs);
+      pinMode(_sclPin, INPUT_PULLUP);
+      delayMicroseconds(halfPeriodUs);
+    }
+    //STOP condition, SDA rises while SCL is high
+    pinMode(_sdaPin, OUTPUT);
+    digitalWrite(_sdaPin, LOW);
+    delayMicroseconds(halfPeriodUs);
+    pinMode(_sdaPin, INPUT_PULLUP);
+    delayMicroseconds(halfPeriodUs);
+    released = (digitalRead(_sdaPin) == HIGH) && (digitalRead(_sclPin) == HIGH);
+  }
+  _i2cPort->begin();
+  _i2cPort->setClock(_i2cSpeed);
+#if defined(WIRE_HAS_TIMEOUT)
+  _i2cPort->setWireTimeout(transactionTimeout(I2C_BUFFER_LENGTH), true);
+#endif
+  return (released);
+}
@@ -0,0 +1,61 @@
+/*
+MAX30100 transport over Arduino Wire
+
+Retries failed transactions, bounds every transaction in time and frees a bus
+a slave holds low.
+*/
+
+#pragma once
+
+#include <Wire.h>
+#include "MAX30100_Transport.h"
+
+#define I2C_SPEED_STANDARD        100000
+#define I2C_SPEED_FAST            400000
+
+//Define the size of the I2C buffer based on the platform the user has
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
+
+  //I2C_BUFFER_LENGTH is defined in Wire.H
+  #define I2C_BUFFER_LENGTH BUFFER_LENGTH
+
+#elif defined(__SAMD21G18A__)
+
+  //SAMD21 uses RingBuffer.h
+  #define I2C_BUFFER_LENGTH SERIAL_BUFFER_SIZE
+
+#else
+
+  //The catch-all default is 32
+  #define I2C_BUFFER_LENGTH 32
+
+#endif
+
+// Attempts per transaction before giving up
+#define MAX30100_I2C_RETRIES         3
+// Time budget per transaction is this many times the nominal time on the bus,
+// leaves room for clock stretching and interrupt latency
+#define MAX30100_I2C_TIMEOUT_FACTOR  4
+
+class MAX30100_WireTransport : public MAX30100_Transport {
+ public:
+  MAX30100_WireTransport(void);
+  void begin(TwoWire &wirePort, uint32_t i2cSpeed);
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t maxBurst(void);
+
+  // Clocks SCL until a slave holding SDA low lets go, issues a STOP and restarts Wire
+  // Pins default to SDA/SCL of the board, set to -1 to only restart Wire
+  void setBusRecoveryPins(int8_t sdaPin, int8_t sclPin);
+  bool recoverBus(void);
+
+ private:
+  TwoWire *_i2cPort; //The generic connection to user's chosen I2C hardware
+  uint32_t _i2cSpeed;
+  uint16_t _byteTimeUs;  //Time to clock one byte plus ACK at _i2cSpeed
+  int8_t _sdaPin;
+  int8_t _sclPin;
+  uint32_t transactionTimeout(uint8_t bytes);
+};
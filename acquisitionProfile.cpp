@@ -0,0 +1,54 @@
+/*
+ Acquisition Profiles
+
+ Switching policy between the SLOW and FAST sensor settings. One decision per
+ processed frame, a compare and a counter, the switch itself is up to the
+ caller since only it knows when the bus is free.
+*/
+
+#include "acquisitionProfile.h"
+
+const acquisitionProfile_t acquisitionProfiles[PROFILE_COUNT] = {
+  {   50, 1600, true,  16 },  // PROFILE_SLOW
+  { 1000,  200, false, 13 },  // PROFILE_FAST
+};
+
+//  Start at profile, frames arrive at frameRate whatever the sensor rate
+void profileManagerInit(profileManager_t *m, uint8_t profile, uint16_t frameRate)
+{
+  m->current = profile;
+  m->wanted = profile;
+  m->stillFrames = 0;
+  m->stillLimit = (uint32_t)frameRate * PROFILE_STILL_MS / 1000;
+  m->holdoff = 0;
+}
+
+//  Process the quality of the next frame, flags are the driver's sample flags
+//  Returns true when the sensor should switch to the wanted profile
+bool profileManagerUpdate(profileManager_t *m, uint8_t quality, uint8_t flags)
+{
+  //  An LED current change steps the level, the quality index reads that as motion for a while
+  if (flags) m->holdoff = PROFILE_HOLDOFF;
+  if (m->holdoff > 0)
+  {
+    m->holdoff--;
+    if (quality == SQ_MOTION) return (false);
+  }
+
+  if (quality == SQ_MOTION) m->stillFrames = 0;
+  else if (m->stillFrames < m->stillLimit) m->stillFrames++;
+
+  //  One switch at a time, the last one has not reached the samples yet
+  if (m->wanted != m->current) return (false);
+
+  if ((m->current == PROFILE_SLOW) && (quality == SQ_MOTION)) m->wanted = PROFILE_FAST;
+  else if ((m->current == PROFILE_FAST) && (m->stillFrames >= m->stillLimit)) m->wanted = PROFILE_SLOW;
+  return (m->wanted != m->current);
+}
+
+//  The first sample taken at the wanted profile arrived
+void profileManagerSwitched(profileManager_t *m)
+{
+  m->current = m->wanted;
+  m->stillFrames = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ Acquisition Profiles
+
+ The sensor runs either SLOW, 50 samples/s with the 1600us pulse for 16 bit
+ resolution, or FAST, 1000 samples/s with the 200us pulse at 13 bit. SLOW
+ resolves the pulsatile signal of a resting finger at a fraction of the bus
+ traffic and LED power, FAST follows movement and averages down to the same
+ frame rate with less motion blur in each frame.
+
+ The profile manager picks one from the signal quality of the processed
+ frames: FAST as soon as motion is seen, back to SLOW once the finger was
+ still for PROFILE_STILL_MS.
+
+   profileManager_t profile;
+   profileManagerInit(&profile, PROFILE_SLOW, 50);
+   ...
+   if (profileManagerUpdate(&profile, f.quality, f.flags)) apply acquisitionProfiles[profile.wanted];
+   ...
+   profileManagerSwitched(&profile);   // first sample at the new profile arrived
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#include "signalQuality.h"
+
+#define PROFILE_SLOW      0
+#define PROFILE_FAST      1
+#define PROFILE_COUNT     2
+
+#define PROFILE_STILL_MS  5000  // no motion for this long returns to SLOW
+#define PROFILE_HOLDOFF   SQ_SETTLE_SAMPLES // frames after a level step whose motion is not believed
+
+typedef struct {
+  uint16_t sampleRate;  // samples/s
+  uint16_t pulseWidth;  // LED pulse width in us
+  bool     highres;     // high resolution SpO2 mode
+  uint8_t  bits;        // ADC resolution at this pulse width
+} acquisitionProfile_t;
+
+extern const acquisitionProfile_t acquisitionProfiles[PROFILE_COUNT];
+
+typedef struct {
+  uint8_t  current;     // profile of the samples arriving now
+  uint8_t  wanted;      // profile asked for, differs from current until the sensor switched
+  uint16_t stillFrames; // frames since the last one with motion
+  uint16_t stillLimit;  // PROFILE_STILL_MS in frames
+  uint8_t  holdoff;     // frames until motion counts again
+} profileManager_t;
+
+void profileManagerInit(profileManager_t *m, uint8_t profile, uint16_t frameRate);
+bool profileManagerUpdate(profileManager_t *m, uint8_t quality, uint8_t flags);
+void profileManagerSwitched(profileManager_t *m);
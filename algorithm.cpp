@@ -60,29 +60,80 @@
 #include "Arduino.h"
 #include "algorithm.h"
 
-#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-//Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
-//To solve this problem, 16-bit MSB of the sampled data will be truncated.  Samples become 16-bit data.
-void maxim_heart_rate_and_oxygen_saturation(uint16_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint16_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, 
-                int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#elif defined(ESP8266)
+#include <pgmspace.h>
+#endif
+// PROGMEM data is read through pgm_read_word wherever the core has it (flash on AVR
+// and ESP8266), directly only on the host where PROGMEM is empty
+#ifdef pgm_read_word
+#define SPO2_TABLE_READ(i) pgm_read_word(&spo2_table.values[i])
 #else
-void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, 
-                int32_t *pn_heart_rate, int8_t *pch_hr_valid)
+#define SPO2_TABLE_READ(i) (spo2_table.values[i])
+#endif
+#ifndef PROGMEM
+#define PROGMEM
 #endif
+
+// Compile time generation of the SpO2 lookup table from SPO2_CAL_A/B/C
+// Index sequence 0..N-1, built by halving so that template depth stays at log2(N)
+template<int... I> struct spo2_indices {};
+template<class A, class B> struct spo2_concat;
+template<int... A, int... B> struct spo2_concat<spo2_indices<A...>, spo2_indices<B...> > {
+  typedef spo2_indices<A..., (int)sizeof...(A) + B...> type;
+};
+template<int N> struct spo2_make_indices {
+  typedef typename spo2_concat<typename spo2_make_indices<N / 2>::type,
+                               typename spo2_make_indices<N - N / 2>::type>::type type;
+};
+template<> struct spo2_make_indices<0> { typedef spo2_indices<> type; };
+template<> struct spo2_make_indices<1> { typedef spo2_indices<0> type; };
+
+// SpO2 in 0.1% for table entry i, clamped to 0..100%
+constexpr double spo2_curve(double r) {
+  return SPO2_CAL_A * r * r + SPO2_CAL_B * r + SPO2_CAL_C;
+}
+constexpr uint16_t spo2_clamp(double f_spo2) {
+  return f_spo2 <= 0.0 ? 0 : f_spo2 >= 100.0 ? 1000 : (uint16_t)(f_spo2 * 10.0 + 0.5);
+}
+constexpr uint16_t spo2_entry(int i) {
+  return spo2_clamp(spo2_curve((double)i / SPO2_TABLE_RESOLUTION));
+}
+
+struct spo2_table_t { uint16_t values[SPO2_TABLE_SIZE]; };
+template<int... I> constexpr spo2_table_t spo2_generate(spo2_indices<I...>) {
+  return spo2_table_t{ { spo2_entry(I)... } };
+}
+
+// Lives in flash on AVR, read it with SPO2_TABLE_READ()
+static const spo2_table_t spo2_table PROGMEM = spo2_generate(spo2_make_indices<SPO2_TABLE_SIZE>::type());
+
+#if defined(MAXIM_RAM_BUDGET)
+static_assert(MAXIM_WORKSPACE_BYTES(BUFFER_SIZE) + MAXIM_STACK_BYTES <= MAXIM_RAM_BUDGET,
+              "workspace and stack of maxim_heart_rate_and_oxygen_saturation() exceed MAXIM_RAM_BUDGET");
+#endif
+
+template<typename sample_t>
+void maxim_heart_rate_and_oxygen_saturation(const sample_t *pun_ir_buffer, int32_t n_ir_buffer_length, const sample_t *pun_red_buffer, int32_t n_sample_rate,
+                int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes)
 /**
 * \brief        Calculate the heart rate and SpO2 level
 * \par          Details
 *               By detecting  peaks of PPG cycle and corresponding AC/DC of red/infra-red signal, the an_ratio for the SPO2 is computed.
 *               Since this algorithm is aiming for Arm M0/M3. formaula for SPO2 did not achieve the accuracy due to register overflow.
-*               Thus, accurate SPO2 is precalculated and save longo uch_spo2_table[] per each an_ratio.
+*               Thus, accurate SPO2 is precalculated at compile time and interpolated by maxim_spo2_from_ratio().
 *
 * \param[in]    *pun_ir_buffer           - IR sensor data buffer
 * \param[in]    n_ir_buffer_length      - IR sensor data buffer length
 * \param[in]    *pun_red_buffer          - Red sensor data buffer
+* \param[in]    n_sample_rate           - Samples per second of the buffers
 * \param[out]    *pn_spo2                - Calculated SpO2 value
 * \param[out]    *pch_spo2_valid         - 1 if the calculated SpO2 value is valid
 * \param[out]    *pn_heart_rate          - Calculated heart rate value
 * \param[out]    *pch_hr_valid           - 1 if the calculated heart rate value is valid
+* \param[in]    *pn_workspace            - Scratch memory of at least maxim_required_workspace_bytes(n_ir_buffer_length)
+* \param[in]    n_workspace_bytes       - Size of the scratch memory
 *
 * \retval       None
 */
@@ -91,7 +142,7 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   int32_t k, n_i_ratio_count;
   int32_t i, n_exact_ir_valley_locs_count, n_middle_idx;
   int32_t n_th1, n_npks;   
-  int32_t an_ir_valley_locs[15] ;
+  int32_t *an_ir_valley_locs;
   int32_t n_peak_interval_sum;
   
   int32_t n_y_ac, n_x_ac;
@@ -101,6 +152,19 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   int32_t n_x_dc_max_idx = 0; 
   int32_t an_ratio[5], n_ratio_average; 
   int32_t n_nume, n_denom ;
+  int32_t n_ma, n_ma_sum, n_ma_old;
+  int32_t *an_x, *an_y;
+
+  if (n_workspace_bytes < maxim_required_workspace_bytes(n_ir_buffer_length)){
+    *pn_spo2 = -999 ; // workspace too small, no result
+    *pch_spo2_valid = 0;
+    *pn_heart_rate = -999;
+    *pch_hr_valid = 0;
+    return;
+  }
+  an_x = pn_workspace; //ir
+  an_ir_valley_locs = pn_workspace + n_ir_buffer_length; //as many as the window can hold
+  an_y = an_ir_valley_locs + MAXIM_VALLEYS_LEN(n_ir_buffer_length); //red, peak detector queue until the valleys are found
 
   // calculates DC mean and subtract DC from ir
   un_ir_mean =0; 
@@ -111,27 +175,33 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   for (k=0 ; k<n_ir_buffer_length ; k++ )  
     an_x[k] = -1*(pun_ir_buffer[k] - un_ir_mean) ; 
     
-  // 4 pt Moving Average
-  for(k=0; k< BUFFER_SIZE-MA4_SIZE; k++){
-    an_x[k]=( an_x[k]+an_x[k+1]+ an_x[k+2]+ an_x[k+3])/(int)4;        
+  // Moving Average, 4 pt at 25 samples/s
+  n_ma = MAXIM_MA_SIZE(n_sample_rate);
+  if (n_ma < 1) n_ma = 1;
+  n_ma_sum = 0;
+  for (k=0; k<n_ma && k<n_ir_buffer_length; k++) n_ma_sum += an_x[k];
+  for(k=0; k< n_ir_buffer_length-n_ma; k++){
+    n_ma_old = an_x[k];
+    an_x[k]= n_ma_sum/n_ma;
+    n_ma_sum += an_x[k+n_ma] - n_ma_old;
   }
   // calculate threshold  
   n_th1=0; 
-  for ( k=0 ; k<BUFFER_SIZE ;k++){
+  for ( k=0 ; k<n_ir_buffer_length ;k++){
     n_th1 +=  an_x[k];
   }
-  n_th1=  n_th1/ ( BUFFER_SIZE);
+  n_th1=  n_th1/ ( n_ir_buffer_length);
   if( n_th1<30) n_th1=30; // min allowed
   if( n_th1>60) n_th1=60; // max allowed
 
-  for ( k=0 ; k<15;k++) an_ir_valley_locs[k]=0;
   // since we flipped signal, we use peak detector as valley detector
-  maxim_find_peaks( an_ir_valley_locs, &n_npks, an_x, BUFFER_SIZE, n_th1, 4, 15 );//peak_height, peak_distance, max_num_peaks 
+  maxim_find_peaks( an_ir_valley_locs, &n_npks, an_x, n_ir_buffer_length, n_th1, MAXIM_VALLEY_DISTANCE(n_sample_rate),
+                    MAXIM_VALLEYS_LEN(n_ir_buffer_length), an_y );//peak_height, peak_distance, max_num_peaks 
   n_peak_interval_sum =0;
   if (n_npks>=2){
     for (k=1; k<n_npks; k++) n_peak_interval_sum += (an_ir_valley_locs[k] -an_ir_valley_locs[k -1] ) ;
     n_peak_interval_sum =n_peak_interval_sum/(n_npks-1);
-    *pn_heart_rate =(int32_t)( (FreqS*60)/ n_peak_interval_sum );
+    *pn_heart_rate =(int32_t)( (n_sample_rate*60)/ n_peak_interval_sum );
     *pch_hr_valid  = 1;
   }
   else  { 
@@ -155,7 +225,7 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   n_i_ratio_count = 0; 
   for(k=0; k< 5; k++) an_ratio[k]=0;
   for (k=0; k< n_exact_ir_valley_locs_count; k++){
-    if (an_ir_valley_locs[k] > BUFFER_SIZE ){
+    if (an_ir_valley_locs[k] >= n_ir_buffer_length ){
       *pn_spo2 =  -999 ; // do not use SPO2 since valley loc is out of range
       *pch_spo2_valid  = 0; 
       return;
@@ -181,7 +251,9 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
       n_denom= ( n_x_ac *n_y_dc_max)>>7;
       if (n_denom>0  && n_i_ratio_count <5 &&  n_nume != 0)
       {   
-        an_ratio[n_i_ratio_count]= (n_nume*100)/n_denom ; //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max) ;
+        //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max), scaled by SPO2_RATIO_SCALE
+        //split into quotient and remainder so the scaling does not overflow
+        an_ratio[n_i_ratio_count]= (n_nume/n_denom)*SPO2_RATIO_SCALE + ((n_nume%n_denom)*SPO2_RATIO_SCALE)/n_denom ;
         n_i_ratio_count++;
       }
     }
@@ -195,10 +267,10 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
   else
     n_ratio_average = an_ratio[n_middle_idx ];
 
-  if( n_ratio_average>2 && n_ratio_average <184){
-    n_spo2_calc= uch_spo2_table[n_ratio_average] ;
-    *pn_spo2 = n_spo2_calc ;
-    *pch_spo2_valid  = 1;//  float_SPO2 =  -45.060*n_ratio_average* n_ratio_average/10000 + 30.354 *n_ratio_average/100 + 94.845 ;  // for comparison with table
+  if( n_ratio_average>2*SPO2_RATIO_SCALE/100 && n_ratio_average <SPO2_RATIO_MAX_X100*SPO2_RATIO_SCALE/100){
+    n_spo2_calc= maxim_spo2_from_ratio(n_ratio_average) ;
+    *pn_spo2 = (n_spo2_calc+5)/10 ;
+    *pch_spo2_valid  = 1;//  float_SPO2 =  SPO2_CAL_A*r*r + SPO2_CAL_B*r + SPO2_CAL_C ;  // for comparison with table
   }
   else{
     *pn_spo2 =  -999 ; // do not use SPO2 since signal an_ratio is out of range
@@ -207,77 +279,239 @@ void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_i
 }
 
 
-void maxim_find_peaks( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num )
+// 16 bit MAX30100 and 18 bit MAX30102 samples
+template void maxim_heart_rate_and_oxygen_saturation<uint16_t>(const uint16_t *pun_ir_buffer, int32_t n_ir_buffer_length, const uint16_t *pun_red_buffer, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes);
+template void maxim_heart_rate_and_oxygen_saturation<uint32_t>(const uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, const uint32_t *pun_red_buffer, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes);
+
+size_t maxim_required_workspace_bytes(int32_t n_window_len)
+/**
+* \brief        Workspace size
+* \par          Details
+*               Bytes of scratch memory maxim_heart_rate_and_oxygen_saturation() needs for a window
+*
+* \retval       Size in bytes
+*/
+{
+  return MAXIM_WORKSPACE_BYTES(n_window_len);
+}
+
+int32_t maxim_spo2_from_ratio(int32_t n_ratio)
+/**
+* \brief        SpO2 for a ratio
+* \par          Details
+*               Linear interpolation between the two nearest entries of the calibration table
+*
+* \param[in]    n_ratio                 - (AC_red/DC_red)/(AC_ir/DC_ir) x SPO2_RATIO_SCALE
+*
+* \retval       SpO2 in 0.1%
+*/
+{
+  int32_t n_pos, n_idx, n_frac;
+  if (n_ratio < 0) n_ratio = 0;
+  n_pos = n_ratio * SPO2_TABLE_RESOLUTION;
+  n_idx = n_pos / SPO2_RATIO_SCALE;
+  n_frac = n_pos % SPO2_RATIO_SCALE;
+  if (n_idx >= SPO2_TABLE_SIZE-1) return SPO2_TABLE_READ(SPO2_TABLE_SIZE-1);
+  return ( (int32_t)SPO2_TABLE_READ(n_idx)*(SPO2_RATIO_SCALE-n_frac) + (int32_t)SPO2_TABLE_READ(n_idx+1)*n_frac
+           + SPO2_RATIO_SCALE/2 ) / SPO2_RATIO_SCALE;
+}
+
+void maxim_find_peaks( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num,
+                void *p_queue )
 /**
 * \brief        Find peaks
 * \par          Details
 *               Find at most MAX_NUM peaks above MIN_HEIGHT separated by at least MIN_DISTANCE
+*               p_queue holds MAXIM_PEAK_QUEUE_BYTES(n_size)
 *
 * \retval       None
 */
 {
-  maxim_peaks_above_min_height( pn_locs, n_npks, pn_x, n_size, n_min_height );
-  maxim_remove_close_peaks( pn_locs, n_npks, pn_x, n_min_distance );
-  *n_npks = min( *n_npks, n_max_num );
+  maxim_peak_detector_t peak_detector;
+  int32_t k;
+  maxim_peak_detector_init( &peak_detector, pn_locs, n_max_num, n_min_height, n_min_distance, p_queue, MAXIM_PEAK_QUEUE_LEN(n_size) );
+  for ( k = 0; k < n_size; k++ )
+    maxim_peak_detector_update( &peak_detector, pn_x[k] );
+  *n_npks = maxim_peak_detector_finish( &peak_detector );
 }
 
-void maxim_peaks_above_min_height( int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height )
+#define PEAK_UNDECIDED   0
+#define PEAK_KEPT        1
+#define PEAK_SUPPRESSED  2
+#define PEAK_HORIZON_END 0x7FFFFFFF
+
+static inline int32_t maxim_peak_queue_slot(const maxim_peak_detector_t *p_det, int32_t n_pos)
 /**
-* \brief        Find peaks above n_min_height
+* \brief        Slot of the n_pos-th queued candidate, the queue is a ring of n_queue_size
+*
+* \retval       Index into the queue arrays
+*/
+{
+  int32_t n_slot = p_det->n_queue_head + n_pos;
+  if (n_slot >= p_det->n_queue_size) n_slot -= p_det->n_queue_size;
+  return n_slot;
+}
+#define PEAK_QUEUE(p_det, n_pos) maxim_peak_queue_slot(p_det, n_pos)
+
+void maxim_peak_detector_init(maxim_peak_detector_t *p_det, int32_t *pn_locs, int32_t n_max_num, int32_t n_min_height, int32_t n_min_distance,
+                void *p_queue, int32_t n_queue_size)
+/**
+* \brief        Start a peak detector
 * \par          Details
-*               Find all peaks above MIN_HEIGHT
+*               Peaks are written to pn_locs as soon as they are decided, at most n_max_num of them.
+*               p_queue holds n_queue_size entries, MAXIM_PEAK_QUEUE_LEN() of the samples to come
+*               for results equal to removing close peaks from all peaks at once.
 *
 * \retval       None
 */
 {
-  int32_t i = 1, n_width;
-  *n_npks = 0;
-  
-  while (i < n_size-1){
-    if (pn_x[i] > n_min_height && pn_x[i] > pn_x[i-1]){      // find left edge of potential peaks
-      n_width = 1;
-      while (i+n_width < n_size && pn_x[i] == pn_x[i+n_width])  // find flat peaks
-        n_width++;
-      if (pn_x[i] > pn_x[i+n_width] && (*n_npks) < 15 ){      // find right edge of peaks
-        pn_locs[(*n_npks)++] = i;    
-        // for flat peaks, peak location is left edge
-        i += n_width+1;
-      }
-      else
-        i += n_width;
+  p_det->pn_queue_vals = (int32_t *)p_queue;
+  p_det->pn_queue_locs = (int16_t *)(p_det->pn_queue_vals + n_queue_size);
+  p_det->pn_queue_stack = p_det->pn_queue_locs + n_queue_size;
+  p_det->pch_queue_state = (int8_t *)(p_det->pn_queue_stack + n_queue_size);
+  p_det->n_queue_size = n_queue_size;
+  p_det->pn_locs = pn_locs;
+  p_det->n_max_num = n_max_num;
+  p_det->n_npks = 0;
+  p_det->n_min_height = n_min_height;
+  p_det->n_min_distance = n_min_distance;
+  p_det->n_index = 0;
+  p_det->n_prev = 0;
+  p_det->n_plateau_loc = -1;
+  p_det->n_plateau_val = 0;
+  p_det->n_last_kept_loc = -1 - n_min_distance; // none yet
+  p_det->n_queue_head = 0;
+  p_det->n_queue_count = 0;
+}
+
+static bool maxim_peak_decide(maxim_peak_detector_t *p_det, int32_t n_start, int32_t n_horizon)
+/**
+* \brief        Decide a queued candidate
+* \par          Details
+*               A candidate is kept unless a higher neighbour within MIN_DISTANCE is kept, equal heights
+*               favour the earlier one. Undecided higher neighbours are decided first, depth first.
+*               Gives up if a candidate on the way may still get a neighbour at or after n_horizon.
+*               A kept neighbour suppresses whatever its height: lower kept ones only exist after
+*               an early decision, and keeping both would break MIN_DISTANCE.
+*
+* \retval       true if n_start was decided
+*/
+{
+  int16_t *pn_stack = p_det->pn_queue_stack;
+  int32_t n_depth, n_pos, n_q, n_t, n_higher;
+  bool b_suppressed;
+
+  pn_stack[0] = n_start;
+  n_depth = 1;
+  while (n_depth > 0){
+    n_pos = pn_stack[n_depth-1];
+    n_t = PEAK_QUEUE(p_det, n_pos);
+    if (p_det->pn_queue_locs[n_t] + p_det->n_min_distance >= n_horizon) return false;
+    b_suppressed = p_det->pn_queue_locs[n_t] - p_det->n_last_kept_loc <= p_det->n_min_distance;
+    n_higher = -1;
+    // neighbours are contiguous in the queue, scan left then right
+    for (n_q = n_pos-1; n_q >= 0 && n_higher < 0; n_q--){
+      int32_t n_i = PEAK_QUEUE(p_det, n_q);
+      if (p_det->pn_queue_locs[n_t] - p_det->pn_queue_locs[n_i] > p_det->n_min_distance) break;
+      if (p_det->pch_queue_state[n_i] == PEAK_KEPT) b_suppressed = true;
+      else if (p_det->pch_queue_state[n_i] == PEAK_UNDECIDED && p_det->pn_queue_vals[n_i] >= p_det->pn_queue_vals[n_t]) n_higher = n_q;
     }
-    else
-      i++;
+    for (n_q = n_pos+1; n_q < p_det->n_queue_count && n_higher < 0; n_q++){
+      int32_t n_i = PEAK_QUEUE(p_det, n_q);
+      if (p_det->pn_queue_locs[n_i] - p_det->pn_queue_locs[n_t] > p_det->n_min_distance) break;
+      if (p_det->pch_queue_state[n_i] == PEAK_KEPT) b_suppressed = true;
+      else if (p_det->pch_queue_state[n_i] == PEAK_UNDECIDED && p_det->pn_queue_vals[n_i] > p_det->pn_queue_vals[n_t]) n_higher = n_q;
+    }
+    if (n_higher >= 0){
+      pn_stack[n_depth++] = n_higher; // each higher neighbour is pushed at most once
+      continue;
+    }
+    p_det->pch_queue_state[n_t] = b_suppressed ? PEAK_SUPPRESSED : PEAK_KEPT;
+    n_depth--;
   }
+  return true;
 }
 
-void maxim_remove_close_peaks(int32_t *pn_locs, int32_t *pn_npks, int32_t *pn_x, int32_t n_min_distance)
+static void maxim_peak_drain(maxim_peak_detector_t *p_det, int32_t n_horizon)
 /**
-* \brief        Remove peaks
+* \brief        Emit decided candidates
 * \par          Details
-*               Remove peaks separated by less than MIN_DISTANCE
+*               Decides and removes candidates from the front of the queue while possible.
+*               Kept ones are emitted in ascending order of location.
 *
 * \retval       None
 */
 {
-    
-  int32_t i, j, n_old_npks, n_dist;
-    
-  /* Order peaks from large to small */
-  maxim_sort_indices_descend( pn_x, pn_locs, *pn_npks );
+  while (p_det->n_queue_count > 0){
+    int32_t n_f = p_det->n_queue_head;
+    if (p_det->pch_queue_state[n_f] == PEAK_UNDECIDED && !maxim_peak_decide(p_det, 0, n_horizon)) return;
+    if (p_det->pch_queue_state[n_f] == PEAK_KEPT){
+      p_det->n_last_kept_loc = p_det->pn_queue_locs[n_f];
+      if (p_det->n_npks < p_det->n_max_num) p_det->pn_locs[p_det->n_npks++] = p_det->pn_queue_locs[n_f];
+    }
+    p_det->n_queue_head = PEAK_QUEUE(p_det, 1);
+    p_det->n_queue_count--;
+  }
+}
 
-  for ( i = -1; i < *pn_npks; i++ ){
-    n_old_npks = *pn_npks;
-    *pn_npks = i+1;
-    for ( j = i+1; j < n_old_npks; j++ ){
-      n_dist =  pn_locs[j] - ( i == -1 ? -1 : pn_locs[i] ); // lag-zero peak of autocorr is at index -1
-      if ( n_dist > n_min_distance || n_dist < -n_min_distance )
-        pn_locs[(*pn_npks)++] = pn_locs[j];
+void maxim_peak_detector_update(maxim_peak_detector_t *p_det, int32_t n_x)
+/**
+* \brief        Feed the next sample
+* \par          Details
+*               A peak is the left edge of a plateau above MIN_HEIGHT that rises from the
+*               previous sample and falls after the plateau.
+*
+* \retval       None
+*/
+{
+  int32_t n_horizon;
+  if (p_det->n_index > 0){
+    if (p_det->n_plateau_loc >= 0){
+      if (n_x < p_det->n_plateau_val){ // right edge, we have a peak
+        // peaks closer than MIN_DISTANCE to the start are dropped
+        if (p_det->n_plateau_loc >= p_det->n_min_distance){
+          if (p_det->n_queue_count == p_det->n_queue_size){
+            maxim_peak_decide(p_det, 0, PEAK_HORIZON_END); // queue sized for fewer samples, decide the oldest with what we know
+            maxim_peak_drain(p_det, p_det->n_plateau_loc);
+          }
+          int32_t n_b = PEAK_QUEUE(p_det, p_det->n_queue_count);
+          p_det->pn_queue_locs[n_b] = p_det->n_plateau_loc;
+          p_det->pn_queue_vals[n_b] = p_det->n_plateau_val;
+          p_det->pch_queue_state[n_b] = PEAK_UNDECIDED;
+          p_det->n_queue_count++;
+        }
+        p_det->n_plateau_loc = -1;
+      }
+      else if (n_x > p_det->n_plateau_val)
+        p_det->n_plateau_loc = -1; // plateau continues upward, not a peak
+    }
+    if (p_det->n_plateau_loc < 0 && n_x > p_det->n_min_height && n_x > p_det->n_prev){
+      p_det->n_plateau_loc = p_det->n_index; // left edge of potential peak
+      p_det->n_plateau_val = n_x;
     }
   }
+  p_det->n_prev = n_x;
+  p_det->n_index++;
+  // no candidate found later can start before the horizon
+  n_horizon = p_det->n_plateau_loc >= 0 ? p_det->n_plateau_loc : p_det->n_index;
+  if (p_det->n_queue_count > 0 && p_det->pn_queue_locs[p_det->n_queue_head] + p_det->n_min_distance < n_horizon)
+    maxim_peak_drain(p_det, n_horizon);
+}
 
-  // Resort indices int32_to ascending order
-  maxim_sort_ascend( pn_locs, *pn_npks );
+int32_t maxim_peak_detector_finish(maxim_peak_detector_t *p_det)
+/**
+* \brief        End of data
+* \par          Details
+*               A plateau still open at the end is not a peak. Decides all queued candidates.
+*
+* \retval       Number of peaks in pn_locs
+*/
+{
+  p_det->n_plateau_loc = -1;
+  maxim_peak_drain(p_det, PEAK_HORIZON_END);
+  return p_det->n_npks;
 }
 
 void maxim_sort_ascend(int32_t  *pn_x, int32_t n_size) 
@@ -297,25 +531,3 @@ void maxim_sort_ascend(int32_t  *pn_x, int32_t n_size)
     pn_x[j] = n_temp;
   }
 }
-
-void maxim_sort_indices_descend(  int32_t  *pn_x, int32_t *pn_indx, int32_t n_size)
-/**
-* \brief        Sort indices
-* \par          Details
-*               Sort indices according to descending order (insertion sort algorithm)
-*
-* \retval       None
-*/ 
-{
-  int32_t i, j, n_temp;
-  for (i = 1; i < n_size; i++) {
-    n_temp = pn_indx[i];
-    for (j = i; j > 0 && pn_x[n_temp] > pn_x[pn_indx[j-1]]; j--)
-      pn_indx[j] = pn_indx[j-1];
-    pn_indx[j] = n_temp;
-  }
-}
-
-
-
-
@@ -64,39 +64,121 @@
 
 #include <Arduino.h>
 
-#define FreqS 25    //sampling frequency
+#define FreqS 25    //sampling frequency of the sketch's SpO2 window
 #define BUFFER_SIZE (FreqS * 4) 
 #define MA4_SIZE 4 // DONOT CHANGE
 //#define min(x,y) ((x) < (y) ? (x) : (y)) //Defined in Arduino.h
 
-//uch_spo2_table is approximated as  -45.060*ratioAverage* ratioAverage + 30.354 *ratioAverage + 94.845 ;
-const uint8_t uch_spo2_table[184]={ 95, 95, 95, 96, 96, 96, 97, 97, 97, 97, 97, 98, 98, 98, 98, 98, 99, 99, 99, 99, 
-              99, 99, 99, 99, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 100, 
-              100, 100, 100, 100, 99, 99, 99, 99, 99, 99, 99, 99, 98, 98, 98, 98, 98, 98, 97, 97, 
-              97, 97, 96, 96, 96, 96, 95, 95, 95, 94, 94, 94, 93, 93, 93, 92, 92, 92, 91, 91, 
-              90, 90, 89, 89, 89, 88, 88, 87, 87, 86, 86, 85, 85, 84, 84, 83, 82, 82, 81, 81, 
-              80, 80, 79, 78, 78, 77, 76, 76, 75, 74, 74, 73, 72, 72, 71, 70, 69, 69, 68, 67, 
-              66, 66, 65, 64, 63, 62, 62, 61, 60, 59, 58, 57, 56, 56, 55, 54, 53, 52, 51, 50, 
-              49, 48, 47, 46, 45, 44, 43, 42, 41, 40, 39, 38, 37, 36, 35, 34, 33, 31, 30, 29, 
-              28, 27, 26, 25, 23, 22, 21, 20, 19, 17, 16, 15, 14, 12, 11, 10, 9, 7, 6, 5, 
-              3, 2, 1 } ;
-static  int32_t an_x[ BUFFER_SIZE]; //ir
-static  int32_t an_y[ BUFFER_SIZE]; //red
+// SpO2 calibration curve SpO2 = A*r*r + B*r + C in percent, r = (AC_red/DC_red)/(AC_ir/DC_ir)
+// The lookup table is generated from these at compile time, define them in the build flags
+// to recalibrate for a sensor batch.
+#ifndef SPO2_CAL_A
+#define SPO2_CAL_A (-45.060)
+#endif
+#ifndef SPO2_CAL_B
+#define SPO2_CAL_B 30.354
+#endif
+#ifndef SPO2_CAL_C
+#define SPO2_CAL_C 94.845
+#endif
+// Table entries per unit of r, values in between are interpolated
+#ifndef SPO2_TABLE_RESOLUTION
+#define SPO2_TABLE_RESOLUTION 100
+#endif
+#define SPO2_RATIO_MAX_X100 184  // largest valid r x100
+#define SPO2_TABLE_SIZE (SPO2_RATIO_MAX_X100 * SPO2_TABLE_RESOLUTION / 100 + 2)
+#define SPO2_RATIO_SCALE 256     // fixed point scale of r passed to maxim_spo2_from_ratio()
+
+// Valleys closer than 160 ms compete, the 4 samples at 25 samples/s of the original
+#define MAXIM_VALLEY_DISTANCE(n_sample_rate) ((n_sample_rate) * 4 / 25)
+// Moving average ahead of the valley search over 160 ms too, MA4_SIZE points at 25 samples/s
+#define MAXIM_MA_SIZE(n_sample_rate) ((n_sample_rate) * MA4_SIZE / 25)
+// Valleys a window can hold, one per peak detector candidate
+#define MAXIM_VALLEYS_LEN(n_window_len) MAXIM_PEAK_QUEUE_LEN(n_window_len)
+
+// Workspace of maxim_heart_rate_and_oxygen_saturation(), the filtered IR of the window as int32_t, the
+// valleys and the peak detector's queue, whose space takes the raw red (4 bytes a sample, less than the
+// queue) afterwards. Nothing is kept between calls, one workspace can serve several sensors processed
+// in turn. Rounded up to whole int32_t, workspaces are int32_t arrays.
+#define MAXIM_WORKSPACE_BYTES(n_window_len) \
+  ((sizeof(int32_t) * ((n_window_len) + MAXIM_VALLEYS_LEN(n_window_len)) + MAXIM_PEAK_QUEUE_BYTES(n_window_len) + \
+    sizeof(int32_t) - 1) & ~(sizeof(int32_t) - 1))
+size_t maxim_required_workspace_bytes(int32_t n_window_len);
 
+// Buffers hold the sample_t of the sensor's sample format, see MAX30100_Sample.h, taken at n_sample_rate.
+// Instantiated in algorithm.cpp for uint16_t (MAX30100) and uint32_t (MAX30102).
+template<typename sample_t>
+void maxim_heart_rate_and_oxygen_saturation(const sample_t *pun_ir_buffer, int32_t n_ir_buffer_length, const sample_t *pun_red_buffer, int32_t n_sample_rate,
+                int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid,
+                int32_t *pn_workspace, size_t n_workspace_bytes);
 
-#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega168__)
-//Arduino Uno doesn't have enough SRAM to store 100 samples of IR led data and red led data in 32-bit format
-//To solve this problem, 16-bit MSB of the sampled data will be truncated.  Samples become 16-bit data.
-void maxim_heart_rate_and_oxygen_saturation(uint16_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint16_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+int32_t maxim_spo2_from_ratio(int32_t n_ratio);
+void maxim_find_peaks(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num,
+                void *p_queue);
+void maxim_sort_ascend(int32_t  *pn_x, int32_t n_size);
+
+// Streaming peak detector
+// Peaks closer than n_min_distance compete, the higher one wins. Competing candidates wait
+// in a queue until every higher neighbour is decided. A peak rises and falls, so candidates are
+// at least 2 samples apart and a queue of MAXIM_PEAK_QUEUE_LEN(n) entries holds every candidate
+// of n samples: nothing is decided early, at any sample rate. A queue sized for fewer samples
+// than it gets decides its oldest entry early when full, never keeping a peak within
+// n_min_distance of a kept one. Windows up to 32767 samples, queue locations are int16_t.
+#define MAXIM_PEAK_QUEUE_LEN(n_window_len) ((n_window_len) / 2 + 1)
+// Height, location, stack slot of the depth first decision and state of each entry
+#define MAXIM_PEAK_QUEUE_BYTES(n_window_len) \
+  (MAXIM_PEAK_QUEUE_LEN(n_window_len) * (sizeof(int32_t) + 2 * sizeof(int16_t) + sizeof(int8_t)))
+
+typedef struct {
+  int32_t *pn_locs;            // output, peak locations in ascending order
+  int32_t n_max_num;           // size of pn_locs
+  int32_t n_npks;              // peaks written to pn_locs so far
+  int32_t n_min_height;
+  int32_t n_min_distance;
+  int32_t n_index;             // index of the next sample
+  int32_t n_prev;              // previous sample
+  int32_t n_plateau_loc;       // left edge of a rising plateau above n_min_height, -1 if none
+  int32_t n_plateau_val;
+  int32_t n_last_kept_loc;     // most recent peak that left the queue as kept
+  int32_t *pn_queue_vals;      // queue in the caller's memory, n_queue_size entries
+  int16_t *pn_queue_locs;
+  int16_t *pn_queue_stack;
+  int8_t  *pch_queue_state;
+  int32_t n_queue_size;
+  int32_t n_queue_head;
+  int32_t n_queue_count;
+} maxim_peak_detector_t;
+
+// p_queue holds MAXIM_PEAK_QUEUE_BYTES(n) for n_queue_size = MAXIM_PEAK_QUEUE_LEN(n), int32_t aligned
+void maxim_peak_detector_init(maxim_peak_detector_t *p_det, int32_t *pn_locs, int32_t n_max_num, int32_t n_min_height, int32_t n_min_distance,
+                void *p_queue, int32_t n_queue_size);
+void maxim_peak_detector_update(maxim_peak_detector_t *p_det, int32_t n_x);
+int32_t maxim_peak_detector_finish(maxim_peak_detector_t *p_det);
+
+// Stack of one maxim_heart_rate_and_oxygen_saturation() call, the locals of each function on its
+// deepest call path and a call frame for each. Keep these in step with the declarations in
+// algorithm.cpp, the host build checks the sum against -fstack-usage (host/stack_check.cpp).
+// maxim_heart_rate_and_oxygen_saturation(): ratio array, 22 scalars, an_x, an_y and the valleys
+#define MAXIM_HR_LOCALS_BYTES ((5 + 22) * sizeof(int32_t) + 3 * sizeof(int32_t *))
+// maxim_find_peaks(): the detector and k
+#define MAXIM_FIND_PEAKS_LOCALS_BYTES (sizeof(maxim_peak_detector_t) + sizeof(int32_t))
+// maxim_peak_detector_update(): n_horizon, n_b
+#define MAXIM_PEAK_UPDATE_LOCALS_BYTES (2 * sizeof(int32_t))
+// maxim_peak_drain(): n_f
+#define MAXIM_PEAK_DRAIN_LOCALS_BYTES (sizeof(int32_t))
+// maxim_peak_decide(): pn_stack, 6 scalars and b_suppressed, its stack is in the queue
+#define MAXIM_PEAK_DECIDE_LOCALS_BYTES (sizeof(int16_t *) + 6 * sizeof(int32_t) + sizeof(bool))
+// Return address and the registers a function saves, at most
+#if defined(__AVR__)
+#define MAXIM_CALL_FRAME_BYTES 21  // 3 byte return address, 18 call-saved registers
 #else
-void maxim_heart_rate_and_oxygen_saturation(uint32_t *pun_ir_buffer, int32_t n_ir_buffer_length, uint32_t *pun_red_buffer, int32_t *pn_spo2, int8_t *pch_spo2_valid, int32_t *pn_heart_rate, int8_t *pch_hr_valid);
+#define MAXIM_CALL_FRAME_BYTES (8 * sizeof(void *))
 #endif
+#define MAXIM_STACK_BYTES (MAXIM_HR_LOCALS_BYTES + MAXIM_FIND_PEAKS_LOCALS_BYTES + MAXIM_PEAK_UPDATE_LOCALS_BYTES + \
+                           MAXIM_PEAK_DRAIN_LOCALS_BYTES + MAXIM_PEAK_DECIDE_LOCALS_BYTES + 5 * MAXIM_CALL_FRAME_BYTES)
 
-void maxim_find_peaks(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance, int32_t n_max_num);
-void maxim_peaks_above_min_height(int32_t *pn_locs, int32_t *n_npks,  int32_t  *pn_x, int32_t n_size, int32_t n_min_height);
-void maxim_remove_close_peaks(int32_t *pn_locs, int32_t *pn_npks, int32_t *pn_x, int32_t n_min_distance);
-void maxim_sort_ascend(int32_t  *pn_x, int32_t n_size);
-void maxim_sort_indices_descend(int32_t  *pn_x, int32_t *pn_indx, int32_t n_size);
+// MAXIM_RAM_BUDGET=<bytes> fails the build if workspace and stack for a BUFFER_SIZE window
+// together exceed the budget.
 
 #endif /* ALGORITHM_H_ */
 
@@ -0,0 +1,111 @@
+/*
+ Autocorrelation Heart Rate
+
+ Per sample:    r[lag] += (x[n] * x[n - lag] - r[lag]) / 2^ACF_SHIFT   for lag 0..lagMax+1
+ Per estimate:  earliest strong local maximum of r over lagMin..lagMax
+
+ Lags outside the searched range but next to it are kept so the
+ interpolation has both neighbours.
+*/
+
+#include "autocorrHR.h"
+
+//  Set up the lag range for the sample rate, an estimate every updateInterval samples
+void autocorrHRInit(autocorrHR_t *a, uint16_t sampleRate, uint16_t updateInterval)
+{
+  uint16_t lagMin = (60UL * sampleRate) / ACF_MAX_BPM;
+  uint16_t lagMax = (60UL * sampleRate + ACF_MIN_BPM - 1) / ACF_MIN_BPM;
+  if (lagMin < 1) lagMin = 1;
+  if (lagMax > ACF_MAX_LAG - 1) lagMax = ACF_MAX_LAG - 1;
+  if (lagMin > lagMax) lagMin = lagMax;
+  a->lagMin = lagMin;
+  a->lagMax = lagMax;
+  a->sampleRate = sampleRate;
+  a->updateInterval = updateInterval;
+  a->bpm = 0;
+  a->confidence = 0;
+  autocorrHRReset(a);
+}
+
+//  Forget history and averages, for example after a finger change
+void autocorrHRReset(autocorrHR_t *a)
+{
+  for (uint8_t i = 0; i < ACF_MAX_LAG; i++) a->history[i] = 0;
+  for (uint8_t i = 0; i <= ACF_MAX_LAG; i++) a->r[i] = 0;
+  a->dc = 0;
+  a->prev = 0;
+  a->pos = 0;
+  a->countdown = a->updateInterval;
+  a->settle = a->lagMax + (1 << ACF_SHIFT);
+}
+
+//  Estimate the period from the correlation
+static void autocorrHREstimate(autocorrHR_t *a)
+{
+  const int32_t *r = a->r;
+
+  //  Strongest local maximum
+  int32_t best = 0;
+  for (uint8_t lag = a->lagMin; lag <= a->lagMax; lag++)
+  {
+    if ((r[lag] > r[lag - 1]) && (r[lag] >= r[lag + 1]) && (r[lag] > best)) best = r[lag];
+  }
+  if ((best <= 0) || (r[0] <= 0))
+  {
+    a->bpm = 0;
+    a->confidence = 0;
+    return;
+  }
+
+  //  Earliest local maximum close to it, later ones are multiples of the period
+  float threshold = best * (ACF_PEAK_PERCENT / 100.0f);
+  uint8_t lag = a->lagMin;
+  while ((lag < a->lagMax) && !((r[lag] > r[lag - 1]) && (r[lag] >= r[lag + 1]) && (r[lag] >= threshold))) lag++;
+
+  //  Parabolic interpolation with the neighbours
+  float left = r[lag - 1], center = r[lag], right = r[lag + 1];
+  float period = lag;
+  float denom = left - 2.0f * center + right;
+  if (denom < 0.0f) period += 0.5f * (left - right) / denom;
+
+  a->bpm = (int16_t)(600.0f * a->sampleRate / period + 0.5f);
+  float confidence = 100.0f * center / r[0];
+  a->confidence = (confidence > 100.0f) ? 100 : (uint8_t)(confidence + 0.5f);
+}
+
+//  Process next IR sample
+//  Returns true when bpm and confidence were updated
+bool autocorrHRUpdate(autocorrHR_t *a, uint32_t sample)
+{
+  //  Seed the DC level with the first sample, then remove it
+  if (a->dc == 0) a->dc = (int32_t)sample << 8;
+  a->dc += (((int32_t)sample << 8) - a->dc) >> ACF_DC_SHIFT;
+  int32_t ac = (int32_t)sample - (a->dc >> 8);
+  if (ac > ACF_AC_LIMIT) ac = ACF_AC_LIMIT;
+  if (ac < -ACF_AC_LIMIT) ac = -ACF_AC_LIMIT;
+
+  //  Two tap average, white noise would otherwise bury the slower lags
+  int32_t x = (ac + a->prev) / 2;
+  a->prev = ac;
+
+  //  Lag products with the history, newest first
+  a->r[0] += ((x * x * 16) - a->r[0]) >> ACF_SHIFT;
+  uint8_t i = a->pos;
+  for (uint8_t lag = 1; lag <= a->lagMax + 1; lag++)
+  {
+    i = (i == 0) ? ACF_MAX_LAG - 1 : i - 1;
+    a->r[lag] += ((x * a->history[i] * 16) - a->r[lag]) >> ACF_SHIFT;
+  }
+  a->history[a->pos] = x;
+  a->pos = (a->pos + 1 == ACF_MAX_LAG) ? 0 : a->pos + 1;
+
+  if (a->settle > 0)
+  {
+    a->settle--;
+    return (false);
+  }
+  if (--a->countdown > 0) return (false);
+  a->countdown = a->updateInterval;
+  autocorrHREstimate(a);
+  return (true);
+}
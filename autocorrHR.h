@@ -0,0 +1,53 @@
+/*
+ Autocorrelation Heart Rate
+
+ Estimates the heart rate from the lag at which the IR signal best matches
+ itself. There is no amplitude threshold, so it does not depend on the
+ signal amplitude the way the peak picking in algorithm.cpp does.
+
+ The correlation at every lag of the 30 to 240 bpm range is a running
+ exponential average of x[n] * x[n - lag], updated in O(lags) per sample
+ from a short history of DC free, lightly smoothed samples. Every updateInterval samples the
+ first lag whose correlation comes close to the strongest one is taken as
+ the beat period and refined by parabolic interpolation.
+
+ The history holds ACF_MAX_LAG samples, which covers 30 bpm up to 31
+ samples/s. At higher rates the slowest rates are cut off, decimate first.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#define ACF_MIN_BPM       30
+#define ACF_MAX_BPM       240
+#ifndef ACF_MAX_LAG
+#define ACF_MAX_LAG       64    // history length in samples
+#endif
+#define ACF_SHIFT         7     // averaging time constant, 2^7 samples
+#define ACF_DC_SHIFT      3     // DC blocker time constant, 2^3 samples, also removes respiration
+#define ACF_AC_LIMIT      4095  // pulsatile input is clamped to this
+#define ACF_PEAK_PERCENT  80    // earliest peak within this percentage of the strongest is the period
+
+typedef struct {
+  int16_t  history[ACF_MAX_LAG]; // DC free samples, history[pos] is the oldest
+  int32_t  r[ACF_MAX_LAG + 1];   // correlation at lag 0..ACF_MAX_LAG, 4 fractional bits
+  int32_t  dc;                   // DC level, 8 fractional bits
+  int16_t  prev;                 // previous DC free sample
+  uint16_t sampleRate;
+  uint16_t updateInterval;       // samples between estimates
+  uint16_t countdown;            // samples until the next estimate
+  uint16_t settle;               // samples until the averages are meaningful
+  uint8_t  pos;                  // next history slot
+  uint8_t  lagMin, lagMax;       // lags searched for the period
+  int16_t  bpm;                  // last estimate in 0.1 bpm, 0 if none
+  uint8_t  confidence;           // correlation at the period relative to lag 0, percent
+} autocorrHR_t;
+
+void autocorrHRInit(autocorrHR_t *a, uint16_t sampleRate, uint16_t updateInterval);
+void autocorrHRReset(autocorrHR_t *a);
+bool autocorrHRUpdate(autocorrHR_t *a, uint32_t sample);
@@ -0,0 +1,130 @@
+/*
+ Frequency Domain Heart Rate (Goertzel filter bank)
+
+ Per sample:  s = x + coeff * s1 - s2   for every bin, coeff in Q14
+ Per block:   P = s1^2 + s2^2 - coeff * s1 * s2
+
+ The resonator state grows with the block length. To keep the product with
+ the coefficient a 16 x 16 bit multiply, the state is held within 16 bits
+ with a block exponent: when a resonator outgrows it, every state and the
+ input that follows are shifted right. All bins share the exponent, so
+ their powers stay comparable. The block end runs once every few seconds
+ and uses float.
+*/
+
+#include <math.h>
+#include "goertzelHR.h"
+
+//  Power of one bin at the end of a block
+static float goertzelPower(const goertzelHR_t *g, uint8_t k)
+{
+  float s1 = g->s1[k];
+  float s2 = g->s2[k];
+  return (s1 * s1 + s2 * s2 - (g->coeff[k] / 16384.0f) * s1 * s2);
+}
+
+//  Set up the bins for the sample rate, blockLength samples per estimate
+void goertzelHRInit(goertzelHR_t *g, uint16_t sampleRate, uint16_t blockLength)
+{
+  for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+  {
+    float w = 2.0f * (float)M_PI * (GOERTZEL_MIN_BPM + k * GOERTZEL_BPM_STEP) / 60.0f / sampleRate;
+    float c = 2.0f * cosf(w) * 16384.0f + 0.5f;
+    g->coeff[k] = (c > 32767.0f) ? 32767 : (int16_t)floorf(c);
+  }
+  g->blockLength = blockLength;
+  g->bpm = 0;
+  g->confidence = 0;
+  goertzelHRReset(g);
+}
+
+//  Start a new block and forget the DC level, for example after a finger change
+void goertzelHRReset(goertzelHR_t *g)
+{
+  for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+  {
+    g->s1[k] = 0;
+    g->s2[k] = 0;
+  }
+  g->dc = 0;
+  g->count = 0;
+  g->scale = 0;
+}
+
+//  Process next IR sample
+//  Returns true when a block completed and bpm and confidence were updated
+bool goertzelHRUpdate(goertzelHR_t *g, uint32_t sample)
+{
+  //  Seed the DC level with the first sample, then remove it
+  if (g->dc == 0) g->dc = (int32_t)sample << 8;
+  g->dc += (((int32_t)sample << 8) - g->dc) >> GOERTZEL_DC_SHIFT;
+  int32_t x = (int32_t)sample - (g->dc >> 8);
+  if (x > GOERTZEL_AC_LIMIT) x = GOERTZEL_AC_LIMIT;
+  if (x < -GOERTZEL_AC_LIMIT) x = -GOERTZEL_AC_LIMIT;
+  if (g->scale > 0) x = (x + ((int32_t)1 << (g->scale - 1))) >> g->scale;
+
+  //  Advance every resonator, the state is within 16 bits here
+  uint32_t bits = 0;
+  for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+  {
+    int32_t s = x + (((int32_t)g->coeff[k] * (int16_t)g->s1[k]) >> 14) - g->s2[k];
+    g->s2[k] = g->s1[k];
+    g->s1[k] = s;
+    bits |= (s < 0) ? -s : s;
+  }
+
+  //  Bring it back within 16 bits for the next sample
+  uint8_t shift = 0;
+  while ((bits >> shift) > GOERTZEL_STATE_LIMIT) shift++;
+  if (shift > 0)
+  {
+    for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+    {
+      g->s1[k] >>= shift;
+      g->s2[k] >>= shift;
+    }
+    g->scale += shift;
+  }
+
+  if (++g->count < g->blockLength) return (false);
+
+  //  Strongest bin and total power in the band
+  float total = 0.0f;
+  float best = -1.0f;
+  uint8_t k_best = 0;
+  for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+  {
+    float p = goertzelPower(g, k);
+    total += p;
+    if (p > best)
+    {
+      best = p;
+      k_best = k;
+    }
+  }
+
+  //  Parabolic interpolation between the neighbours, none at the band edges
+  float bpm = GOERTZEL_MIN_BPM + k_best * GOERTZEL_BPM_STEP;
+  float peak = best;
+  if ((k_best > 0) && (k_best < GOERTZEL_BINS - 1))
+  {
+    float left = goertzelPower(g, k_best - 1);
+    float right = goertzelPower(g, k_best + 1);
+    float denom = left - 2.0f * best + right;
+    if (denom < 0.0f) bpm += 0.5f * (left - right) / denom * GOERTZEL_BPM_STEP;
+    peak += left + right;
+  }
+  g->bpm = (int16_t)(bpm * 10.0f + 0.5f);
+  g->confidence = (total > 0.0f) ? (uint8_t)(100.0f * peak / total + 0.5f) : 0;
+  if (g->confidence > 100) g->confidence = 100;
+
+  //  Next block, the DC level carries over
+  for (uint8_t k = 0; k < GOERTZEL_BINS; k++)
+  {
+    g->s1[k] = 0;
+    g->s2[k] = 0;
+  }
+  g->count = 0;
+  g->scale = 0;
+  return (true);
+}
@@ -0,0 +1,55 @@
+/*
+ Frequency Domain Heart Rate (Goertzel filter bank)
+
+ Estimates the heart rate from the dominant frequency of the IR signal in the
+ 30 to 240 bpm band instead of from individual beats, which holds up better
+ with noisy or irregular waveforms where zero crossings and peaks are missed.
+
+ Each bin is a second order Goertzel resonator that is advanced with every
+ sample, so the cost is spread evenly over the block: one 16 x 16 bit
+ multiply per bin and sample. At the end of a block the bin powers are compared, the strongest
+ bin is refined by parabolic interpolation with its neighbours and the
+ resonators start over.
+
+ The resolution of a block is sampleRate / blockLength Hz, a block of 8 s
+ separates peaks 7.5 bpm apart. Bins closer than that only sample the peak
+ more finely for the interpolation.
+
+ Feed decimated data: at the 25 to 100 samples/s the algorithms use, the
+ whole band is well above the DC blocker and the coefficients keep enough
+ precision in Q14.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#define GOERTZEL_MIN_BPM   30
+#define GOERTZEL_MAX_BPM   240
+#ifndef GOERTZEL_BPM_STEP
+#define GOERTZEL_BPM_STEP  5   // bin spacing, 10 halves the RAM and the cost
+#endif
+#define GOERTZEL_BINS      ((GOERTZEL_MAX_BPM - GOERTZEL_MIN_BPM) / GOERTZEL_BPM_STEP + 1)
+#define GOERTZEL_DC_SHIFT  5   // DC blocker time constant, 2^5 samples
+#define GOERTZEL_AC_LIMIT  16383 // pulsatile input is clamped to this
+#define GOERTZEL_STATE_LIMIT 32767 // resonator state is shifted down to within this
+
+typedef struct {
+  int16_t  coeff[GOERTZEL_BINS]; // 2cos(2 pi f / fs) in Q14
+  int32_t  s1[GOERTZEL_BINS];    // resonator state, previous output
+  int32_t  s2[GOERTZEL_BINS];    // resonator state, output before that
+  int32_t  dc;                   // DC level, 8 fractional bits
+  uint16_t blockLength;          // samples per estimate
+  uint16_t count;                // samples in the current block
+  uint8_t  scale;                // block exponent, state and input are shifted right by this
+  int16_t  bpm;                  // last estimate in 0.1 bpm, 0 until the first block
+  uint8_t  confidence;           // percent of the band power in the peak, 0..100
+} goertzelHR_t;
+
+void goertzelHRInit(goertzelHR_t *g, uint16_t sampleRate, uint16_t blockLength);
+void goertzelHRReset(goertzelHR_t *g);
+bool goertzelHRUpdate(goertzelHR_t *g, uint32_t sample);
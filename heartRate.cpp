@@ -57,55 +57,96 @@
 
 #include "heartRate.h"
 
-int16_t IR_AC_Max =  20;
-int16_t IR_AC_Min = -20;
+beatDetector_t defaultDetector = {
+  0, 0,
+  { {0}, 0 },
+  { 20, -20, 0, 0, 0, 0, 0, 0 },
+  0
+};
 
-int16_t IR_AC_Signal_Current = 0;
-int16_t IR_AC_Signal_Previous;
-int16_t IR_AC_Signal_min = 0;
-int16_t IR_AC_Signal_max = 0;
-int16_t IR_Average_Estimated;
+static const uint16_t FIRCoeffs[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
+//  Hamming windowed sinc, cut off at 0.04 of the sample rate, same gain at DC as FIRCoeffs
+static const uint16_t FIRShortCoeffs[LOWPASS_FIR_SHORT_DELAY + 1] = {302, 563, 1297, 2488, 3948, 5365, 6394, 6770};
 
-int16_t positiveEdge = 0;
-int16_t negativeEdge = 0;
-int32_t ir_avg_reg   = 0;
+//  Start a detector, same state as the built in one at power up
+void beatDetectorInit(beatDetector_t *d)
+{
+  d->ir_avg_reg = 0;
+  d->IR_Average_Estimated = 0;
+  lowPassFIRInit(&d->fir);
+  beatEdgeInit(&d->edge);
+  d->lowLatency = 0;
+}
 
-int16_t cbuf[32];
-uint8_t offset = 0;
+void beatEdgeInit(beatEdge_t *e)
+{
+  e->IR_AC_Max =  20;
+  e->IR_AC_Min = -20;
+  e->IR_AC_Signal_Current = 0;
+  e->IR_AC_Signal_Previous = 0;
+  e->IR_AC_Signal_min = 0;
+  e->IR_AC_Signal_max = 0;
+  e->positiveEdge = 0;
+  e->negativeEdge = 0;
+}
 
-static const uint16_t FIRCoeffs[12] = {172, 321, 579, 927, 1360, 1858, 2390, 2916, 3391, 3768, 4012, 4096};
+void lowPassFIRInit(lowPassFIR_t *f)
+{
+  for (uint8_t i = 0 ; i < 32 ; i++) f->cbuf[i] = 0;
+  f->offset = 0;
+}
 
 //  Heart Rate Monitor functions takes a sample value and the sample number
 //  Returns true if a beat is detected
 //  A running average of four samples is recommended for display on the screen.
+bool checkForBeat(beatDetector_t *d, int32_t sample)
+{
+  //  Process next data sample
+  d->IR_Average_Estimated = averageDCEstimator(&d->ir_avg_reg, sample);
+  int16_t ac = sample - d->IR_Average_Estimated;
+  return (detectBeatEdge(&d->edge, d->lowLatency ? lowPassFIRShort(&d->fir, ac) : lowPassFIRFilter(&d->fir, ac)));
+}
+
+//  When the beat checkForBeat() just reported happened, in 1/256 sample relative to the
+//  sample that reported it. Negative, the filter delay is taken out.
+int16_t beatTimeOffset(const beatDetector_t *d)
+{
+  return (beatEdgeOffset(&d->edge, (d->lowLatency ? LOWPASS_FIR_SHORT_DELAY : LOWPASS_FIR_DELAY) << 8));
+}
+
 bool checkForBeat(int32_t sample)
+{
+  return (checkForBeat(&defaultDetector, sample));
+}
+
+//  Zero crossing detector, takes the next filtered AC sample
+//  Returns true if a beat is detected
+bool detectBeatEdge(beatEdge_t *e, int16_t ac)
 {
   bool beatDetected = false;
 
   //  Save current state
-  IR_AC_Signal_Previous = IR_AC_Signal_Current;
+  e->IR_AC_Signal_Previous = e->IR_AC_Signal_Current;
   
   //This is good to view for debugging
   //Serial.print("Signal_Current: ");
-  //Serial.println(IR_AC_Signal_Current);
+  //Serial.println(e->IR_AC_Signal_Current);
 
-  //  Process next data sample
-  IR_Average_Estimated = averageDCEstimator(&ir_avg_reg, sample);
-  IR_AC_Signal_Current = lowPassFIRFilter(sample - IR_Average_Estimated);
+  e->IR_AC_Signal_Current = ac;
 
   //  Detect positive zero crossing (rising edge)
-  if ((IR_AC_Signal_Previous < 0) & (IR_AC_Signal_Current >= 0))
+  if ((e->IR_AC_Signal_Previous < 0) & (e->IR_AC_Signal_Current >= 0))
   {
   
-    IR_AC_Max = IR_AC_Signal_max; //Adjust our AC max and min
-    IR_AC_Min = IR_AC_Signal_min;
+    e->IR_AC_Max = e->IR_AC_Signal_max; //Adjust our AC max and min
+    e->IR_AC_Min = e->IR_AC_Signal_min;
 
-    positiveEdge = 1;
-    negativeEdge = 0;
-    IR_AC_Signal_max = 0;
+    e->positiveEdge = 1;
+    e->negativeEdge = 0;
+    e->IR_AC_Signal_max = 0;
 
-    //if ((IR_AC_Max - IR_AC_Min) > 100 & (IR_AC_Max - IR_AC_Min) < 1000)
-    if ((IR_AC_Max - IR_AC_Min) > 20 & (IR_AC_Max - IR_AC_Min) < 1000)
+    //if ((e->IR_AC_Max - e->IR_AC_Min) > 100 && (e->IR_AC_Max - e->IR_AC_Min) < 1000)
+    if ((e->IR_AC_Max - e->IR_AC_Min) > 20 && (e->IR_AC_Max - e->IR_AC_Min) < 1000)
     {
       //Heart beat!!!
       beatDetected = true;
@@ -113,28 +154,39 @@ bool checkForBeat(int32_t sample)
   }
 
   //  Detect negative zero crossing (falling edge)
-  if ((IR_AC_Signal_Previous > 0) & (IR_AC_Signal_Current <= 0))
+  if ((e->IR_AC_Signal_Previous > 0) & (e->IR_AC_Signal_Current <= 0))
   {
-    positiveEdge = 0;
-    negativeEdge = 1;
-    IR_AC_Signal_min = 0;
+    e->positiveEdge = 0;
+    e->negativeEdge = 1;
+    e->IR_AC_Signal_min = 0;
   }
 
   //  Find Maximum value in positive cycle
-  if (positiveEdge & (IR_AC_Signal_Current > IR_AC_Signal_Previous))
+  if (e->positiveEdge & (e->IR_AC_Signal_Current > e->IR_AC_Signal_Previous))
   {
-    IR_AC_Signal_max = IR_AC_Signal_Current;
+    e->IR_AC_Signal_max = e->IR_AC_Signal_Current;
   }
 
   //  Find Minimum value in negative cycle
-  if (negativeEdge & (IR_AC_Signal_Current < IR_AC_Signal_Previous))
+  if (e->negativeEdge & (e->IR_AC_Signal_Current < e->IR_AC_Signal_Previous))
   {
-    IR_AC_Signal_min = IR_AC_Signal_Current;
+    e->IR_AC_Signal_min = e->IR_AC_Signal_Current;
   }
   
   return(beatDetected);
 }
 
+//  Position of the last positive zero crossing relative to the current sample in 1/256 sample,
+//  interpolated linearly between the samples on either side, less the delay of the filter
+//  in front of the detector, also in 1/256 sample
+int16_t beatEdgeOffset(const beatEdge_t *e, uint16_t delay)
+{
+  int32_t rise = (int32_t)e->IR_AC_Signal_Current - e->IR_AC_Signal_Previous;
+  int16_t before = 0;
+  if (rise > 0) before = ((int32_t)e->IR_AC_Signal_Current << 8) / rise;
+  return (-before - (int16_t)delay);
+}
+
 //  Average DC Estimator
 int16_t averageDCEstimator(int32_t *p, uint16_t x)
 {
@@ -142,24 +194,79 @@ int16_t averageDCEstimator(int32_t *p, uint16_t x)
   return (*p >> 15);
 }
 
+void dcEstimatorInit(dcEstimator_t *e)
+{
+  e->reg = 0;
+  e->count = 0;
+}
+
+//  Average DC Estimator with a warm start
+//  Seeded with the first sample, then averages over 2, 4, 8 and from the 8th sample on over 16
+//  samples like averageDCEstimator(), so it settles within a few samples instead of climbing from
+//  zero for a hundred. A step of more than a quarter of the level, a finger put on the sensor or
+//  taken off, starts it over.
+int16_t warmDCEstimator(dcEstimator_t *e, uint16_t x)
+{
+  int32_t in = (long) x << 15;
+  int32_t step = in - e->reg;
+  if (step < 0) step = -step;
+  if ((e->count == 0) || (step > (e->reg >> 2)))
+  {
+    e->reg = in;
+    e->count = 1;
+    return (x);
+  }
+  uint8_t shift = 4;
+  if (e->count < 8)
+  {
+    shift = (e->count < 2) ? 1 : ((e->count < 4) ? 2 : 3);
+    e->count++;
+  }
+  e->reg += ((in - e->reg) >> shift);
+  return (e->reg >> 15);
+}
+
 //  Low Pass FIR Filter
-int16_t lowPassFIRFilter(int16_t din)
+int16_t lowPassFIRFilter(lowPassFIR_t *f, int16_t din)
 {  
-  cbuf[offset] = din;
+  f->cbuf[f->offset] = din;
 
-  int32_t z = mul16(FIRCoeffs[11], cbuf[(offset - 11) & 0x1F]);
+  int32_t z = mul16(FIRCoeffs[11], f->cbuf[(f->offset - 11) & 0x1F]);
   
   for (uint8_t i = 0 ; i < 11 ; i++)
   {
-    z += mul16(FIRCoeffs[i], cbuf[(offset - i) & 0x1F] + cbuf[(offset - 22 + i) & 0x1F]);
+    z += mul16(FIRCoeffs[i], f->cbuf[(f->offset - i) & 0x1F] + f->cbuf[(f->offset - 22 + i) & 0x1F]);
+  }
+
+  f->offset++;
+  f->offset %= 32; //Wrap condition
+
+  return(z >> 15);
+}
+
+//  Low Pass FIR Filter, 15 taps for a shorter delay
+int16_t lowPassFIRShort(lowPassFIR_t *f, int16_t din)
+{
+  f->cbuf[f->offset] = din;
+
+  int32_t z = mul16(FIRShortCoeffs[LOWPASS_FIR_SHORT_DELAY], f->cbuf[(f->offset - LOWPASS_FIR_SHORT_DELAY) & 0x1F]);
+
+  for (uint8_t i = 0 ; i < LOWPASS_FIR_SHORT_DELAY ; i++)
+  {
+    z += mul16(FIRShortCoeffs[i], f->cbuf[(f->offset - i) & 0x1F] + f->cbuf[(f->offset - 2 * LOWPASS_FIR_SHORT_DELAY + i) & 0x1F]);
   }
 
-  offset++;
-  offset %= 32; //Wrap condition
+  f->offset++;
+  f->offset %= 32; //Wrap condition
 
   return(z >> 15);
 }
 
+int16_t lowPassFIRFilter(int16_t din)
+{
+  return (lowPassFIRFilter(&defaultDetector.fir, din));
+}
+
 //  Integer multiplier
 int32_t mul16(int16_t x, int16_t y)
 {
@@ -55,12 +55,68 @@
 * 
 */
 
+#pragma once
+
 #if (ARDUINO >= 100)
  #include "Arduino.h"
 #else
  #include "WProgram.h"
 #endif
 
+//  Group delay of the low pass filters in samples, the filtered signal lags the input by this much
+//  lowPassFIRFilter() passes up to about 0.06 of the sample rate and stops from 0.1 on, so at
+//  25 samples/s no beat above about 90 bpm gets through it, at 50 samples/s 180 bpm does.
+//  lowPassFIRShort() still passes 180 bpm at 25 samples/s.
+#define LOWPASS_FIR_DELAY        11  // lowPassFIRFilter(), 23 taps
+#define LOWPASS_FIR_SHORT_DELAY   7  // lowPassFIRShort(), 15 taps, wider transition band
+
+//  Low pass FIR filter state
+typedef struct {
+  int16_t cbuf[32];
+  uint8_t offset;
+} lowPassFIR_t;
+
+//  Zero crossing beat detector state, works on the filtered AC signal
+typedef struct {
+  int16_t IR_AC_Max;
+  int16_t IR_AC_Min;
+  int16_t IR_AC_Signal_Current;
+  int16_t IR_AC_Signal_Previous;
+  int16_t IR_AC_Signal_min;
+  int16_t IR_AC_Signal_max;
+  int16_t positiveEdge;
+  int16_t negativeEdge;
+} beatEdge_t;
+
+//  Complete PBA detector: DC estimator, low pass FIR and zero crossing detector
+typedef struct {
+  int32_t ir_avg_reg;
+  int16_t IR_Average_Estimated;
+  lowPassFIR_t fir;
+  beatEdge_t edge;
+  uint8_t lowLatency;  // 1 uses lowPassFIRShort(), beats arrive 4 samples earlier
+} beatDetector_t;
+
+//  DC estimator with a warm start, see warmDCEstimator()
+typedef struct {
+  int32_t reg;
+  uint8_t count;  // samples since the start, counts up to 8, then averages over 16
+} dcEstimator_t;
+
+//  One detector per signal, for several sensors or channels
+void beatDetectorInit(beatDetector_t *d);
+bool checkForBeat(beatDetector_t *d, int32_t sample);
+void beatEdgeInit(beatEdge_t *e);
+int16_t beatTimeOffset(const beatDetector_t *d);
+bool detectBeatEdge(beatEdge_t *e, int16_t ac);
+int16_t beatEdgeOffset(const beatEdge_t *e, uint16_t delay);
+void dcEstimatorInit(dcEstimator_t *e);
+int16_t warmDCEstimator(dcEstimator_t *e, uint16_t x);
+void lowPassFIRInit(lowPassFIR_t *f);
+int16_t lowPassFIRFilter(lowPassFIR_t *f, int16_t din);
+int16_t lowPassFIRShort(lowPassFIR_t *f, int16_t din);
+
+//  Original interface, runs on one built in detector
 bool checkForBeat(int32_t sample);
 int16_t averageDCEstimator(int32_t *p, uint16_t x);
 int16_t lowPassFIRFilter(int16_t din);
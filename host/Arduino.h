@@ -0,0 +1,56 @@
+/*
+ Minimal Arduino core for building the sketch sources on a Linux host
+
+ Only what the algorithm and driver sources use. Time is the host's
+ monotonic clock.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+
+inline unsigned long micros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((unsigned long)ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+inline unsigned long millis(void)
+{
+  return (micros() / 1000);
+}
+
+inline void delay(unsigned long ms)
+{
+  usleep(ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  usleep(us);
+}
+
+// Byte sink, as in the Arduino core
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return (n);
+  }
+};
@@ -0,0 +1,159 @@
+/*
+ MAX30100 transport over Linux i2c-dev
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include "MAX30100_LinuxI2C.h"
+
+MAX30100_LinuxI2C::MAX30100_LinuxI2C(void)
+  : _fd(-1), _plainI2C(true), _slave(-1) {}
+
+MAX30100_LinuxI2C::~MAX30100_LinuxI2C(void)
+{
+  close();
+}
+
+bool MAX30100_LinuxI2C::open(const char *device)
+{
+  close();
+  _fd = ::open(device, O_RDWR | O_CLOEXEC);
+  if (_fd < 0) return (false);
+  unsigned long funcs = 0;
+  if (ioctl(_fd, I2C_FUNCS, &funcs) < 0)
+  {
+    close();
+    return (false);
+  }
+  _plainI2C = (funcs & I2C_FUNC_I2C) != 0;
+  if (!_plainI2C && !(funcs & I2C_FUNC_SMBUS_READ_I2C_BLOCK))
+  {
+    close();
+    errno = EOPNOTSUPP;
+    return (false);
+  }
+  return (true);
+}
+
+void MAX30100_LinuxI2C::close(void)
+{
+  if (_fd >= 0) ::close(_fd);
+  _fd = -1;
+  _slave = -1;
+}
+
+//  The kernel splits nothing, a whole FIFO fits in one message
+//  SMBus block transfers carry at most 32 bytes
+uint8_t MAX30100_LinuxI2C::maxBurst(void)
+{
+  return (_plainI2C ? 255 : I2C_SMBUS_BLOCK_MAX);
+}
+
+//  errno of a failed transfer as MAX30100_I2C_ status
+//  Adapters report a missing ACK as ENXIO or EREMOTEIO
+uint8_t MAX30100_LinuxI2C::status(int err)
+{
+  switch (err)
+  {
+    case ENXIO:
+    case EREMOTEIO:
+      return (MAX30100_I2C_ERR_NACK_ADDR);
+    case ETIMEDOUT:
+      return (MAX30100_I2C_ERR_TIMEOUT);
+    case EMSGSIZE:
+    case EINVAL:
+      return (MAX30100_I2C_ERR_TOO_LONG);
+    default:
+      return (MAX30100_I2C_ERR_BUS);
+  }
+}
+
+bool MAX30100_LinuxI2C::selectSlave(uint8_t address)
+{
+  if (_slave == address) return (true);
+  if (ioctl(_fd, I2C_SLAVE, (unsigned long)address) < 0) return (false);
+  _slave = address;
+  return (true);
+}
+
+uint8_t MAX30100_LinuxI2C::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len)
+{
+  if (_fd < 0) return (MAX30100_I2C_ERR_BUS);
+  if (len == 0) return (MAX30100_I2C_OK);
+
+  if (_plainI2C)
+  {
+    //  Register pointer write, repeated start, read
+    struct i2c_msg msgs[2];
+    msgs[0].addr = address;
+    msgs[0].flags = 0;
+    msgs[0].len = 1;
+    msgs[0].buf = &reg;
+    msgs[1].addr = address;
+    msgs[1].flags = I2C_M_RD;
+    msgs[1].len = len;
+    msgs[1].buf = buffer;
+    struct i2c_rdwr_ioctl_data xfer;
+    xfer.msgs = msgs;
+    xfer.nmsgs = 2;
+    int done = ioctl(_fd, I2C_RDWR, &xfer);
+    if (done < 0) return (status(errno));
+    return (done == 2 ? MAX30100_I2C_OK : MAX30100_I2C_ERR_SHORT_READ);
+  }
+
+  if (len > I2C_SMBUS_BLOCK_MAX) return (MAX30100_I2C_ERR_TOO_LONG);
+  if (!selectSlave(address)) return (status(errno));
+  union i2c_smbus_data data;
+  struct i2c_smbus_ioctl_data args;
+  args.read_write = I2C_SMBUS_READ;
+  args.command = reg;
+  args.data = &data;
+  if (len == 1)
+  {
+    args.size = I2C_SMBUS_BYTE_DATA;
+    if (ioctl(_fd, I2C_SMBUS, &args) < 0) return (status(errno));
+    buffer[0] = data.byte;
+    return (MAX30100_I2C_OK);
+  }
+  data.block[0] = len;
+  args.size = I2C_SMBUS_I2C_BLOCK_DATA;
+  if (ioctl(_fd, I2C_SMBUS, &args) < 0) return (status(errno));
+  if (data.block[0] < len) return (MAX30100_I2C_ERR_SHORT_READ);
+  memcpy(buffer, &data.block[1], len);
+  return (MAX30100_I2C_OK);
+}
+
+uint8_t MAX30100_LinuxI2C::writeRegister8(uint8_t address, uint8_t reg, uint8_t value)
+{
+  if (_fd < 0) return (MAX30100_I2C_ERR_BUS);
+
+  if (_plainI2C)
+  {
+    uint8_t bytes[2] = { reg, value };
+    struct i2c_msg msg;
+    msg.addr = address;
+    msg.flags = 0;
+    msg.len = 2;
+    msg.buf = bytes;
+    struct i2c_rdwr_ioctl_data xfer;
+    xfer.msgs = &msg;
+    xfer.nmsgs = 1;
+    if (ioctl(_fd, I2C_RDWR, &xfer) < 0) return (status(errno));
+    return (MAX30100_I2C_OK);
+  }
+
+  if (!selectSlave(address)) return (status(errno));
+  union i2c_smbus_data data;
+  data.byte = value;
+  struct i2c_smbus_ioctl_data args;
+  args.read_write = I2C_SMBUS_WRITE;
+  args.command = reg;
+  args.size = I2C_SMBUS_BYTE_DATA;
+  args.data = &data;
+  if (ioctl(_fd, I2C_SMBUS, &args) < 0) return (status(errno));
+  return (MAX30100_I2C_OK);
+}
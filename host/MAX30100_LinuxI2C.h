@@ -0,0 +1,43 @@
+/*
+ MAX30100 transport over Linux i2c-dev
+
+ A register read is one combined transaction: the register address write and
+ the data read go to the kernel in a single I2C_RDWR call, joined by a
+ repeated start, so nothing else on the bus can move the register pointer in
+ between and a whole sensor FIFO is read with one system call.
+
+ Adapters without plain I2C transfers (SMBus controllers, the kernel's
+ i2c-stub) are driven with SMBus i2c block reads of at most 32 bytes, which
+ are combined transactions as well.
+
+   MAX30100_LinuxI2C bus;
+   if (!bus.open("/dev/i2c-1")) ...
+   sensor.begin(bus);
+*/
+
+#pragma once
+
+#include "MAX30100_Transport.h"
+
+class MAX30100_LinuxI2C : public MAX30100_Transport {
+ public:
+  MAX30100_LinuxI2C(void);
+  ~MAX30100_LinuxI2C(void);
+
+  // Returns false with errno set if the device cannot be opened or does neither I2C nor SMBus block reads
+  bool open(const char *device);
+  void close(void);
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t maxBurst(void);
+
+  bool isSMBus(void) const { return (!_plainI2C); }
+
+ private:
+  int _fd;
+  bool _plainI2C;   // adapter does I2C_RDWR
+  int _slave;       // address selected with I2C_SLAVE for SMBus transfers, -1 if none
+  bool selectSlave(uint8_t address);
+  static uint8_t status(int err);
+};
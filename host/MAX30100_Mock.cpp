@@ -0,0 +1,170 @@
+/*
+ Simulated MAX30100 behind the transport interface
+*/
+
+#include "MAX30100_Mock.h"
+
+//  Sample period per SPO2_SR setting in us
+static const uint32_t samplePeriodUs[8] = { 20000, 10000, 5988, 5000, 2500, 1667, 1250, 1000 };
+
+//  LED current of each step in 0.1mA, the synthetic levels hold at 27.1mA
+static const uint16_t ledCurrent[16] = { 0, 44, 76, 110, 142, 174, 208, 240, 271, 306, 338, 370, 402, 436, 468, 500 };
+static const uint16_t REFERENCE_CURRENT = 271;
+
+//  Interrupt status bits
+static const uint8_t INT_A_FULL   = 0x80;
+static const uint8_t INT_TEMP_RDY = 0x40;
+static const uint8_t INT_HR_RDY   = 0x20;
+static const uint8_t INT_SPO2_RDY = 0x10;
+static const uint8_t INT_PWR_RDY  = 0x01;
+
+MAX30100_Mock::MAX30100_Mock(float bpm, uint32_t seed)
+  : ppg(50.0f, bpm, seed), address(MAX30100_ADDRESS), burstLimit(255), present(true),
+    samplesMade(0), samplesLost(0), virtualTime(false), frozen(false), _nowUs(0)
+{
+  reset();
+}
+
+void MAX30100_Mock::reset(void)
+{
+  memset(_regs, 0, sizeof(_regs));
+  _regs[MAX30100_PARTID] = MAX_30100_EXPECTEDPARTID;
+  _regs[MAX30100_REVISIONID] = 0x03;
+  _regs[MAX30100_INTSTAT] = INT_PWR_RDY;
+  _count = 0;
+  _byte = 0;
+  _periodUs = samplePeriodUs[0];
+  _lastUs = now();
+  frozen = false;
+}
+
+uint8_t MAX30100_Mock::maxBurst(void)
+{
+  return (burstLimit);
+}
+
+//  ADC counts for a synthetic level at the given LED current step
+uint16_t MAX30100_Mock::level(float counts, uint8_t current) const
+{
+  uint8_t bits = 13 + (_regs[MAX30100_SPO2CONFIG] & ~MAX30100_PULSEWIDTH_MASK);
+  float v = counts * ledCurrent[current & 0x0F] / REFERENCE_CURRENT / (1 << (16 - bits));
+  float full = (1 << bits) - 1;
+  return ((uint16_t)(v > full ? full : v));
+}
+
+//  Produce the samples due since the last call
+void MAX30100_Mock::update(void)
+{
+  unsigned long now = this->now();
+  uint8_t mode = _regs[MAX30100_MODECONFIG];
+  uint8_t ledMode = mode & ~MAX30100_MODE_MASK;
+  if (frozen || (mode & MAX30100_SHUTDOWN) || (ledMode != MAX30100_MODE_HR && ledMode != MAX30100_MODE_SPO2))
+  {
+    _lastUs = now;
+    return;
+  }
+  while (now - _lastUs >= _periodUs)
+  {
+    _lastUs += _periodUs;
+    uint32_t red, ir;
+    ppg.next(&red, &ir);
+    samplesMade++;
+    uint8_t leds = _regs[MAX30100_LEDCONFIG];
+    if (_count == MAX30100_FIFO_DEPTH)
+    {
+      //  Full, the sample is lost
+      if (_regs[MAX30100_FIFOOVERFLOW] < 0x0F) _regs[MAX30100_FIFOOVERFLOW]++;
+      samplesLost++;
+      continue;
+    }
+    uint8_t slot = (_regs[MAX30100_FIFOREADPTR] + _count) & (MAX30100_FIFO_DEPTH - 1);
+    _fifo[slot][0] = level(ir, leds & 0x0F);
+    _fifo[slot][1] = (ledMode == MAX30100_MODE_SPO2) ? level(red, leds >> 4) : 0;
+    _count++;
+    _regs[MAX30100_FIFOWRITEPTR] = (slot + 1) & (MAX30100_FIFO_DEPTH - 1);
+    _regs[MAX30100_INTSTAT] |= (ledMode == MAX30100_MODE_SPO2) ? INT_SPO2_RDY : INT_HR_RDY;
+    if (_count >= MAX30100_FIFO_DEPTH - 1) _regs[MAX30100_INTSTAT] |= INT_A_FULL;
+  }
+}
+
+uint8_t MAX30100_Mock::readRegister(uint8_t reg)
+{
+  if (reg == MAX30100_FIFODATA)
+  {
+    if (_count == 0) return (0);
+    uint8_t rd = _regs[MAX30100_FIFOREADPTR];
+    uint16_t value = _fifo[rd][_byte >> 1];
+    uint8_t b = (_byte & 1) ? (value & 0xFF) : (value >> 8);
+    if (++_byte == 4)
+    {
+      //  Whole slot read, it leaves the FIFO
+      _byte = 0;
+      _count--;
+      _regs[MAX30100_FIFOREADPTR] = (rd + 1) & (MAX30100_FIFO_DEPTH - 1);
+      _regs[MAX30100_FIFOOVERFLOW] = 0;
+    }
+    return (b);
+  }
+  uint8_t value = _regs[reg];
+  if (reg == MAX30100_INTSTAT) _regs[reg] = 0; //Cleared by reading
+  return (value);
+}
+
+uint8_t MAX30100_Mock::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len)
+{
+  if (!present || address != this->address) return (MAX30100_I2C_ERR_NACK_ADDR);
+  if (len > burstLimit) return (MAX30100_I2C_ERR_TOO_LONG);
+  update();
+  for (uint8_t i = 0; i < len; i++)
+  {
+    buffer[i] = readRegister(reg);
+    if (reg != MAX30100_FIFODATA) reg++;
+  }
+  return (MAX30100_I2C_OK);
+}
+
+uint8_t MAX30100_Mock::writeRegister8(uint8_t address, uint8_t reg, uint8_t value)
+{
+  if (!present || address != this->address) return (MAX30100_I2C_ERR_NACK_ADDR);
+  update(); //Samples due so far use the old configuration
+  switch (reg)
+  {
+    case MAX30100_MODECONFIG:
+      if (value & MAX30100_RESET)
+      {
+        reset();
+        break;
+      }
+      if (value & MAX30100_TEMPREAD)
+      {
+        //  Conversion completes at once, 28.25 C
+        _regs[MAX30100_DIETEMPINT] = 28;
+        _regs[MAX30100_DIETEMPFRAC] = 4;
+        _regs[MAX30100_INTSTAT] |= INT_TEMP_RDY;
+        value &= MAX30100_TEMPREAD_MASK;
+      }
+      _regs[reg] = value;
+      break;
+    case MAX30100_FIFOWRITEPTR:
+    case MAX30100_FIFOREADPTR:
+    case MAX30100_FIFOOVERFLOW:
+      _regs[reg] = value & 0x0F;
+      _count = (_regs[MAX30100_FIFOWRITEPTR] - _regs[MAX30100_FIFOREADPTR]) & (MAX30100_FIFO_DEPTH - 1);
+      _byte = 0;
+      break;
+    case MAX30100_SPO2CONFIG:
+      _regs[reg] = value;
+      _periodUs = samplePeriodUs[(value & ~MAX30100_SAMPLERATE_MASK) >> 2];
+      _lastUs = now(); //The next sample is one new period away
+      ppg.sampleRate = 1000000.0f / _periodUs;
+      break;
+    case MAX30100_INTSTAT:
+    case MAX30100_PARTID:
+    case MAX30100_REVISIONID:
+      break; //Read only
+    default:
+      _regs[reg] = value;
+      break;
+  }
+  return (MAX30100_I2C_OK);
+}
@@ -0,0 +1,80 @@
+/*
+ Simulated MAX30100 behind the transport interface
+
+ Register file, 16 sample FIFO with write and read pointers and overflow
+ counter, self clearing reset and temperature bits. While the mode register
+ selects HR or SpO2 the FIFO fills at the configured sample rate with a
+ synthetic PPG (synthPPG.h), scaled by the LED currents and cut to the ADC
+ resolution of the pulse width. Lets the driver, the pipeline and the host
+ tools run without hardware.
+
+ Reads of FIFODATA stay on that register, any other register auto increments,
+ as on the sensor.
+
+ Samples are due by micros(), or with virtualTime set by the time handed to
+ advance(), so a simulation can run faster than the sensor would.
+ MAX30100_VirtualClock gives the driver that time.
+
+ Faults to test recovery with: reset() is a brownout, the registers go back
+ to their power on defaults and sampling stops, frozen stops the sample
+ clock with the registers intact until the next reset.
+*/
+
+#pragma once
+
+#include "MAX30100_Transport.h"
+#include "MAX30100_Clock.h"
+#include "MAX30100_Registers.h"
+#include "synthPPG.h"
+
+class MAX30100_Mock : public MAX30100_Transport {
+ public:
+  MAX30100_Mock(float bpm = 72.0f, uint32_t seed = 1);
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t maxBurst(void);
+
+  // Power on state, empty FIFO
+  void reset(void);
+
+  // Moves the virtual clock on, samples due by then are made at the next transaction
+  void advance(uint32_t us) { _nowUs += us; }
+  // Time of the sensor in us
+  unsigned long now(void) const { return (virtualTime ? _nowUs : micros()); }
+
+  synthPPG ppg;          // signal source, adjust noise, jitter and wander here
+  uint8_t address;       // 7 bit address the mock answers to
+  uint8_t burstLimit;    // longest read, 32 stands in for an Uno's Wire buffer
+  bool present;          // false: every transaction is not acknowledged
+  uint32_t samplesMade;  // samples the sensor produced, including lost ones
+  uint32_t samplesLost;  // samples dropped because the FIFO was full
+  bool virtualTime;      // time moves only with advance()
+  bool frozen;           // sample clock stopped, the write pointer stays until a reset
+
+ private:
+  uint8_t _regs[256];
+  uint16_t _fifo[MAX30100_FIFO_DEPTH][2]; // IR, red
+  uint8_t _count;        // samples in the FIFO
+  uint8_t _byte;         // byte of the current FIFO slot the next read returns
+  unsigned long _lastUs; // time up to which samples were made
+  uint32_t _periodUs;    // sample period at the configured rate
+  unsigned long _nowUs;  // virtual clock
+  void update(void);
+  uint16_t level(float counts, uint8_t current) const;
+  uint8_t readRegister(uint8_t reg);
+};
+
+// Clock of a simulated session for MAX30100::setClock(): the time is the sensor's
+// virtual time and a delay() moves it on at once. Samples come due with the time
+// and are made at the driver's next transaction, nothing waits in real time.
+class MAX30100_VirtualClock : public MAX30100_Clock {
+ public:
+  MAX30100_VirtualClock(MAX30100_Mock &sensor) : _sensor(sensor) { sensor.virtualTime = true; }
+  unsigned long millis(void) { return (_sensor.now() / 1000); }
+  unsigned long micros(void) { return (_sensor.now()); }
+  void delay(unsigned long ms) { _sensor.advance(ms * 1000); }
+
+ private:
+  MAX30100_Mock &_sensor;
+};
@@ -0,0 +1,120 @@
+/*
+ Replay of a MAX30100 transaction log
+*/
+
+#include <string.h>
+
+#include "MAX30100_Replay.h"
+
+static const char *typeName[] = { "?", "read", "write", "recover" };
+
+MAX30100_Replay::MAX30100_Replay(void)
+  : timeUs(0), transactions(0), divergences(0), report(stderr), _pos(0), _maxBurst(32) {}
+
+bool MAX30100_Replay::open(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return (false);
+  uint8_t chunk[4096];
+  size_t n;
+  _log.clear();
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) _log.insert(_log.end(), chunk, chunk + n);
+  fclose(f);
+  if ((_log.size() < MAX30100_LOG_HEADER) || (memcmp(&_log[0], MAX30100_LOG_MAGIC, 4) != 0) ||
+      (_log[4] != MAX30100_LOG_VERSION))
+  {
+    _log.clear();
+    return (false);
+  }
+  _maxBurst = _log[5];
+  _pos = MAX30100_LOG_HEADER;
+  timeUs = 0;
+  transactions = 0;
+  divergences = 0;
+  return (true);
+}
+
+//  Chunking of the FIFO reads depends on it, answer what the recorded transport said
+uint8_t MAX30100_Replay::maxBurst(void)
+{
+  return (_maxBurst);
+}
+
+//  Take the next record if it is the transaction asked for
+bool MAX30100_Replay::next(uint8_t type, uint8_t address, uint8_t reg, uint8_t value, uint8_t *status, const uint8_t **data)
+{
+  if (done())
+  {
+    *status = MAX30100_I2C_ERR_NACK_ADDR; //Log is over, as if the sensor was gone
+    return (false);
+  }
+  size_t p = _pos;
+  uint8_t recType = _log[p++];
+  uint64_t dt = 0;
+  for (int shift = 0; p < _log.size(); shift += 7)
+  {
+    uint8_t b = _log[p++];
+    dt |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) break;
+  }
+  if (p + 4 > _log.size())
+  {
+    _pos = _log.size(); //Truncated, nothing more to replay
+    *status = MAX30100_I2C_ERR_NACK_ADDR;
+    return (false);
+  }
+  uint8_t recAddress = _log[p++];
+  uint8_t recReg = _log[p++];
+  uint8_t recValue = _log[p++];
+  uint8_t recStatus = _log[p++];
+  size_t dataLength = (recType == MAX30100_LOG_READ && recStatus == MAX30100_I2C_OK) ? recValue : 0;
+
+  if ((recType != type) || (recAddress != address) || (recReg != reg) || (recValue != value))
+  {
+    if ((divergences++ == 0) && (report != NULL))
+    {
+      fprintf(report, "replay: transaction %u differs from the log at byte %zu: %s 0x%02X reg 0x%02X %u, "
+        "recorded %s 0x%02X reg 0x%02X %u\n", transactions, _pos, typeName[type & 3], address, reg, value,
+        typeName[recType & 3], recAddress, recReg, recValue);
+    }
+    _pos = _log.size(); //The driver went its own way, the rest of the log no longer applies
+    *status = MAX30100_I2C_ERR_BUS;
+    return (false);
+  }
+  if (p + dataLength > _log.size())
+  {
+    _pos = _log.size();
+    *status = MAX30100_I2C_ERR_SHORT_READ;
+    return (false);
+  }
+  *status = recStatus;
+  *data = &_log[p];
+  _pos = p + dataLength;
+  timeUs += dt;
+  transactions++;
+  return (true);
+}
+
+uint8_t MAX30100_Replay::readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len)
+{
+  uint8_t status;
+  const uint8_t *data;
+  if (next(MAX30100_LOG_READ, address, reg, len, &status, &data) && (status == MAX30100_I2C_OK)) memcpy(buffer, data, len);
+  return (status);
+}
+
+uint8_t MAX30100_Replay::writeRegister8(uint8_t address, uint8_t reg, uint8_t value)
+{
+  uint8_t status;
+  const uint8_t *data;
+  next(MAX30100_LOG_WRITE, address, reg, value, &status, &data);
+  return (status);
+}
+
+bool MAX30100_Replay::recoverBus(void)
+{
+  uint8_t status;
+  const uint8_t *data;
+  if (!next(MAX30100_LOG_RECOVER, 0, 0, 0, &status, &data)) return (false);
+  return (status != 0);
+}
@@ -0,0 +1,63 @@
+/*
+ Replay of a MAX30100 transaction log
+
+ Stands in for the bus and answers the driver from a log written by
+ MAX30100_RecordTransport, transaction by transaction. The driver has to ask
+ for exactly what was recorded; the first request that differs is reported,
+ counted as a divergence, answered with a bus error and ends the replay.
+
+ It is the driver's clock as well. Time moves on by the recorded dt with each
+ replayed transaction and delay() returns at once, so the watchdog and the
+ driver's timeouts see the time they saw when recording, and a session still
+ replays as fast as the host runs the driver. Once the log is over or has
+ diverged, delay() moves time on by what it was asked to wait, so the
+ driver's timed waits run out instead of spinning.
+
+   MAX30100_Replay replay;
+   replay.open("i2c.log");
+   sensor.setClock(replay);
+   sensor.begin(replay);
+   while (!replay.done()) pipeline.poll(sensor);
+*/
+
+#pragma once
+
+#include <vector>
+#include <stdio.h>
+
+#include "MAX30100_Transport.h"
+#include "MAX30100_Record.h"
+#include "MAX30100_Clock.h"
+
+class MAX30100_Replay : public MAX30100_Transport, public MAX30100_Clock {
+ public:
+  MAX30100_Replay(void);
+
+  // Reads the whole log, false if it cannot be read or is not a log
+  bool open(const char *path);
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len);
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value);
+  uint8_t maxBurst(void);
+  bool recoverBus(void);
+
+  // Recorded time of the last replayed transaction, waits take no time until the log is over
+  unsigned long millis(void) { return ((unsigned long)(timeUs / 1000)); }
+  void delay(unsigned long ms) {
+    if (done()) timeUs += (uint64_t)ms * 1000;
+  }
+
+  // Every record was replayed, or the log is broken
+  bool done(void) const { return (_pos >= _log.size()); }
+
+  uint64_t timeUs;       // recorded time of the last replayed transaction since begin()
+  uint32_t transactions; // records replayed
+  uint32_t divergences;  // requests that did not match the log
+  FILE *report;          // where the first divergence is described, NULL for silence
+
+ private:
+  std::vector<uint8_t> _log;
+  size_t _pos;
+  uint8_t _maxBurst;
+  bool next(uint8_t type, uint8_t address, uint8_t reg, uint8_t value, uint8_t *status, const uint8_t **data);
+};
@@ -0,0 +1,342 @@
+/*
+ Batched maxim_heart_rate_and_oxygen_saturation()
+
+ Follows algorithm.cpp step by step, every lane computes exactly what the
+ scalar function computes for its stream, including its integer rounding.
+*/
+
+#include <string.h>
+
+#include "algorithmBatch.h"
+
+#if MAXIM_BATCH_LANES > 1
+ typedef int32_t lanes_t __attribute__((vector_size(4 * MAXIM_BATCH_LANES), aligned(4)));
+ typedef uint32_t ulanes_t __attribute__((vector_size(4 * MAXIM_BATCH_LANES), aligned(4)));
+ #define LANE(v, l) ((v)[l])
+#else
+ typedef int32_t lanes_t;
+ typedef uint32_t ulanes_t;
+ #define LANE(v, l) (v)
+#endif
+
+#define L MAXIM_BATCH_LANES
+#define NO_VALUE (-16777216)
+
+static inline lanes_t splat(int32_t n_x)
+{
+  lanes_t v = {};
+  return (v + n_x);
+}
+
+//  One sample of L streams
+template<typename sample_t>
+static inline lanes_t maxim_batch_load(const sample_t *pun_x)
+{
+#if MAXIM_BATCH_LANES > 1
+  typedef sample_t row_t __attribute__((vector_size(sizeof(sample_t) * L)));
+  row_t x;
+  memcpy(&x, pun_x, sizeof(x));
+  return (__builtin_convertvector(x, lanes_t));
+#else
+  return (*pun_x);
+#endif
+}
+
+//  Quotient truncated toward zero like /, int32 quotients are exact in double
+static inline lanes_t maxim_batch_div(lanes_t n_a, lanes_t n_b)
+{
+#if MAXIM_BATCH_LANES > 1
+  typedef double dlanes_t __attribute__((vector_size(8 * L)));
+  return (__builtin_convertvector(__builtin_convertvector(n_a, dlanes_t) / __builtin_convertvector(n_b, dlanes_t), lanes_t));
+#else
+  return ((int32_t)((double)n_a / (double)n_b));
+#endif
+}
+
+static inline lanes_t maxim_batch_row(const int32_t *pn_x)
+{
+  lanes_t v;
+  memcpy(&v, pn_x, sizeof(v));
+  return (v);
+}
+
+//  Stretches between valleys longer than 3 samples, of all lanes in the order they end,
+//  with what the ratio needs of them. Arrays of MAXIM_BATCH_SEGMENTS_LEN() in the workspace.
+typedef struct {
+  int32_t *an_lane;
+  int32_t *an_len;
+  int32_t *an_x0, *an_x1, *an_x_off, *an_x_pk, *an_x_dc_max;
+  int32_t *an_y0, *an_y1, *an_y_off, *an_y_pk, *an_y_dc_max;
+  int32_t n_count;
+} maxim_batch_segments_t;
+
+static void maxim_batch_segments_init(maxim_batch_segments_t *p_seg, int32_t *pn_space, int32_t n_size)
+{
+  int32_t **ppn_arrays[MAXIM_BATCH_SEGMENT_ARRAYS] = { &p_seg->an_lane, &p_seg->an_len,
+    &p_seg->an_x0, &p_seg->an_x1, &p_seg->an_x_off, &p_seg->an_x_pk, &p_seg->an_x_dc_max,
+    &p_seg->an_y0, &p_seg->an_y1, &p_seg->an_y_off, &p_seg->an_y_pk, &p_seg->an_y_dc_max };
+  for (int32_t i = 0; i < MAXIM_BATCH_SEGMENT_ARRAYS; i++) *ppn_arrays[i] = pn_space + i * n_size;
+  p_seg->n_count = 0;
+}
+
+static void maxim_batch_segment(maxim_batch_segments_t *p_seg, const lanes_t *an_x, const lanes_t *an_y, int32_t n_l,
+                int32_t n_start, int32_t n_end, int32_t n_x_dc_max_idx, int32_t n_y_dc_max_idx)
+{
+  if (n_end - n_start <= 3) return;
+  int32_t n = p_seg->n_count++;
+  p_seg->an_lane[n] = n_l;
+  p_seg->an_len[n] = n_end - n_start;
+  p_seg->an_x0[n] = LANE(an_x[n_start], n_l);
+  p_seg->an_x1[n] = LANE(an_x[n_end], n_l);
+  p_seg->an_x_off[n] = n_x_dc_max_idx - n_start;
+  p_seg->an_x_pk[n] = LANE(an_x[n_y_dc_max_idx], n_l); // at the red maximum, as the original does
+  p_seg->an_x_dc_max[n] = LANE(an_x[n_x_dc_max_idx], n_l);
+  p_seg->an_y0[n] = LANE(an_y[n_start], n_l);
+  p_seg->an_y1[n] = LANE(an_y[n_end], n_l);
+  p_seg->an_y_off[n] = n_y_dc_max_idx - n_start;
+  p_seg->an_y_pk[n] = LANE(an_y[n_y_dc_max_idx], n_l);
+  p_seg->an_y_dc_max[n] = LANE(an_y[n_y_dc_max_idx], n_l);
+}
+
+//  AC/DC ratios of the stretches, L at a time, the first 5 valid ones of each lane are kept
+static void maxim_batch_ratios(maxim_batch_segments_t *p_seg, int32_t an_ratio[][5], int32_t *an_ratio_count)
+{
+  int32_t n, j;
+  while (p_seg->n_count % L != 0)
+  {
+    n = p_seg->n_count++;
+    p_seg->an_lane[n] = -1; // padding, gives no ratio
+    p_seg->an_len[n] = 1;
+    p_seg->an_x0[n] = p_seg->an_x1[n] = p_seg->an_x_off[n] = p_seg->an_x_pk[n] = p_seg->an_x_dc_max[n] = 0;
+    p_seg->an_y0[n] = p_seg->an_y1[n] = p_seg->an_y_off[n] = p_seg->an_y_pk[n] = p_seg->an_y_dc_max[n] = 0;
+  }
+  for (n = 0; n < p_seg->n_count; n += L)
+  {
+    lanes_t n_len = maxim_batch_row(&p_seg->an_len[n]);
+    lanes_t n_y0 = maxim_batch_row(&p_seg->an_y0[n]);
+    lanes_t n_x0 = maxim_batch_row(&p_seg->an_x0[n]);
+    lanes_t n_y_ac = (maxim_batch_row(&p_seg->an_y1[n]) - n_y0) * maxim_batch_row(&p_seg->an_y_off[n]); //red
+    n_y_ac = n_y0 + maxim_batch_div(n_y_ac, n_len);
+    n_y_ac = maxim_batch_row(&p_seg->an_y_pk[n]) - n_y_ac; // subracting linear DC compoenents from raw
+    lanes_t n_x_ac = (maxim_batch_row(&p_seg->an_x1[n]) - n_x0) * maxim_batch_row(&p_seg->an_x_off[n]); // ir
+    n_x_ac = n_x0 + maxim_batch_div(n_x_ac, n_len);
+    n_x_ac = maxim_batch_row(&p_seg->an_x_pk[n]) - n_x_ac;
+    lanes_t n_nume = (n_y_ac * maxim_batch_row(&p_seg->an_x_dc_max[n])) >> 7;
+    lanes_t n_denom = (n_x_ac * maxim_batch_row(&p_seg->an_y_dc_max[n])) >> 7;
+    lanes_t b_valid = (n_denom > 0) & (n_nume != 0);
+    n_denom = b_valid ? n_denom : splat(1);
+    //formular is ( n_y_ac *n_x_dc_max) / ( n_x_ac *n_y_dc_max), scaled by SPO2_RATIO_SCALE
+    lanes_t n_quot = maxim_batch_div(n_nume, n_denom);
+    lanes_t n_ratio = n_quot * SPO2_RATIO_SCALE + maxim_batch_div((n_nume - n_quot * n_denom) * SPO2_RATIO_SCALE, n_denom);
+
+    int32_t ab_valid[L], an_row_ratio[L];
+    memcpy(ab_valid, &b_valid, sizeof(lanes_t));
+    memcpy(an_row_ratio, &n_ratio, sizeof(lanes_t));
+    for (j = 0; j < L; j++)
+    {
+      int32_t n_l = p_seg->an_lane[n + j];
+      if ((n_l >= 0) && ab_valid[j] && (an_ratio_count[n_l] < 5)) an_ratio[n_l][an_ratio_count[n_l]++] = an_row_ratio[j];
+    }
+  }
+}
+
+//  Up to L streams from n_first on, n_lanes of them in use
+template<typename sample_t>
+static void maxim_batch_block(const sample_t *pun_ir_buffer, const sample_t *pun_red_buffer, int32_t n_streams,
+                int32_t n_first, int32_t n_lanes, int32_t n_len, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t n_sample_rate, lanes_t *an_ir, lanes_t *an_red, lanes_t *an_x,
+                lanes_t *an_y_idx, int32_t *pn_valleys, maxim_batch_segments_t *p_seg, void *p_queue)
+{
+  int32_t k, l, i;
+  maxim_peak_detector_t detector;
+  int32_t *an_valley_locs[L];
+  int32_t an_npks[L];
+  int32_t an_ratio[L][5], an_ratio_count[L];
+  bool ab_ratio_done[L];
+
+  // load the lanes and calculate the DC mean
+  ulanes_t un_ir_sum = {};
+  for (k = 0; k < n_len; k++)
+  {
+    const sample_t *pun_ir = pun_ir_buffer + (size_t)k * n_streams + n_first;
+    const sample_t *pun_red = pun_red_buffer + (size_t)k * n_streams + n_first;
+    if (n_lanes == L)
+    {
+      an_ir[k] = maxim_batch_load(pun_ir);
+      an_red[k] = maxim_batch_load(pun_red);
+    }
+    else
+    {
+      an_ir[k] = an_red[k] = splat(0); // unused lanes of the last block
+      for (l = 0; l < n_lanes; l++)
+      {
+        LANE(an_ir[k], l) = pun_ir[l];
+        LANE(an_red[k], l) = pun_red[l];
+      }
+    }
+    un_ir_sum += (ulanes_t)an_ir[k];
+  }
+  lanes_t n_ir_mean = (lanes_t)(un_ir_sum / (uint32_t)n_len);
+
+  // remove DC and invert signal so that we can use peak detector as valley detector
+  for (k = 0; k < n_len; k++) an_x[k] = n_ir_mean - an_ir[k];
+
+  // Moving Average, 4 pt at 25 samples/s
+  int32_t n_ma = MAXIM_MA_SIZE(n_sample_rate);
+  if (n_ma < 1) n_ma = 1;
+  lanes_t n_ma_sum = {};
+  for (k = 0; k < n_ma && k < n_len; k++) n_ma_sum += an_x[k];
+  for (k = 0; k < n_len - n_ma; k++)
+  {
+    lanes_t n_ma_old = an_x[k];
+    an_x[k] = n_ma_sum / n_ma;
+    n_ma_sum += an_x[k + n_ma] - n_ma_old;
+  }
+
+  // calculate threshold
+  lanes_t n_th1 = {};
+  for (k = 0; k < n_len; k++) n_th1 += an_x[k];
+  n_th1 = n_th1 / n_len;
+  n_th1 = (n_th1 < 30) ? splat(30) : n_th1; // min allowed
+  n_th1 = (n_th1 > 60) ? splat(60) : n_th1; // max allowed
+
+  // valleys, then heart rate from the valley intervals, lane by lane through one detector queue
+  for (l = 0; l < n_lanes; l++)
+  {
+    an_valley_locs[l] = pn_valleys + l * MAXIM_VALLEYS_LEN(n_len);
+    maxim_peak_detector_init(&detector, an_valley_locs[l], MAXIM_VALLEYS_LEN(n_len), LANE(n_th1, l), MAXIM_VALLEY_DISTANCE(n_sample_rate),
+      p_queue, MAXIM_PEAK_QUEUE_LEN(n_len));
+    for (k = 0; k < n_len; k++) maxim_peak_detector_update(&detector, LANE(an_x[k], l));
+    int32_t n_npks = maxim_peak_detector_finish(&detector);
+    int32_t n_peak_interval_sum = 0;
+    an_npks[l] = n_npks;
+    if (n_npks >= 2)
+    {
+      for (k = 1; k < n_npks; k++) n_peak_interval_sum += (an_valley_locs[l][k] - an_valley_locs[l][k - 1]);
+      n_peak_interval_sum = n_peak_interval_sum / (n_npks - 1);
+      pn_heart_rate[n_first + l] = (int32_t)((n_sample_rate * 60) / n_peak_interval_sum);
+      pch_hr_valid[n_first + l] = 1;
+    }
+    else
+    {
+      pn_heart_rate[n_first + l] = -999; // unable to calculate because # of peaks are too small
+      pch_hr_valid[n_first + l] = 0;
+    }
+    ab_ratio_done[l] = false;
+    for (k = 0; k < n_npks; k++)
+    {
+      if (an_valley_locs[l][k] >= n_len) ab_ratio_done[l] = true; // do not use SPO2 since valley loc is out of range
+    }
+  }
+
+  // mark the valleys of every lane, -1 in its lane of the sample
+  for (k = 0; k < n_len; k++) an_x[k] = splat(0);
+  for (l = 0; l < n_lanes; l++)
+  {
+    for (k = 0; !ab_ratio_done[l] && k < an_npks[l]; k++) LANE(an_x[an_valley_locs[l][k]], l) = -1;
+  }
+
+  // maxima of raw IR and red between valleys, each lane restarts at its own valleys. Where
+  // the maxima were of the stretch that ends at a sample is kept for each sample.
+  lanes_t n_x_dc_max = splat(NO_VALUE), n_y_dc_max = splat(NO_VALUE);
+  lanes_t n_x_dc_max_idx = {}, n_y_dc_max_idx = {};
+  lanes_t n_i = {};
+  for (i = 0; i < n_len; i++)
+  {
+    lanes_t b_valley = an_x[i];
+    an_x[i] = n_x_dc_max_idx;
+    an_y_idx[i] = n_y_dc_max_idx;
+    n_x_dc_max = b_valley ? splat(NO_VALUE) : n_x_dc_max;
+    n_y_dc_max = b_valley ? splat(NO_VALUE) : n_y_dc_max;
+    lanes_t b_x_gt = an_ir[i] > n_x_dc_max;
+    lanes_t b_y_gt = an_red[i] > n_y_dc_max;
+    n_x_dc_max = b_x_gt ? an_ir[i] : n_x_dc_max;
+    n_x_dc_max_idx = b_x_gt ? n_i : n_x_dc_max_idx;
+    n_y_dc_max = b_y_gt ? an_red[i] : n_y_dc_max;
+    n_y_dc_max_idx = b_y_gt ? n_i : n_y_dc_max_idx;
+    n_i += 1;
+  }
+
+  // stretches between two valleys of each lane, then their ratios
+  p_seg->n_count = 0;
+  for (l = 0; l < n_lanes; l++)
+  {
+    an_ratio_count[l] = 0;
+    for (k = 0; k < 5; k++) an_ratio[l][k] = 0;
+    for (k = 0; !ab_ratio_done[l] && k < an_npks[l] - 1; k++)
+      maxim_batch_segment(p_seg, an_ir, an_red, l, an_valley_locs[l][k], an_valley_locs[l][k + 1],
+        LANE(an_x[an_valley_locs[l][k + 1]], l), LANE(an_y_idx[an_valley_locs[l][k + 1]], l));
+  }
+  maxim_batch_ratios(p_seg, an_ratio, an_ratio_count);
+
+  // choose median value since PPG signal may varies from beat to beat
+  for (l = 0; l < n_lanes; l++)
+  {
+    int32_t n_ratio_average, n_middle_idx, n_spo2_calc;
+    if (ab_ratio_done[l])
+    {
+      pn_spo2[n_first + l] = -999;
+      pch_spo2_valid[n_first + l] = 0;
+      continue;
+    }
+    maxim_sort_ascend(an_ratio[l], an_ratio_count[l]);
+    n_middle_idx = an_ratio_count[l] / 2;
+    if (n_middle_idx > 1)
+      n_ratio_average = (an_ratio[l][n_middle_idx - 1] + an_ratio[l][n_middle_idx]) / 2; // use median
+    else
+      n_ratio_average = an_ratio[l][n_middle_idx];
+    if (n_ratio_average > 2 * SPO2_RATIO_SCALE / 100 && n_ratio_average < SPO2_RATIO_MAX_X100 * SPO2_RATIO_SCALE / 100)
+    {
+      n_spo2_calc = maxim_spo2_from_ratio(n_ratio_average);
+      pn_spo2[n_first + l] = (n_spo2_calc + 5) / 10;
+      pch_spo2_valid[n_first + l] = 1;
+    }
+    else
+    {
+      pn_spo2[n_first + l] = -999; // do not use SPO2 since signal an_ratio is out of range
+      pch_spo2_valid[n_first + l] = 0;
+    }
+  }
+}
+
+template<typename sample_t>
+void maxim_heart_rate_and_oxygen_saturation_batch(const sample_t *pun_ir_buffer, const sample_t *pun_red_buffer,
+                int32_t n_streams, int32_t n_buffer_length, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes)
+{
+  int32_t s;
+  if (n_workspace_bytes < MAXIM_BATCH_WORKSPACE_BYTES(n_buffer_length))
+  {
+    for (s = 0; s < n_streams; s++)
+    {
+      pn_spo2[s] = -999; // workspace too small, no result
+      pch_spo2_valid[s] = 0;
+      pn_heart_rate[s] = -999;
+      pch_hr_valid[s] = 0;
+    }
+    return;
+  }
+  lanes_t *an_ir = (lanes_t *)pn_workspace;
+  lanes_t *an_red = an_ir + n_buffer_length;
+  lanes_t *an_x = an_red + n_buffer_length;
+  lanes_t *an_y_idx = an_x + n_buffer_length;
+  int32_t *pn_valleys = (int32_t *)(an_y_idx + n_buffer_length);
+  int32_t *pn_segments = pn_valleys + L * MAXIM_VALLEYS_LEN(n_buffer_length);
+  void *p_queue = pn_segments + MAXIM_BATCH_SEGMENT_ARRAYS * MAXIM_BATCH_SEGMENTS_LEN(n_buffer_length);
+  maxim_batch_segments_t segments;
+  maxim_batch_segments_init(&segments, pn_segments, MAXIM_BATCH_SEGMENTS_LEN(n_buffer_length));
+  for (s = 0; s < n_streams; s += L)
+  {
+    int32_t n_lanes = (n_streams - s < L) ? n_streams - s : L;
+    maxim_batch_block(pun_ir_buffer, pun_red_buffer, n_streams, s, n_lanes, n_buffer_length,
+      pn_spo2, pch_spo2_valid, pn_heart_rate, pch_hr_valid, n_sample_rate, an_ir, an_red, an_x, an_y_idx,
+      pn_valleys, &segments, p_queue);
+  }
+}
+
+template void maxim_heart_rate_and_oxygen_saturation_batch<uint16_t>(const uint16_t *pun_ir_buffer, const uint16_t *pun_red_buffer,
+                int32_t n_streams, int32_t n_buffer_length, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes);
+template void maxim_heart_rate_and_oxygen_saturation_batch<uint32_t>(const uint32_t *pun_ir_buffer, const uint32_t *pun_red_buffer,
+                int32_t n_streams, int32_t n_buffer_length, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes);
@@ -0,0 +1,53 @@
+/*
+ Batched maxim_heart_rate_and_oxygen_saturation()
+
+ Computes heart rate and SpO2 of one window for many streams at once, with
+ the same results as calling maxim_heart_rate_and_oxygen_saturation() on
+ each stream. The windows are passed in structure of arrays layout, sample
+ k of stream s at buffer[k * n_streams + s], which is how a server collects
+ the samples of its subjects tick by tick.
+
+ Streams are processed MAXIM_BATCH_LANES at a time, one per SIMD lane. The
+ stages that run the same on every stream are vectorized across the streams:
+ DC mean and removal, the 4 point moving average, the threshold, the search
+ of the AC/DC maxima between valleys, where each lane restarts at its own
+ valleys with masked updates, and the AC/DC ratios, computed for the
+ stretches between valleys of all lanes together. The peak detector stays
+ scalar per lane; it is the largest part of the cost left.
+
+ The lanes are GCC vector extensions, which become SSE/AVX on x86 and NEON on
+ ARM, build with -march=native for the widest. MAXIM_BATCH_SCALAR, or a
+ compiler without them, selects the scalar fallback of one lane, which runs
+ the identical code.
+*/
+
+#pragma once
+
+#include "algorithm.h"
+
+#if defined(__GNUC__) && !defined(MAXIM_BATCH_SCALAR) && (defined(__AVX2__) || defined(__AVX512F__))
+ #define MAXIM_BATCH_LANES 8
+#elif defined(__GNUC__) && !defined(MAXIM_BATCH_SCALAR)
+ #define MAXIM_BATCH_LANES 4
+#else
+ #define MAXIM_BATCH_LANES 1
+#endif
+
+// Stretches between valleys of the lanes of a block, with padding to whole rows of lanes
+#define MAXIM_BATCH_SEGMENTS_LEN(n_window_len) (MAXIM_BATCH_LANES * MAXIM_VALLEYS_LEN(n_window_len))
+#define MAXIM_BATCH_SEGMENT_ARRAYS 12
+
+// Workspace of the batch: raw IR, raw red, filtered IR and the maxima positions of MAXIM_BATCH_LANES streams,
+// their valleys, the stretches between valleys and the peak detector queue the lanes take in turn,
+// rounded up to whole int32_t
+#define MAXIM_BATCH_WORKSPACE_BYTES(n_window_len) \
+  ((sizeof(int32_t) * (4 * MAXIM_BATCH_LANES * (n_window_len) + MAXIM_BATCH_LANES * MAXIM_VALLEYS_LEN(n_window_len) + \
+    MAXIM_BATCH_SEGMENT_ARRAYS * MAXIM_BATCH_SEGMENTS_LEN(n_window_len)) + MAXIM_PEAK_QUEUE_BYTES(n_window_len) + \
+    sizeof(int32_t) - 1) & ~(sizeof(int32_t) - 1))
+
+// Results are written per stream, pn_spo2[s] and so on.
+// Instantiated for uint16_t (MAX30100) and uint32_t (MAX30102).
+template<typename sample_t>
+void maxim_heart_rate_and_oxygen_saturation_batch(const sample_t *pun_ir_buffer, const sample_t *pun_red_buffer,
+                int32_t n_streams, int32_t n_buffer_length, int32_t n_sample_rate, int32_t *pn_spo2, int8_t *pch_spo2_valid,
+                int32_t *pn_heart_rate, int8_t *pch_hr_valid, int32_t *pn_workspace, size_t n_workspace_bytes);
@@ -0,0 +1,530 @@
+/*
+ Heart rate engine benchmark
+
+ Runs every heart rate engine over the same synthetic recordings and reports
+ the host cost per sample, the RAM the engine keeps on the device and the
+ heart rate error for clean, noisy and irregular signals. For the PBA detector
+ it also reports how precisely beats are timed against the synthetic beats, and
+ for the pipeline of the sketch how long after a start the first reading comes.
+ It compares the Maxim algorithm run stream by stream against the batched
+ one over many streams, as a server would run it. Last it checks the streaming
+ peak detector of algorithm.cpp against the sort based removal of close peaks
+ it replaced, without that one's cap of 15 candidates, from 25 to 1000
+ samples/s. It exits with 1 if either comparison finds a difference.
+
+   bench_hr [sampleRate] [seconds]
+
+ The cost is host time; on a microcontroller the ratio between the engines
+ is what carries over, not the absolute numbers.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <algorithm>
+
+#include "algorithm.h"
+#include "algorithmBatch.h"
+#include "heartRate.h"
+#include "goertzelHR.h"
+#include "autocorrHR.h"
+#include "synthPPG.h"
+#include "MAX30100_Sample.h"
+#include "pipeline.h"
+
+static const int MAXIM_WINDOW = BUFFER_SIZE;  // as in the sketch
+static const int MAXIM_SHIFT = BUFFER_SIZE / 4;
+
+struct recording {
+  float sampleRate;
+  std::vector<uint16_t> red, ir;
+};
+
+struct engine {
+  const char *name;
+  size_t stateBytes;
+  // processes the recording, returns the mean estimate of the second half in bpm, NAN if none
+  float (*run)(const recording &rec);
+};
+
+static double nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+//  PBA zero crossing detector, rate from the beat intervals
+static float runPBA(const recording &rec, uint8_t lowLatency)
+{
+  static beatDetector_t d;
+  beatDetectorInit(&d);
+  d.lowLatency = lowLatency;
+  int n = rec.ir.size();
+  long last = -1;
+  double sum = 0.0;
+  int count = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (checkForBeat(&d, rec.ir[i]))
+    {
+      if ((last >= 0) && (i >= n / 2))
+      {
+        sum += 60.0 * rec.sampleRate / (i - last);
+        count++;
+      }
+      last = i;
+    }
+  }
+  return (count ? sum / count : NAN);
+}
+
+static float runPBALong(const recording &rec) { return (runPBA(rec, 0)); }
+static float runPBAShort(const recording &rec) { return (runPBA(rec, 1)); }
+
+//  Maxim peak interval, sliding window of 4 s moved by 1 s as in the sketch
+static float runMaxim(const recording &rec)
+{
+  const int window = (int)(4 * rec.sampleRate), shift = window / 4;
+  std::vector<int32_t> workspace(MAXIM_WORKSPACE_BYTES(window) / sizeof(int32_t));
+  int n = rec.ir.size();
+  double sum = 0.0;
+  int count = 0;
+  for (int i = window; i <= n; i += shift)
+  {
+    int32_t spo2, heartRate;
+    int8_t validSPO2, validHeartRate;
+    maxim_heart_rate_and_oxygen_saturation(&rec.ir[i - window], window, &rec.red[i - window], (int32_t)rec.sampleRate,
+      &spo2, &validSPO2, &heartRate, &validHeartRate, workspace.data(), workspace.size() * sizeof(int32_t));
+    if (validHeartRate && (i >= n / 2))
+    {
+      sum += heartRate;
+      count++;
+    }
+  }
+  return (count ? sum / count : NAN);
+}
+
+//  Goertzel bank, 8 s blocks
+static float runGoertzel(const recording &rec)
+{
+  static goertzelHR_t g;
+  goertzelHRInit(&g, (uint16_t)rec.sampleRate, (uint16_t)(8 * rec.sampleRate));
+  int n = rec.ir.size();
+  double sum = 0.0;
+  int count = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (goertzelHRUpdate(&g, rec.ir[i]) && (i >= n / 2))
+    {
+      sum += g.bpm / 10.0;
+      count++;
+    }
+  }
+  return (count ? sum / count : NAN);
+}
+
+//  Running autocorrelation, an estimate every second
+static float runAutocorr(const recording &rec)
+{
+  static autocorrHR_t a;
+  autocorrHRInit(&a, (uint16_t)rec.sampleRate, (uint16_t)rec.sampleRate);
+  int n = rec.ir.size();
+  double sum = 0.0;
+  int count = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (autocorrHRUpdate(&a, rec.ir[i]) && a.bpm && (i >= n / 2))
+    {
+      sum += a.bpm / 10.0;
+      count++;
+    }
+  }
+  return (count ? sum / count : NAN);
+}
+
+static const engine engines[] = {
+  { "PBA checkForBeat", sizeof(beatDetector_t), runPBALong },
+  { "PBA low latency", sizeof(beatDetector_t), runPBAShort },
+  { "maxim peaks", MAXIM_WORKSPACE_BYTES(MAXIM_WINDOW) + MAXIM_STACK_BYTES + 2 * MAXIM_WINDOW * sizeof(uint16_t), runMaxim },
+  { "Goertzel bank", sizeof(goertzelHR_t), runGoertzel },
+  { "autocorrelation", sizeof(autocorrHR_t), runAutocorr },
+};
+static const int NUM_ENGINES = sizeof(engines) / sizeof(engines[0]);
+
+struct condition {
+  const char *name;
+  float noise, jitter, wander;
+};
+
+static const condition conditions[] = {
+  { "clean",     0.05f, 0.00f, 0.1f },
+  { "noisy",     0.60f, 0.00f, 0.5f },
+  { "irregular", 0.20f, 0.15f, 0.3f },
+};
+static const int NUM_CONDITIONS = sizeof(conditions) / sizeof(conditions[0]);
+
+static const float rates[] = { 45, 60, 75, 90, 120, 150, 180 };
+static const int NUM_RATES = sizeof(rates) / sizeof(rates[0]);
+
+static recording record(float fs, float seconds, float bpm, const condition &c, uint32_t seed)
+{
+  synthPPG ppg(fs, bpm, seed);
+  ppg.noise = c.noise;
+  ppg.jitter = c.jitter;
+  ppg.wander = c.wander;
+  recording rec;
+  rec.sampleRate = fs;
+  int n = (int)(fs * seconds);
+  for (int i = 0; i < n; i++)
+  {
+    uint32_t red, ir;
+    ppg.next(&red, &ir);
+    rec.red.push_back(red);
+    rec.ir.push_back(ir);
+  }
+  return (rec);
+}
+
+//  Beat times of a recording without jitter against its beats, which start every period
+//  samples from sample 0. Times are taken from the second half, as sample numbers and
+//  as interpolated and delay compensated times. Returns the mean and the standard
+//  deviation of both, in samples after the start of the beat.
+//  Returns the number of beats timed, none from a filter that stops the heart rate
+static int timeBeats(const recording &rec, float period, uint8_t lowLatency, double *lag, double *spread)
+{
+  static beatDetector_t d;
+  beatDetectorInit(&d);
+  d.lowLatency = lowLatency;
+  int n = rec.ir.size();
+  double sum[2] = { 0.0, 0.0 }, squares[2] = { 0.0, 0.0 };
+  int count = 0;
+  for (int i = 0; i < n; i++)
+  {
+    if (checkForBeat(&d, rec.ir[i]) && (i >= n / 2))
+    {
+      double t[2] = { (double)i, i + beatTimeOffset(&d) / 256.0 };
+      for (int k = 0; k < 2; k++)
+      {
+        double phase = t[k] - floor(t[k] / period) * period;
+        sum[k] += phase;
+        squares[k] += phase * phase;
+      }
+      count++;
+    }
+  }
+  for (int k = 0; k < 2; k++)
+  {
+    lag[k] = count ? sum[k] / count : NAN;
+    spread[k] = count ? sqrt(fmax(squares[k] / count - lag[k] * lag[k], 0.0)) : NAN;
+  }
+  return (count);
+}
+
+//  Pipeline of the sketch from its start with a finger on the sensor, cold as before or with
+//  the warm started DC estimator and provisional SpO2 results
+static const int PIPELINE_RATE = 50;
+
+template<class DCStage>
+struct firstReading {
+  typedef ppgPipeline<
+    ppgQuality<MAX30100_Format>,
+    DCStage,
+    ppgLowPass,
+    ppgBeat,
+    ppgDecimate<PIPELINE_RATE / FreqS>,
+    ppgSpO2<BUFFER_SIZE, FreqS, uint16_t>
+  > Pipeline;
+  enum { QUALITY, DC, LOWPASS, BEAT, DECIMATE, SPO2 };
+
+  static float bpm;
+  static uint32_t frame;
+  static float beatTime, resultTime;
+  static uint8_t confidence;
+
+  static bool close(float measured) { return (fabs(measured - bpm) <= 0.1f * bpm); }
+  static void onBeat(const ppgBeatEvent &beat) {
+    if (beat.bpm && close(beat.bpm / 10.0f) && (beatTime < 0)) beatTime = frame / (float)PIPELINE_RATE;
+  }
+  static void onResult(const ppgResult &result) {
+    if (result.validHeartRate && close(result.heartRate) && (resultTime < 0)) {
+      resultTime = frame / (float)PIPELINE_RATE;
+      confidence = result.confidence;
+    }
+  }
+
+  //  Seconds to the first beat rate and the first heart rate within 10%, -1 if none
+  static void run(const recording &rec, float heartRate, bool provisional, float *beat, float *result, uint8_t *conf) {
+    static Pipeline pipeline;
+    bpm = heartRate;
+    beatTime = resultTime = -1;
+    confidence = 0;
+    pipeline.begin(PIPELINE_RATE);
+    pipeline.template stage<BEAT>().onBeat(onBeat);
+    pipeline.template stage<SPO2>().onResult(onResult);
+    pipeline.template stage<SPO2>().provisional(provisional);
+    for (frame = 0; frame < rec.ir.size() && (beatTime < 0 || resultTime < 0); frame++)
+      pipeline.push(rec.red[frame], rec.ir[frame], 0);
+    *beat = beatTime;
+    *result = resultTime;
+    *conf = confidence;
+  }
+};
+template<class D> float firstReading<D>::bpm;
+template<class D> uint32_t firstReading<D>::frame;
+template<class D> float firstReading<D>::beatTime;
+template<class D> float firstReading<D>::resultTime;
+template<class D> uint8_t firstReading<D>::confidence;
+
+//  Maxim windows of many streams, one call per stream against one batched call per window.
+//  Returns the windows per second of each and the number of windows where they differ.
+static const int BATCH_STREAMS = 256;
+
+static int benchBatch(float seconds, double *scalarRate, double *batchRate)
+{
+  int n = (int)(FreqS * seconds);
+  std::vector<uint16_t> red((size_t)n * BATCH_STREAMS), ir((size_t)n * BATCH_STREAMS);
+  for (int s = 0; s < BATCH_STREAMS; s++)
+  {
+    recording rec = record(FreqS, seconds, rates[s % NUM_RATES], conditions[s % NUM_CONDITIONS], 100 + s);
+    for (int k = 0; k < n; k++)
+    {
+      red[(size_t)k * BATCH_STREAMS + s] = rec.red[k];
+      ir[(size_t)k * BATCH_STREAMS + s] = rec.ir[k];
+    }
+  }
+
+  static int32_t workspace[MAXIM_WORKSPACE_BYTES(MAXIM_WINDOW) / sizeof(int32_t)];
+  static int32_t batchWorkspace[MAXIM_BATCH_WORKSPACE_BYTES(MAXIM_WINDOW) / sizeof(int32_t)];
+  static uint16_t windowRed[MAXIM_WINDOW], windowIR[MAXIM_WINDOW];
+  int32_t spo2[2][BATCH_STREAMS], heartRate[2][BATCH_STREAMS];
+  int8_t validSPO2[2][BATCH_STREAMS], validHeartRate[2][BATCH_STREAMS];
+  double ns[2] = { 0.0, 0.0 };
+  int windows = 0, differ = 0;
+  for (int i = MAXIM_WINDOW; i <= n; i += MAXIM_SHIFT)
+  {
+    const size_t first = (size_t)(i - MAXIM_WINDOW) * BATCH_STREAMS;
+    double t0 = nowNs();
+    for (int s = 0; s < BATCH_STREAMS; s++)
+    {
+      //  A stream by stream server gathers each window too
+      for (int k = 0; k < MAXIM_WINDOW; k++)
+      {
+        windowRed[k] = red[first + (size_t)k * BATCH_STREAMS + s];
+        windowIR[k] = ir[first + (size_t)k * BATCH_STREAMS + s];
+      }
+      maxim_heart_rate_and_oxygen_saturation(windowIR, MAXIM_WINDOW, windowRed, FreqS, &spo2[0][s], &validSPO2[0][s],
+        &heartRate[0][s], &validHeartRate[0][s], workspace, sizeof(workspace));
+    }
+    double t1 = nowNs();
+    maxim_heart_rate_and_oxygen_saturation_batch(&ir[first], &red[first], BATCH_STREAMS, MAXIM_WINDOW, FreqS,
+      spo2[1], validSPO2[1], heartRate[1], validHeartRate[1], batchWorkspace, sizeof(batchWorkspace));
+    ns[0] += t1 - t0;
+    ns[1] += nowNs() - t1;
+    for (int s = 0; s < BATCH_STREAMS; s++)
+    {
+      if ((spo2[0][s] != spo2[1][s]) || (validSPO2[0][s] != validSPO2[1][s]) ||
+          (heartRate[0][s] != heartRate[1][s]) || (validHeartRate[0][s] != validHeartRate[1][s])) differ++;
+    }
+    windows += BATCH_STREAMS;
+  }
+  *scalarRate = windows / ns[0] * 1e9;
+  *batchRate = windows / ns[1] * 1e9;
+  return (differ);
+}
+
+//  Peak finding of algorithm.cpp before the streaming detector, all candidates above the
+//  height, then the highest first, removing those closer than the distance
+static void referencePeaks(std::vector<int32_t> &locs, const int32_t *pn_x, int32_t n_size, int32_t n_min_height, int32_t n_min_distance)
+{
+  int32_t i = 1, n_width;
+  locs.clear();
+  while (i < n_size - 1)
+  {
+    if (pn_x[i] > n_min_height && pn_x[i] > pn_x[i - 1])
+    {
+      n_width = 1;
+      while (i + n_width < n_size && pn_x[i] == pn_x[i + n_width]) n_width++;
+      if (pn_x[i] > pn_x[i + n_width])
+      {
+        locs.push_back(i);
+        i += n_width + 1;
+      }
+      else i += n_width;
+    }
+    else i++;
+  }
+  //  Stable like the insertion sort it had, equal heights keep the earlier first
+  std::stable_sort(locs.begin(), locs.end(), [pn_x](int32_t a, int32_t b) { return (pn_x[a] > pn_x[b]); });
+  int32_t n_npks = locs.size();
+  for (i = -1; i < n_npks; i++)
+  {
+    int32_t n_old_npks = n_npks;
+    n_npks = i + 1;
+    for (int32_t j = i + 1; j < n_old_npks; j++)
+    {
+      int32_t n_dist = locs[j] - (i == -1 ? -1 : locs[i]);
+      if (n_dist > n_min_distance || n_dist < -n_min_distance) locs[n_npks++] = locs[j];
+    }
+  }
+  locs.resize(n_npks);
+  std::sort(locs.begin(), locs.end());
+}
+
+//  Windows of 4 s where maxim_find_peaks() and the reference disagree, and where it keeps
+//  peaks closer than the distance. Valley search as in the algorithm: inverted IR, 4 point
+//  average, threshold from the mean, distance scaled from 4 at 25 samples/s.
+static const int PEAK_WINDOWS = 500;
+
+static void comparePeaks(float fs, float noiseCounts, int *differ, int *tooClose)
+{
+  const int32_t n = (int32_t)(4 * fs);
+  const int32_t distance = (int32_t)(4 * fs / 25);
+  condition c = { "peaks", noiseCounts / 300.0f, 0.05f, 0.3f }; //acIR is 300 counts
+  recording rec = record(fs, PEAK_WINDOWS + 4, 75, c, 7);
+  std::vector<int32_t> x(n), locs(n), reference;
+  std::vector<int32_t> queue(MAXIM_PEAK_QUEUE_BYTES(n) / sizeof(int32_t) + 1);
+  *differ = *tooClose = 0;
+  for (int w = 0; w < PEAK_WINDOWS; w++)
+  {
+    const uint16_t *ir = &rec.ir[(size_t)w * (size_t)fs];
+    uint32_t mean = 0;
+    for (int32_t k = 0; k < n; k++) mean += ir[k];
+    mean /= n;
+    for (int32_t k = 0; k < n; k++) x[k] = (int32_t)mean - ir[k];
+    for (int32_t k = 0; k < n - MA4_SIZE; k++) x[k] = (x[k] + x[k + 1] + x[k + 2] + x[k + 3]) / 4;
+    int32_t th = 0;
+    for (int32_t k = 0; k < n; k++) th += x[k];
+    th /= n;
+    th = th < 30 ? 30 : (th > 60 ? 60 : th);
+
+    int32_t npks;
+    maxim_find_peaks(locs.data(), &npks, x.data(), n, th, distance, n, queue.data());
+    referencePeaks(reference, x.data(), n, th, distance);
+    if ((npks != (int32_t)reference.size()) || !std::equal(reference.begin(), reference.end(), locs.begin())) (*differ)++;
+    for (int32_t k = 1; k < npks; k++)
+    {
+      if (locs[k] - locs[k - 1] <= distance)
+      {
+        (*tooClose)++;
+        break;
+      }
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  float fs = (argc > 1) ? atof(argv[1]) : FreqS;
+  float seconds = (argc > 2) ? atof(argv[2]) : 60.0f;
+
+  printf("%.0f samples/s, %.0f s per recording, rates", fs, seconds);
+  for (int r = 0; r < NUM_RATES; r++) printf(" %.0f", rates[r]);
+  printf(" bpm\n\n");
+  printf("%-18s %10s %8s", "engine", "ns/sample", "RAM");
+  for (int c = 0; c < NUM_CONDITIONS; c++) printf(" %10s", conditions[c].name);
+  printf("   (mean abs error bpm, missed)\n");
+
+  for (int e = 0; e < NUM_ENGINES; e++)
+  {
+    double ns = 0.0;
+    long samples = 0;
+    printf("%-18s", engines[e].name);
+    char errors[NUM_CONDITIONS][32];
+    for (int c = 0; c < NUM_CONDITIONS; c++)
+    {
+      double err = 0.0;
+      int found = 0, missed = 0;
+      for (int r = 0; r < NUM_RATES; r++)
+      {
+        recording rec = record(fs, seconds, rates[r], conditions[c], 1 + r);
+        double t0 = nowNs();
+        float bpm = engines[e].run(rec);
+        ns += nowNs() - t0;
+        samples += rec.ir.size();
+        if (isnan(bpm)) missed++;
+        else
+        {
+          err += fabs(bpm - rates[r]);
+          found++;
+        }
+      }
+      snprintf(errors[c], sizeof(errors[c]), "%5.1f/%d", found ? err / found : NAN, missed);
+    }
+    printf(" %10.1f %8u", ns / samples, (unsigned)engines[e].stateBytes);
+    for (int c = 0; c < NUM_CONDITIONS; c++) printf(" %10s", errors[c]);
+    printf("\n");
+  }
+
+  //  Beats without jitter or noise, every beat should land on the same phase of its period
+  printf("\nPBA beat timing, no noise or jitter   (ms after the start of the beat modulo the period, mean +- sd)\n");
+  printf("%-18s %8s %22s %22s\n", "filter", "bpm", "sample number", "interpolated");
+  condition steady = { "steady", 0.0f, 0.0f, 0.0f };
+  for (int lowLatency = 0; lowLatency < 2; lowLatency++)
+  {
+    for (int r = 0; r < NUM_RATES; r += 3)
+    {
+      recording rec = record(fs, seconds, rates[r], steady, 1 + r);
+      double lag[2], spread[2];
+      const char *filter = lowLatency ? "15 taps" : "23 taps";
+      if (timeBeats(rec, 60.0f * fs / rates[r], lowLatency, lag, spread) == 0)
+      {
+        //  The 23 tap filter passes up to about 0.06 of the sample rate, 90 bpm at 25 samples/s
+        printf("%-18s %8.0f %22s %22s\n", filter, rates[r], "no beats", "no beats");
+        continue;
+      }
+      double ms = 1000.0 / fs;
+      printf("%-18s %8.0f %12.1f +- %5.2f %12.1f +- %5.2f\n", filter, rates[r],
+        lag[0] * ms, spread[0] * ms, lag[1] * ms, spread[1] * ms);
+    }
+  }
+
+  printf("\nTime to first reading, pipeline of the sketch at %d samples/s, clean   (s to within 10%%, confidence)\n",
+    PIPELINE_RATE);
+  printf("%-18s %8s %12s %16s\n", "start", "bpm", "beat rate", "heart rate");
+  for (int warm = 0; warm < 2; warm++)
+  {
+    for (int r = 0; r < NUM_RATES; r += 2)
+    {
+      recording rec = record(PIPELINE_RATE, 20.0f, rates[r], conditions[0], 1 + r);
+      float beat, result;
+      uint8_t conf;
+      if (warm) firstReading<ppgDCRemoveWarm>::run(rec, rates[r], true, &beat, &result, &conf);
+      else firstReading<ppgDCRemove>::run(rec, rates[r], false, &beat, &result, &conf);
+      char beatText[16], resultText[16];
+      snprintf(beatText, sizeof(beatText), beat < 0 ? "none" : "%.2f", beat);
+      snprintf(resultText, sizeof(resultText), result < 0 ? "none" : "%.2f %3u%%", result, conf);
+      printf("%-18s %8.0f %12s %16s\n", warm ? "warm, provisional" : "cold", rates[r], beatText, resultText);
+    }
+  }
+
+  printf("\nMaxim algorithm on %d streams at %d samples/s, %d lanes   (windows/s of one core)\n",
+    BATCH_STREAMS, FreqS, MAXIM_BATCH_LANES);
+  double scalarRate, batchRate;
+  int differ = benchBatch(seconds, &scalarRate, &batchRate);
+  printf("%-18s %12.0f\n", "per stream", scalarRate);
+  printf("%-18s %12.0f   x%.1f, %d windows differ\n", "batched", batchRate, batchRate / scalarRate, differ);
+
+  static const float peakRates[] = { 25, 100, 200, 1000 };
+  static const float peakNoise[] = { 2, 10, 40 };
+  printf("\nMaxim peak detector against the sort based removal, %d windows of 4 s   (differ/too close)\n", PEAK_WINDOWS);
+  printf("%-18s", "samples/s");
+  for (unsigned j = 0; j < sizeof(peakNoise) / sizeof(peakNoise[0]); j++) printf("  noise %3.0f", peakNoise[j]);
+  printf("\n");
+  int peaksDiffer = 0;
+  for (unsigned i = 0; i < sizeof(peakRates) / sizeof(peakRates[0]); i++)
+  {
+    printf("%-18.0f", peakRates[i]);
+    for (unsigned j = 0; j < sizeof(peakNoise) / sizeof(peakNoise[0]); j++)
+    {
+      int windowsDiffer, tooClose;
+      comparePeaks(peakRates[i], peakNoise[j], &windowsDiffer, &tooClose);
+      printf("  %4d/%-4d", windowsDiffer, tooClose);
+      peaksDiffer += windowsDiffer + tooClose;
+    }
+    printf("\n");
+  }
+  return ((differ || peaksDiffer) ? 1 : 0);
+}
@@ -0,0 +1,327 @@
+/*
+ I2C bus budget of the driver
+
+ Runs the driver's check() against simulated sensors (MAX30100_Mock) on a
+ simulated bus. Every transaction the driver issues costs its clocks at the
+ bus speed plus a fixed software overhead, and the sensors keep sampling
+ while the bus is busy. The numbers come from the transactions the driver
+ really makes: the pointer read and the FIFO bursts, split by the transport's
+ buffer length.
+
+   i2c_budget [-s speed] [-b buffer] [-i ms] [-o us] [-n sensors] [-m hr|spo2] [-r rate] [-w width]
+
+   -s speed    bus clock in Hz, default 100000 (I2C_SPEED_STANDARD)
+   -b buffer   longest read of the transport, I2C_BUFFER_LENGTH, default 32 (AVR)
+   -i ms       polling interval, default 20
+   -o us       software overhead per transaction, default 20
+   -n sensors  sensors on the bus, up to 8, default 1, 2, 4 and 8
+   -m -r -w    one mode, sample rate and pulse width instead of all that the sensor allows
+
+ More than one sensor needs an I2C multiplexer, the sensor address is fixed.
+ Changing its channel costs one more write whenever the next sensor is read.
+
+ The pulse width does not change the bus load, a row covers every width the mode
+ allows at its rate. For every row it prints the bus time per drain and the bus
+ utilization at the polling interval, the time the FIFO takes to fill, the
+ longest polling interval that still keeps two samples of headroom in the FIFO,
+ and whether samples are lost. On the MAX30100 A_FULL fires at 15 of 16 samples
+ and cannot be moved. Instead of a threshold the tool recommends that polling
+ interval, and tells whether a drain started on A_FULL finishes before the
+ FIFO overflows when all sensors raise it together.
+
+ The headroom matters: with all 16 slots taken and no sample lost yet the write
+ pointer equals the read pointer, as on an empty FIFO, and check() reads nothing.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "MAX30100.h"
+#include "MAX30100_Mock.h"
+
+//  Clocks of one transaction: start, address, register, repeated start, address, data, stop
+#define READ_CLOCKS(len)   (1 + 9 + 9 + 1 + 9 + 9 * (len) + 1)
+#define WRITE_CLOCKS       (1 + 9 + 9 + 9 + 1)
+#define MUX_SELECT_CLOCKS  (1 + 9 + 9 + 1) //address and channel mask
+#define MAX_SENSORS        8                //channels of a TCA9548A multiplexer
+
+//  Sensors sharing one bus, the clock of all of them
+struct simBus {
+  uint32_t speed;
+  uint32_t overheadUs;
+  uint8_t bufferLength;
+  MAX30100_Mock *sensors;
+  int count;
+  int selected;          // multiplexer channel, -1 before the first
+  double nowUs;          // virtual time
+  double busyUs;         // time the bus was in use
+  double carryUs;        // fraction of a us not yet handed to the sensors
+  uint32_t transactions;
+
+  // Time passes for every sensor
+  void elapse(double us) {
+    nowUs += us;
+    carryUs += us;
+    uint32_t whole = (uint32_t)carryUs;
+    carryUs -= whole;
+    for (int i = 0; i < count; i++) sensors[i].advance(whole);
+  }
+
+  // A transaction of so many clocks
+  void spend(uint32_t clocks) {
+    double us = clocks * 1e6 / speed + overheadUs;
+    busyUs += us;
+    transactions++;
+    elapse(us);
+  }
+};
+
+//  One sensor's view of the bus
+class BusTransport : public MAX30100_Transport {
+ public:
+  void attach(simBus &bus, MAX30100_Mock &mock, int channel) {
+    _bus = &bus;
+    _mock = &mock;
+    _channel = channel;
+  }
+
+  uint8_t readBurst(uint8_t address, uint8_t reg, uint8_t *buffer, uint8_t len) {
+    select();
+    uint8_t status = _mock->readBurst(address, reg, buffer, len);
+    _bus->spend(READ_CLOCKS(len));
+    return (status);
+  }
+  uint8_t writeRegister8(uint8_t address, uint8_t reg, uint8_t value) {
+    select();
+    uint8_t status = _mock->writeRegister8(address, reg, value);
+    _bus->spend(WRITE_CLOCKS);
+    return (status);
+  }
+  uint8_t maxBurst(void) { return (_bus->bufferLength); }
+
+ private:
+  simBus *_bus;
+  MAX30100_Mock *_mock;
+  int _channel;
+  void select(void) {
+    if ((_bus->count > 1) && (_bus->selected != _channel)) {
+      _bus->spend(MUX_SELECT_CLOCKS);
+      _bus->selected = _channel;
+    }
+  }
+};
+
+struct config {
+  uint8_t mode;      // MAX30100_MODE_HR or _SPO2
+  int rate;          // samples/s
+  int width;         // widest pulse in us the mode allows at this rate
+};
+
+struct outcome {
+  double drainUs;    // bus time per check() of one sensor
+  double busShare;   // bus utilization
+  uint8_t peak;      // most samples a check() found
+  uint32_t lost;     // samples the sensors dropped
+  uint32_t made;
+};
+
+static uint32_t speed = 100000;
+static uint8_t bufferLength = 32;
+static uint32_t overheadUs = 20;
+
+//  Bus, sensors and drivers for one run
+struct simulation {
+  simBus bus;
+  MAX30100_Mock mocks[MAX_SENSORS];
+  BusTransport transports[MAX_SENSORS];
+  MAX30100 drivers[MAX_SENSORS];
+  int count;
+
+  simulation(const config &c, int sensors) : count(sensors) {
+    bus.speed = speed;
+    bus.overheadUs = overheadUs;
+    bus.bufferLength = bufferLength;
+    bus.sensors = mocks;
+    bus.count = sensors;
+    bus.selected = -1;
+    bus.nowUs = bus.busyUs = bus.carryUs = 0.0;
+    for (int i = 0; i < sensors; i++)
+    {
+      mocks[i].ppg.rng = 1 + i;
+      mocks[i].virtualTime = true;
+      mocks[i].burstLimit = bufferLength;
+      transports[i].attach(bus, mocks[i], i);
+      drivers[i].begin(transports[i]);
+      drivers[i].setup(0x07, c.mode, c.rate, c.width, false);
+      drivers[i].clearFIFO();
+    }
+    for (int i = 0; i < sensors; i++) mocks[i].samplesMade = mocks[i].samplesLost = 0;
+    bus.busyUs = 0.0;
+    bus.transactions = 0;
+  }
+
+  // Drains every sensor in turn, returns the most samples one check() found
+  uint8_t drainAll(void) {
+    uint8_t peak = 0;
+    for (int i = 0; i < count; i++)
+    {
+      uint16_t n = drivers[i].check();
+      if (n > peak) peak = n;
+      while (drivers[i].available()) drivers[i].nextSample();
+    }
+    return (peak);
+  }
+
+  uint32_t lost(void) const {
+    uint32_t n = 0;
+    for (int i = 0; i < count; i++) n += mocks[i].samplesLost;
+    return (n);
+  }
+};
+
+//  Polls every intervalUs for a while, as the sketch's loop would
+static outcome poll(const config &c, int sensors, double intervalUs)
+{
+  simulation sim(c, sensors);
+  outcome o;
+  o.peak = 0;
+  uint32_t drains = 0;
+  double endUs = 2e6 + 40.0 * intervalUs; //a few dozen polls at the longest intervals
+  while (sim.bus.nowUs < endUs)
+  {
+    double start = sim.bus.nowUs;
+    uint8_t peak = sim.drainAll();
+    if (peak > o.peak) o.peak = peak;
+    drains += sensors;
+    double spent = sim.bus.nowUs - start;
+    if (spent < intervalUs) sim.bus.elapse(intervalUs - spent);
+  }
+  o.drainUs = sim.bus.busyUs / drains;
+  o.busShare = sim.bus.busyUs / sim.bus.nowUs;
+  o.lost = sim.lost();
+  o.made = 0;
+  for (int i = 0; i < sensors; i++) o.made += sim.mocks[i].samplesMade;
+  return (o);
+}
+
+//  The sensors fill up together, on the A_FULL of the first one all are drained in turn
+//  Returns the bus time of the drains, *lost the samples dropped meanwhile
+static double aFull(const config &c, int sensors, uint32_t *lost)
+{
+  simulation sim(c, sensors);
+  sim.drainAll();
+  uint8_t status = 0;
+  while (!(status & MAX30100_INT_A_FULL_ENABLE))
+  {
+    sim.bus.elapse(10.0);
+    sim.mocks[0].readBurst(MAX30100_ADDRESS, MAX30100_INTSTAT, &status, 1); //the interrupt line, no bus time
+  }
+  double start = sim.bus.nowUs;
+  sim.drainAll();
+  *lost = sim.lost();
+  return (sim.bus.nowUs - start);
+}
+
+//  Longest polling interval in 0.1 ms that keeps the FIFO two samples short of full
+static double longestInterval(const config &c, int sensors)
+{
+  double lo = 0.0, hi = MAX30100_FIFO_DEPTH * 1e6 / c.rate;
+  for (int i = 0; i < 12; i++)
+  {
+    double mid = (lo + hi) / 2;
+    outcome o = poll(c, sensors, mid);
+    if ((o.lost == 0) && (o.peak <= MAX30100_FIFO_DEPTH - 2)) lo = mid;
+    else hi = mid;
+  }
+  if (lo < 100.0)
+  {
+    outcome o = poll(c, sensors, 0.0);
+    if ((o.lost > 0) || (o.peak > MAX30100_FIFO_DEPTH - 2)) return (-1.0); //not even back to back polling
+  }
+  return ((int)(lo / 100.0) * 100.0);
+}
+
+static void report(const config &c, int sensors, double intervalUs)
+{
+  outcome o = poll(c, sensors, intervalUs);
+  uint32_t aFullLost;
+  double aFullUs = aFull(c, sensors, &aFullLost);
+  double longest = longestInterval(c, sensors);
+  char longestText[16];
+  if (longest < 0) snprintf(longestText, sizeof(longestText), "none");
+  else snprintf(longestText, sizeof(longestText), "%.1f", longest / 1000.0);
+  char widthText[16];
+  snprintf(widthText, sizeof(widthText), c.width > 200 ? "200-%d" : "%d", c.width);
+  printf("%-5s %5d %9s %7d %9.0f %6.1f%% %7.1f %9s %5.2f %-4s %5u/16  %s\n",
+    c.mode == MAX30100_MODE_SPO2 ? "spo2" : "hr", c.rate, widthText, sensors, o.drainUs, 100.0 * o.busShare,
+    MAX30100_FIFO_DEPTH * 1000.0 / c.rate, longestText, aFullUs / 1000.0, aFullLost ? "late" : "ok", o.peak,
+    o.lost ? "LOSES SAMPLES" : (o.peak > MAX30100_FIFO_DEPTH - 2 ? "no headroom" : "ok"));
+}
+
+//  Combinations the sensor allows, datasheet tables 8 and 9, widest pulse per mode and rate
+static const int RATES[8] = { 50, 100, 167, 200, 400, 600, 800, 1000 };
+static const int SPO2_WIDEST[8] = { 1600, 1600, 800, 800, 400, 200, 200, 200 };
+static const int HR_WIDEST[8] = { 1600, 1600, 800, 800, 400, 400, 400, 400 };
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-s speed] [-b buffer] [-i ms] [-o us] [-n sensors] [-m hr|spo2] [-r rate] [-w width]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+  double intervalMs = 20.0;
+  int sensors = 0, rate = 0, width = 0;
+  const char *modeName = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:b:i:o:n:m:r:w:")) != -1)
+  {
+    switch (opt)
+    {
+      case 's': speed = strtoul(optarg, NULL, 0); break;
+      case 'b': bufferLength = atoi(optarg); break;
+      case 'i': intervalMs = atof(optarg); break;
+      case 'o': overheadUs = strtoul(optarg, NULL, 0); break;
+      case 'n': sensors = atoi(optarg); break;
+      case 'm': modeName = optarg; break;
+      case 'r': rate = atoi(optarg); break;
+      case 'w': width = atoi(optarg); break;
+      default: usage(argv[0]); return (2);
+    }
+  }
+  if ((speed == 0) || (bufferLength < 4) || (intervalMs < 0) || (sensors < 0) || (sensors > MAX_SENSORS) ||
+      ((modeName != NULL) && strcmp(modeName, "hr") && strcmp(modeName, "spo2")))
+  {
+    usage(argv[0]);
+    return (2);
+  }
+
+  printf("bus %u Hz, buffer %u bytes, %u us per transaction, polling every %.1f ms\n\n",
+    speed, bufferLength, overheadUs, intervalMs);
+  printf("%-5s %5s %9s %7s %9s %7s %7s %9s %10s %8s  %s\n", "mode", "rate", "width us", "sensors", "drain us",
+    "bus", "fill ms", "max poll", "A_FULL ms", "peak", "at this interval");
+
+  std::vector<int> counts;
+  if (sensors > 0) counts.push_back(sensors);
+  else { counts.push_back(1); counts.push_back(2); counts.push_back(4); counts.push_back(8); }
+
+  for (int m = 0; m < 2; m++)
+  {
+    config c;
+    c.mode = m ? MAX30100_MODE_SPO2 : MAX30100_MODE_HR;
+    if ((modeName != NULL) && (strcmp(modeName, m ? "spo2" : "hr") != 0)) continue;
+    for (int r = 0; r < 8; r++)
+    {
+      if ((rate > 0) && (RATES[r] != rate)) continue;
+      c.rate = RATES[r];
+      c.width = m ? SPO2_WIDEST[r] : HR_WIDEST[r];
+      if (width > c.width) continue; //not allowed at this rate
+      if (width > 0) c.width = width;
+      for (size_t n = 0; n < counts.size(); n++) report(c, counts[n], intervalMs * 1000.0);
+    }
+  }
+  return (0);
+}
@@ -0,0 +1,550 @@
+/*
+ Multi-stream ingest daemon
+
+ Reads the serial output of any number of boards running MAX30100.ino,
+ recomputes beats, heart rate and SpO2 per stream and exports metrics.
+
+   ingestd [-b baud] [-w workers] [-m metrics file] [-i seconds] [-s name] [-q] device...
+
+ One thread multiplexes all devices with epoll and non-blocking reads and
+ parses the "R:red,ir,..." lines or decodes the compressed blocks of
+ ppgCodec.h, both may be mixed. Samples go through a per-stream spscQueue
+ to a pool of worker threads; each stream belongs to one worker, which runs
+ the sketch's pipeline on it. Devices that disappear are reopened.
+
+ Results are printed to stdout, one line per stream and SpO2 window:
+   <device> H:<bpm>,B:<valid>,O:<spo2>,V:<valid>,Q:<quality>
+
+ Metrics are written in Prometheus text format every interval, to the
+ metrics file (replaced atomically) or to stderr.
+
+ With -s the samples, beats and results are also published to the shared
+ memory ring of ppgShm.h under that name, for any number of local readers
+ such as ppg_tap. The workers take turns as the ring's one writer.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MAX30100_Sample.h"
+#include "pipeline.h"
+#include "spscQueue.h"
+#include "ppgCodec.h"
+#include "ppgShm.h"
+
+static const int SKETCH_SAMPLE_RATE = 50;  // MAX30100.ino, decimated by 2 for SpO2
+static const int LINE_LENGTH = 128;
+static const int QUEUE_SIZE = 1024;        // 20 s of samples per stream
+
+typedef ppgPipeline<
+  ppgQuality<MAX30100_Format>,
+  ppgDCRemove,
+  ppgLowPass,
+  ppgBeat,
+  ppgDecimate<SKETCH_SAMPLE_RATE / FreqS>,
+  ppgSpO2<BUFFER_SIZE, FreqS, uint16_t>
+> Pipeline;
+enum { QUALITY, DC, LOWPASS, BEAT, DECIMATE, SPO2 };
+
+// Sample as received, with the time it was read
+struct rxSample {
+  ppgSample sample;
+  uint64_t rxTimeUs;
+};
+
+struct stream {
+  // Reader thread
+  std::string path;
+  int fd;
+  char line[LINE_LENGTH];
+  int lineLength;
+  uint64_t bytes;
+  uint64_t samples;
+  uint64_t parseErrors;
+  ppgDecoder_t decoder;
+  uint64_t reopens;                 // opens after the device was open once
+  bool opened;                      // had a working fd before
+  uint64_t lastSamples;             // samples and processed at the previous export
+  uint64_t lastProcessed;
+  spscQueue<rxSample, QUEUE_SIZE> queue;
+  // Worker thread
+  Pipeline pipeline;
+  std::atomic<uint64_t> processed;
+  std::atomic<uint64_t> beats;
+  std::atomic<uint64_t> windows;
+  std::atomic<uint64_t> latencySumUs;
+  std::atomic<uint32_t> latencyMaxUs;
+  std::atomic<int32_t> heartRate;   // last valid results, -1 if none
+  std::atomic<int32_t> spo2;
+  uint8_t worker;
+  uint16_t shmStream;               // stream number in the shared memory ring
+};
+
+struct worker {
+  std::vector<stream *> streams;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool pending;
+};
+
+static std::vector<stream *> streams;
+static std::vector<worker *> workers;
+static std::atomic<bool> running(true);
+static std::mutex outputLock;
+static bool quiet = false;
+static thread_local stream *current = NULL;  // stream a worker is processing, for the callbacks
+static thread_local rxSample currentSample;   // and the sample, for the time and number of the events
+static ppgShmWriter ring;
+static bool sharing = false;
+static std::mutex ringLock;
+
+static uint64_t nowUs(void)
+{
+  return (std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void onStop(int)
+{
+  running = false;
+}
+
+static speed_t baudConstant(long baud)
+{
+  switch (baud)
+  {
+    case 9600:   return (B9600);
+    case 19200:  return (B19200);
+    case 38400:  return (B38400);
+    case 57600:  return (B57600);
+    case 115200: return (B115200);
+    case 230400: return (B230400);
+    case 460800: return (B460800);
+    case 921600: return (B921600);
+  }
+  return (B0);
+}
+
+//  Open a device non-blocking and raw, -1 on failure
+static int openSerial(const char *path, speed_t speed)
+{
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return (-1);
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return (fd);
+}
+
+//  "R:red,ir,..." to a sample, false for anything else
+static bool parseLine(const char *line, ppgSample *s)
+{
+  if ((line[0] != 'R') || (line[1] != ':')) return (false);
+  char *end;
+  unsigned long red = strtoul(line + 2, &end, 10);
+  if ((end == line + 2) || (*end != ',')) return (false);
+  const char *p = end + 1;
+  unsigned long ir = strtoul(p, &end, 10);
+  if ((end == p) || ((*end != ',') && (*end != '\0'))) return (false);
+  s->red = red;
+  s->ir = ir;
+  s->flags = 0;
+  return (true);
+}
+
+//  Split what was read into compressed blocks and lines and queue the samples
+//  Returns true if samples were queued
+static bool consume(stream *st, const char *data, ssize_t n, uint64_t rxTime)
+{
+  bool queued = false;
+  st->bytes += n;
+  for (ssize_t i = 0; i < n; i++)
+  {
+    uint8_t decoded = ppgDecode(&st->decoder, data[i]);
+    if (decoded == PPG_DECODE_BLOCK)
+    {
+      for (uint8_t k = 0; k < st->decoder.count; k++)
+      {
+        rxSample rx;
+        rx.sample.red = st->decoder.redOut[k];
+        rx.sample.ir = st->decoder.irOut[k];
+        rx.sample.flags = 0;
+        rx.rxTimeUs = rxTime;
+        st->queue.push(rx);
+        st->samples++;
+      }
+      queued = true;
+    }
+    if (decoded != PPG_DECODE_TEXT) continue;
+    char c = data[i];
+    if ((c != '\n') && (c != '\r'))
+    {
+      if (st->lineLength < LINE_LENGTH - 1) st->line[st->lineLength++] = c;
+      continue;
+    }
+    if (st->lineLength == 0) continue;
+    st->line[st->lineLength] = '\0';
+    rxSample rx;
+    if (parseLine(st->line, &rx.sample))
+    {
+      rx.rxTimeUs = rxTime;
+      st->queue.push(rx); //counted as a stall when the worker falls behind
+      st->samples++;
+      queued = true;
+    }
+    else if (st->line[0] == 'R')
+    {
+      st->parseErrors++;
+    }
+    st->lineLength = 0;
+  }
+  return (queued);
+}
+
+//  Into the shared memory ring, with the time and number of the sample being processed
+static void share(ppgShmRecord &r, uint8_t type)
+{
+  r.timeUs = currentSample.rxTimeUs;
+  r.index = current->processed.load(std::memory_order_relaxed);
+  r.stream = current->shmStream;
+  r.type = type;
+  r.flags = currentSample.sample.flags;
+  std::lock_guard<std::mutex> guard(ringLock);
+  ring.publish(r);
+}
+
+static void onBeat(const ppgBeatEvent &beat)
+{
+  current->beats.fetch_add(1, std::memory_order_relaxed);
+  if (!sharing) return;
+  ppgShmRecord r;
+  r.beat.bpm = beat.bpm;
+  r.beat.bpmAverage = beat.bpmAverage;
+  r.beat.offset = beat.offset;
+  share(r, PPG_SHM_BEAT);
+}
+
+static void onResult(const ppgResult &result)
+{
+  current->windows.fetch_add(1, std::memory_order_relaxed);
+  if (result.validHeartRate) current->heartRate.store(result.heartRate, std::memory_order_relaxed);
+  if (result.validSPO2) current->spo2.store(result.spo2, std::memory_order_relaxed);
+  if (sharing)
+  {
+    ppgShmRecord r;
+    r.result.heartRate = result.heartRate;
+    r.result.spo2 = result.spo2;
+    r.result.validHeartRate = result.validHeartRate;
+    r.result.validSPO2 = result.validSPO2;
+    r.result.quality = result.quality;
+    r.result.confidence = result.confidence;
+    share(r, PPG_SHM_RESULT);
+  }
+  if (quiet) return;
+  std::lock_guard<std::mutex> guard(outputLock);
+  printf("%s H:%ld,B:%d,O:%ld,V:%d,Q:%d\n", current->path.c_str(), (long)result.heartRate, result.validHeartRate,
+    (long)result.spo2, result.validSPO2, result.quality);
+  fflush(stdout);
+}
+
+//  Worker: drain the queues of its streams through their pipelines
+static void work(worker *w)
+{
+  while (running)
+  {
+    {
+      std::unique_lock<std::mutex> guard(w->lock);
+      w->wake.wait_for(guard, std::chrono::milliseconds(100), [w] { return (w->pending || !running); });
+      w->pending = false;
+    }
+    for (size_t i = 0; i < w->streams.size(); i++)
+    {
+      stream *st = w->streams[i];
+      current = st;
+      rxSample &rx = currentSample;
+      while (st->queue.pop(rx))
+      {
+        if (sharing)
+        {
+          //  Ahead of the beat and result it completes
+          ppgShmRecord r;
+          r.sample.red = rx.sample.red;
+          r.sample.ir = rx.sample.ir;
+          share(r, PPG_SHM_SAMPLE);
+        }
+        st->pipeline.push(rx.sample.red, rx.sample.ir, rx.sample.flags);
+        uint32_t latency = nowUs() - rx.rxTimeUs;
+        st->latencySumUs.fetch_add(latency, std::memory_order_relaxed);
+        if (latency > st->latencyMaxUs.load(std::memory_order_relaxed)) st->latencyMaxUs.store(latency, std::memory_order_relaxed);
+        st->processed.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+  }
+}
+
+//  Prometheus text format
+static void exportMetrics(const char *path, double seconds)
+{
+  std::string out;
+  char buf[256];
+  const char *names[][3] = {
+    { "ppg_bytes_total", "counter", "Bytes read from the device" },
+    { "ppg_samples_total", "counter", "Samples parsed" },
+    { "ppg_parse_errors_total", "counter", "Sample lines that did not parse" },
+    { "ppg_block_errors_total", "counter", "Compressed blocks lost to corruption or a gap" },
+    { "ppg_dropped_total", "counter", "Samples dropped because the worker fell behind" },
+    { "ppg_reopens_total", "counter", "Times the device was reopened" },
+    { "ppg_processed_total", "counter", "Samples through the pipeline" },
+    { "ppg_beats_total", "counter", "Beats detected" },
+    { "ppg_windows_total", "counter", "SpO2 windows calculated" },
+    { "ppg_sample_rate", "gauge", "Samples per second over the last interval" },
+    { "ppg_queue_high_water", "gauge", "Most samples waiting for the worker" },
+    { "ppg_latency_avg_us", "gauge", "Mean time from read to processed over the last interval" },
+    { "ppg_latency_max_us", "gauge", "Longest time from read to processed over the last interval" },
+    { "ppg_heart_rate_bpm", "gauge", "Last valid heart rate" },
+    { "ppg_spo2_percent", "gauge", "Last valid SpO2" },
+    { "ppg_connected", "gauge", "Device open" },
+  };
+  const int NUM_METRICS = sizeof(names) / sizeof(names[0]);
+  std::vector<std::vector<double> > values(streams.size(), std::vector<double>(NUM_METRICS));
+  for (size_t i = 0; i < streams.size(); i++)
+  {
+    stream *st = streams[i];
+    uint64_t processed = st->processed.load();
+    uint64_t latencySum = st->latencySumUs.exchange(0);
+    uint64_t interval = processed - st->lastProcessed;
+    st->lastProcessed = processed;
+    double v[] = {
+      (double)st->bytes, (double)st->samples, (double)st->parseErrors, (double)st->decoder.dropped,
+      (double)st->queue.stats.stalls, (double)st->reopens, (double)processed, (double)st->beats.load(),
+      (double)st->windows.load(), (st->samples - st->lastSamples) / seconds, (double)st->queue.stats.highWater,
+      interval ? (double)latencySum / interval : 0.0, (double)st->latencyMaxUs.exchange(0),
+      (double)st->heartRate.load(), (double)st->spo2.load(), st->fd >= 0 ? 1.0 : 0.0,
+    };
+    st->lastSamples = st->samples;
+    for (int m = 0; m < NUM_METRICS; m++) values[i][m] = v[m];
+  }
+  for (int m = 0; m < NUM_METRICS; m++)
+  {
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n", names[m][0], names[m][2], names[m][0], names[m][1]);
+    out += buf;
+    for (size_t i = 0; i < streams.size(); i++)
+    {
+      snprintf(buf, sizeof(buf), "%s{device=\"%s\"} %.6g\n", names[m][0], streams[i]->path.c_str(), values[i][m]);
+      out += buf;
+    }
+  }
+
+  if (path == NULL)
+  {
+    fputs(out.c_str(), stderr);
+    return;
+  }
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+  if (f == NULL) return;
+  fputs(out.c_str(), f);
+  fclose(f);
+  rename(tmp.c_str(), path);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: ingestd [-b baud] [-w workers] [-m metrics file] [-i seconds] [-s name] [-q] device...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  long baud = 115200;
+  int numWorkers = std::thread::hardware_concurrency();
+  const char *metricsPath = NULL;
+  const char *ringName = NULL;
+  double interval = 10.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "b:w:m:i:s:q")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b': baud = atol(optarg); break;
+      case 'w': numWorkers = atoi(optarg); break;
+      case 'm': metricsPath = optarg; break;
+      case 'i': interval = atof(optarg); break;
+      case 's': ringName = optarg; break;
+      case 'q': quiet = true; break;
+      default: usage();
+    }
+  }
+  if (optind >= argc) usage();
+  speed_t speed = baudConstant(baud);
+  if (speed == B0)
+  {
+    fprintf(stderr, "ingestd: unsupported baud rate %ld\n", baud);
+    return (2);
+  }
+  if (numWorkers < 1) numWorkers = 1;
+
+  signal(SIGINT, onStop);
+  signal(SIGTERM, onStop);
+  signal(SIGPIPE, SIG_IGN);
+
+  if (ringName != NULL)
+  {
+    if (!ring.create(ringName))
+    {
+      fprintf(stderr, "ingestd: shared memory %s: %s\n", ringName, strerror(errno));
+      return (1);
+    }
+    sharing = true;
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+  {
+    perror("epoll_create1");
+    return (1);
+  }
+
+  for (int i = 0; i < numWorkers; i++)
+  {
+    worker *w = new worker;
+    w->pending = false;
+    workers.push_back(w);
+  }
+
+  for (int i = optind; i < argc; i++)
+  {
+    //Over aligned for the queue's cache lines
+    void *mem;
+    if (posix_memalign(&mem, SPSC_CACHE_LINE, sizeof(stream)) != 0) return (1);
+    stream *st = new (mem) stream();
+    st->path = argv[i];
+    st->fd = -1;
+    st->opened = false;
+    st->lineLength = 0;
+    ppgDecoderInit(&st->decoder);
+    st->bytes = st->samples = st->parseErrors = st->reopens = st->lastSamples = st->lastProcessed = 0;
+    st->processed = 0;
+    st->beats = 0;
+    st->windows = 0;
+    st->latencySumUs = 0;
+    st->latencyMaxUs = 0;
+    st->heartRate = -1;
+    st->spo2 = -1;
+    st->pipeline.stage<BEAT>().onBeat(onBeat);
+    st->pipeline.stage<SPO2>().onResult(onResult);
+    st->pipeline.begin(SKETCH_SAMPLE_RATE);
+    st->shmStream = 0;
+    if (sharing)
+    {
+      int n = ring.addStream(argv[i]);
+      if (n < 0)
+      {
+        fprintf(stderr, "ingestd: %s: shared memory %s names at most %d devices\n", argv[i], ringName, PPG_SHM_STREAMS);
+        return (1);
+      }
+      st->shmStream = n;
+    }
+    st->worker = streams.size() % numWorkers;
+    workers[st->worker]->streams.push_back(st);
+    streams.push_back(st);
+  }
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < numWorkers; i++) threads.push_back(std::thread(work, workers[i]));
+
+  std::vector<struct epoll_event> events(streams.size());
+  std::vector<bool> notify(numWorkers);
+  uint64_t lastOpen = 0, lastExport = nowUs();
+  char data[4096];
+
+  while (running)
+  {
+    //(Re)open devices that are closed, once a second
+    uint64_t now = nowUs();
+    if (now - lastOpen > 1000000)
+    {
+      lastOpen = now;
+      for (size_t i = 0; i < streams.size(); i++)
+      {
+        stream *st = streams[i];
+        if (st->fd >= 0) continue;
+        st->fd = openSerial(st->path.c_str(), speed);
+        if (st->fd < 0) continue;
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = st;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, st->fd, &ev);
+        st->lineLength = 0;
+        ppgDecoderInit(&st->decoder);
+        if (st->opened) st->reopens++;
+        st->opened = true;
+      }
+    }
+
+    int n = epoll_wait(epfd, &events[0], events.size(), 200);
+    uint64_t rxTime = nowUs();
+    for (int w = 0; w < numWorkers; w++) notify[w] = false;
+    for (int e = 0; e < n; e++)
+    {
+      stream *st = (stream *)events[e].data.ptr;
+      for (;;)
+      {
+        ssize_t got = read(st->fd, data, sizeof(data));
+        if (got > 0)
+        {
+          if (consume(st, data, got, rxTime)) notify[st->worker] = true;
+          continue;
+        }
+        if ((got < 0) && ((errno == EAGAIN) || (errno == EINTR))) break;
+        //End of file or error, the device went away
+        epoll_ctl(epfd, EPOLL_CTL_DEL, st->fd, NULL);
+        close(st->fd);
+        st->fd = -1;
+        break;
+      }
+    }
+    for (int w = 0; w < numWorkers; w++)
+    {
+      if (!notify[w]) continue;
+      {
+        std::lock_guard<std::mutex> guard(workers[w]->lock);
+        workers[w]->pending = true;
+      }
+      workers[w]->wake.notify_one();
+    }
+
+    if (rxTime - lastExport >= interval * 1e6)
+    {
+      exportMetrics(metricsPath, (rxTime - lastExport) / 1e6);
+      lastExport = rxTime;
+    }
+  }
+
+  for (int w = 0; w < numWorkers; w++) workers[w]->wake.notify_one();
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  ring.close(); //readers see the writer gone
+  exportMetrics(metricsPath, (nowUs() - lastExport) / 1e6);
+  return (0);
+}
@@ -0,0 +1,263 @@
+/*
+ MAX30100 on a Linux I2C bus
+
+ Runs the driver and the sketch's pipeline on a Linux board (Raspberry Pi,
+ BeagleBone, ...) with the sensor on /dev/i2c-N, or on the simulated sensor,
+ and prints the same R: lines as MAX30100.ino.
+
+   max30100_read [-d device | -m | -p log] [-w log] [-t seconds] [-a] [-f seconds] [-r] [-q]
+
+   -d device   i2c-dev node, default /dev/i2c-1
+   -m          simulated sensor instead of a bus
+   -p log      replay a transaction log instead of a bus, as fast as possible in
+               the recorded time
+   -w log      record every transaction to a log (MAX30100_Record.h)
+   -t seconds  stop after this long, default run until interrupted
+   -a          switch between the SLOW and FAST profiles on motion like the sketch,
+               the simulated finger then moves from 10 to 15 s of every 30
+   -f seconds  with -m, break the simulated sensor this often, brownouts and frozen
+               sample clocks in turn, for the watchdog to recover from
+   -r          register read back, print what begin() and setup() left in the sensor and exit
+   -q          no R: lines, only the S: statistics at the end
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "MAX30100.h"
+#include "pipeline.h"
+#include "MAX30100_LinuxI2C.h"
+#include "MAX30100_Mock.h"
+#include "MAX30100_Record.h"
+#include "MAX30100_Replay.h"
+#include "acquisitionProfile.h"
+
+typedef MAX30100::sample_t sample_t;
+
+//  Same stages as the sketch
+typedef ppgPipeline<
+  ppgDecimateTo<50>,
+  ppgQuality<MAX30100::Format>,
+  ppgDCRemove,
+  ppgLowPass,
+  ppgBeat,
+  ppgSampleSink,
+  ppgDecimate<2>,
+  ppgSpO2<100, 25, sample_t>
+> Pipeline;
+enum { RATE, QUALITY, DC, LOWPASS, BEAT, PRINT, DECIMATE, SPO2 };
+
+static MAX30100 sensor;
+static Pipeline pipeline;
+static ppgResult lastResult;
+static bool quiet = false;
+static unsigned long printed = 0;
+static volatile sig_atomic_t stop = 0;
+static bool adaptive = false;
+static profileManager_t profile;
+static uint8_t appliedProfile = PROFILE_SLOW;
+
+static void onSignal(int sig)
+{
+  stop = 1;
+}
+
+static void printSample(const ppgFrame &f)
+{
+  printed++;
+  if (adaptive && profileManagerUpdate(&profile, f.quality, f.flags))
+  {
+    //  Between two polls, as the sketch does after draining the FIFO
+    const acquisitionProfile_t &p = acquisitionProfiles[profile.wanted];
+    if (sensor.setAcquisition(p.sampleRate, p.pulseWidth, p.highres)) appliedProfile = profile.wanted;
+  }
+  if (quiet) return;
+  printf("R:%u,%u,H:%ld,B:%d,O:%ld,V:%d,Q:%u\n", (unsigned)f.red, (unsigned)f.ir,
+    (long)lastResult.heartRate, lastResult.validHeartRate, (long)lastResult.spo2, lastResult.validSPO2, f.quality);
+  fflush(stdout);
+}
+
+static void newResult(const ppgResult &result)
+{
+  lastResult = result;
+}
+
+static void restartStages(uint8_t flags)
+{
+  if (flags & MAX30100_FLAG_RATE) profileManagerSwitched(&profile);
+  const acquisitionProfile_t &p = acquisitionProfiles[profile.current];
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - p.bits;
+  if (flags & MAX30100_FLAG_RESTART) pipeline.retune(p.sampleRate);
+  else pipeline.retune<RATE>(p.sampleRate);
+  if (flags & MAX30100_FLAG_RATE) printf("S:rate %u\n", p.sampleRate);
+  if (flags & MAX30100_FLAG_RESTART) printf("S:watchdog restart %u,outage ms %lu\n", sensor.getRestarts(), (unsigned long)sensor.getLastOutage());
+}
+
+//  Log file for the recorder
+class FilePrint : public Print {
+ public:
+  FILE *file;
+  FilePrint(FILE *f) : file(f) {}
+  size_t write(uint8_t c) { return (fputc(c, file) == EOF ? 0 : 1); }
+  size_t write(const uint8_t *buffer, size_t size) { return (fwrite(buffer, 1, size, file)); }
+};
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-d device | -m | -p log] [-w log] [-t seconds] [-a] [-f seconds] [-r] [-q]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *device = "/dev/i2c-1";
+  const char *replayPath = NULL, *recordPath = NULL;
+  bool mock = false, registers = false;
+  double seconds = 0.0, faultSeconds = 0.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:mp:w:t:af:rq")) != -1)
+  {
+    switch (opt)
+    {
+      case 'd': device = optarg; break;
+      case 'm': mock = true; break;
+      case 'p': replayPath = optarg; break;
+      case 'w': recordPath = optarg; break;
+      case 't': seconds = atof(optarg); break;
+      case 'a': adaptive = true; break;
+      case 'f': faultSeconds = atof(optarg); break;
+      case 'r': registers = true; break;
+      case 'q': quiet = true; break;
+      default: usage(argv[0]);
+    }
+  }
+
+  MAX30100_LinuxI2C bus;
+  MAX30100_Mock simulated;
+  MAX30100_Replay replay;
+  MAX30100_Transport *transport = &simulated;
+  if (replayPath != NULL)
+  {
+    if (!replay.open(replayPath))
+    {
+      fprintf(stderr, "%s: not a transaction log\n", replayPath);
+      return (1);
+    }
+    transport = &replay;
+    sensor.setClock(replay);
+  }
+  else if (!mock)
+  {
+    if (!bus.open(device))
+    {
+      fprintf(stderr, "%s: %s\n", device, strerror(errno));
+      return (1);
+    }
+    if (bus.isSMBus()) fprintf(stderr, "%s: no plain I2C, SMBus block reads of %u bytes\n", device, bus.maxBurst());
+    transport = &bus;
+  }
+
+  FILE *logFile = NULL;
+  FilePrint logPrint(NULL);
+  MAX30100_RecordTransport *recorder = NULL;
+  if (recordPath != NULL)
+  {
+    logFile = fopen(recordPath, "wb");
+    if (logFile == NULL)
+    {
+      fprintf(stderr, "%s: %s\n", recordPath, strerror(errno));
+      return (1);
+    }
+    logPrint.file = logFile;
+    recorder = new MAX30100_RecordTransport(*transport, logPrint);
+    recorder->begin();
+    transport = recorder;
+    sensor.setClock(*recorder); //the time the replay will give
+  }
+
+  if (!sensor.begin(*transport))
+  {
+    fprintf(stderr, "MAX30100 was not found, I2C status %u\n", sensor.getLastError());
+    return (1);
+  }
+
+  //  Sketch's SLOW settings, 1600us pulse width for the full 16 bit
+  const acquisitionProfile_t &slow = acquisitionProfiles[PROFILE_SLOW];
+  sensor.setup(0x07, MAX30100_MODE_SPO2, slow.sampleRate, slow.pulseWidth, slow.highres);
+  sensor.enableAutoGain();
+  sensor.enableWatchdog();
+
+  if (registers)
+  {
+    static const uint8_t regs[] = { MAX30100_INTENABLE, MAX30100_MODECONFIG, MAX30100_SPO2CONFIG, MAX30100_LEDCONFIG,
+      MAX30100_REVISIONID, MAX30100_PARTID };
+    for (unsigned i = 0; i < sizeof(regs); i++) printf("0x%02X: 0x%02X\n", regs[i], sensor.readRegister8(MAX30100_ADDRESS, regs[i]));
+    return (sensor.getErrorCount() ? 1 : 0);
+  }
+
+  pipeline.stage<PRINT>().onSample(printSample);
+  pipeline.stage<SPO2>().onResult(newResult);
+  pipeline.onRetune(MAX30100_FLAG_RATE | MAX30100_FLAG_RESTART, restartStages);
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - slow.bits;
+  pipeline.begin(slow.sampleRate);
+  profileManagerInit(&profile, PROFILE_SLOW, 50);
+  lastResult = pipeline.stage<SPO2>().result;
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  unsigned long start = millis();
+  if (replayPath != NULL)
+  {
+    //  Everything check() saw, without the waits
+    unsigned long startUs = micros();
+    while (!stop && !replay.done()) pipeline.poll(sensor);
+    double elapsed = (micros() - startUs) / 1e6;
+    fprintf(stderr, "replay: %u transactions, %.1f s recorded, replayed in %.3f s, %.0fx real time, %u divergences\n",
+      replay.transactions, replay.timeUs / 1e6, elapsed, elapsed > 0 ? replay.timeUs / 1e6 / elapsed : 0.0, replay.divergences);
+  }
+  float wander = simulated.ppg.wander;
+  unsigned long lastFault = start;
+  unsigned faults = 0;
+  while (!stop && (replayPath == NULL) && (seconds <= 0.0 || millis() - start < seconds * 1000.0))
+  {
+    if (adaptive && mock)
+    {
+      unsigned long t = (millis() - start) % 30000;
+      simulated.ppg.wander = (t >= 10000 && t < 15000) ? 40.0f : wander; //baseline swings of 40 pulses, gross movement
+    }
+    if (mock && faultSeconds > 0.0 && millis() - lastFault >= faultSeconds * 1000.0)
+    {
+      lastFault = millis();
+      if (faults++ % 2 == 0) simulated.reset(); //brownout, power on defaults
+      else simulated.frozen = true;             //sample clock stopped, settings intact
+    }
+    pipeline.poll(sensor);
+    delay(appliedProfile == PROFILE_FAST ? 5 : 20); //a FIFO of 16 samples lasts 320 ms at 50 samples/s, 16 ms at 1000
+  }
+
+  if (recorder != NULL)
+  {
+    fprintf(stderr, "record: %u transactions, %u bytes\n", recorder->records, recorder->bytes);
+    fclose(logFile);
+  }
+  fprintf(stderr, "S:samples %lu,overflows %u,i2c errors %u,faults %u,restarts %u\n", printed, sensor.getFIFOOverflows(),
+    sensor.getErrorCount(), faults, sensor.getRestarts());
+  if (replayPath != NULL)
+  {
+    //  Past the end of the log the driver's timed waits must still run out, on a clock
+    //  that stopped with the log they would spin here for good
+    unsigned long endMs = replay.millis();
+    sensor.safeCheck(10);
+    sensor.softReset();
+    if (replay.millis() - endMs < 110)
+    {
+      fprintf(stderr, "replay: clock stopped at the end of the log\n");
+      return (1);
+    }
+  }
+  return ((replayPath != NULL && replay.divergences) ? 1 : 0);
+}
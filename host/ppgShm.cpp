@@ -0,0 +1,233 @@
+/*
+ Shared Memory Sample Ring
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ppgShm.h"
+
+static_assert(sizeof(ppgShmRecord) == 32, "records are packed two to a cache line");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the sequence numbers are shared between processes");
+
+//  Payload only, the sequence number belongs to the slot
+ppgShmRecord &ppgShmRecord::operator=(const ppgShmRecord &r)
+{
+  memcpy((char *)this + sizeof(seq), (const char *)&r + sizeof(seq), sizeof(ppgShmRecord) - sizeof(seq));
+  return (*this);
+}
+
+static size_t ringSize(uint32_t capacity)
+{
+  return (sizeof(ppgShmHeader) + (size_t)capacity * sizeof(ppgShmRecord));
+}
+
+//
+// Writer
+//
+
+ppgShmWriter::ppgShmWriter(void) : _header(NULL), _ring(NULL), _size(0)
+{
+  _name[0] = '\0';
+}
+
+ppgShmWriter::~ppgShmWriter(void)
+{
+  close();
+}
+
+bool ppgShmWriter::create(const char *name, uint32_t capacity)
+{
+  close();
+  uint32_t n = 2;
+  while (n < capacity) n <<= 1;
+  strncpy(_name, name, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = '\0';
+
+  //  A new ring rather than the old one resized, readers of the old one notice it closed
+  shm_unlink(_name);
+  int fd = shm_open(_name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+  if (fd < 0) return (false);
+  _size = ringSize(n);
+  if (ftruncate(fd, _size) != 0)
+  {
+    ::close(fd);
+    shm_unlink(_name);
+    return (false);
+  }
+  void *mem = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED)
+  {
+    shm_unlink(_name);
+    return (false);
+  }
+
+  //  ftruncate() zeroed it, which is a valid state for the atomics
+  _header = (ppgShmHeader *)mem;
+  _ring = (ppgShmRecord *)(_header + 1);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  _header->version = PPG_SHM_VERSION;
+  _header->capacity = n;
+  _header->recordSize = sizeof(ppgShmRecord);
+  _header->epoch = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  _header->pid = getpid();
+  _header->magic.store(PPG_SHM_MAGIC, std::memory_order_release);
+  return (true);
+}
+
+int ppgShmWriter::addStream(const char *name)
+{
+  uint16_t n = _header->streams.load(std::memory_order_relaxed);
+  if (n >= PPG_SHM_STREAMS) return (-1);
+  strncpy(_header->names[n], name, PPG_SHM_NAME - 1);
+  _header->streams.store(n + 1, std::memory_order_release);
+  return (n);
+}
+
+void ppgShmWriter::publish(const ppgShmRecord &r)
+{
+  uint64_t n = _header->head.load(std::memory_order_relaxed);
+  ppgShmRecord *slot = &_ring[n & (_header->capacity - 1)];
+  //  Odd while the payload changes, readers copying the slot now discard their copy
+  slot->seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  *slot = r;
+  slot->seq.store(2 * n + 2, std::memory_order_release);
+  _header->head.store(n + 1, std::memory_order_release);
+}
+
+void ppgShmWriter::close(void)
+{
+  if (_header == NULL) return;
+  _header->closed.store(1, std::memory_order_release);
+  munmap(_header, _size);
+  shm_unlink(_name);
+  _header = NULL;
+  _ring = NULL;
+}
+
+//
+// Reader
+//
+
+ppgShmReader::ppgShmReader(void)
+  : cursor(0), received(0), overruns(0), restarts(0), _header(NULL), _ring(NULL), _size(0), _epoch(0)
+{
+  _name[0] = '\0';
+}
+
+ppgShmReader::~ppgShmReader(void)
+{
+  unmap();
+}
+
+void ppgShmReader::unmap(void)
+{
+  if (_header != NULL) munmap(_header, _size);
+  _header = NULL;
+  _ring = NULL;
+}
+
+//  Map whatever ring has the name now, false if there is none or it is not ready
+bool ppgShmReader::map(void)
+{
+  int fd = shm_open(_name, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0) return (false);
+  struct stat st;
+  if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(ppgShmHeader)))
+  {
+    ::close(fd);
+    return (false);
+  }
+  void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (mem == MAP_FAILED) return (false);
+  ppgShmHeader *header = (ppgShmHeader *)mem;
+  if ((header->magic.load(std::memory_order_acquire) != PPG_SHM_MAGIC) || (header->version != PPG_SHM_VERSION) ||
+      (header->recordSize != sizeof(ppgShmRecord)) || (ringSize(header->capacity) > (size_t)st.st_size))
+  {
+    munmap(mem, st.st_size);
+    return (false);
+  }
+  unmap();
+  _header = header;
+  _ring = (ppgShmRecord *)(_header + 1);
+  _size = st.st_size;
+  return (true);
+}
+
+bool ppgShmReader::open(const char *name, bool oldest)
+{
+  strncpy(_name, name, sizeof(_name) - 1);
+  _name[sizeof(_name) - 1] = '\0';
+  if (!map()) return (false);
+  _epoch = _header->epoch;
+  uint64_t head = _header->head.load(std::memory_order_acquire);
+  cursor = head;
+  if (oldest) cursor = (head > _header->capacity) ? head - _header->capacity : 0;
+  received = overruns = 0;
+  restarts = 0;
+  return (true);
+}
+
+bool ppgShmReader::writerGone(void) const
+{
+  if (_header == NULL) return (true);
+  if (_header->closed.load(std::memory_order_acquire)) return (true);
+  return ((kill(_header->pid, 0) != 0) && (errno == ESRCH));
+}
+
+const char *ppgShmReader::streamName(uint16_t stream) const
+{
+  if ((_header == NULL) || (stream >= _header->streams.load(std::memory_order_acquire))) return ("?");
+  return (_header->names[stream]);
+}
+
+bool ppgShmReader::next(ppgShmRecord &r)
+{
+  if (_header == NULL) return (false);
+  for (;;)
+  {
+    uint64_t head = _header->head.load(std::memory_order_acquire);
+    if (cursor >= head)
+    {
+      //  Caught up. A writer that went away may have been replaced by a new ring.
+      if (!writerGone() || !map() || (_header->epoch == _epoch)) return (false);
+      _epoch = _header->epoch;
+      cursor = 0;
+      restarts++;
+      continue;
+    }
+    uint32_t capacity = _header->capacity;
+    if (head - cursor > capacity)
+    {
+      overruns += head - capacity - cursor;
+      cursor = head - capacity;
+    }
+    const ppgShmRecord *slot = &_ring[cursor & (capacity - 1)];
+    uint64_t seq = slot->seq.load(std::memory_order_acquire);
+    if (seq == 2 * cursor + 2)
+    {
+      r = *slot;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot->seq.load(std::memory_order_relaxed) == seq)
+      {
+        r.seq.store(cursor, std::memory_order_relaxed);
+        cursor++;
+        received++;
+        return (true);
+      }
+    }
+    //  The writer is already reusing the slot
+    overruns++;
+    cursor++;
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ Shared Memory Sample Ring
+
+ Fans the decoded streams of ingestd out to any number of local processes.
+ One writer puts samples, beats and SpO2 results as fixed size records into
+ a POSIX shared memory ring (/dev/shm/<name>); readers map it read only and
+ each keeps its own cursor, so a reader neither slows the writer nor the
+ other readers and nothing is copied through pipes or sockets.
+
+   ppgShmWriter ring;                       ppgShmReader tap;
+   ring.create("/ppg", 65536);              tap.open("/ppg");
+   int s = ring.addStream("ttyACM0");       ppgShmRecord r;
+   ring.publish(record);                    while (tap.next(r)) use(r);
+
+ The writer never waits. A reader that falls more than the ring size behind
+ is overrun: next() skips to the oldest record still in the ring and counts
+ the records lost in overruns. Every record carries its sequence number,
+ written odd before and even after the payload, a reader copying a slot the
+ writer is overwriting sees the number change and discards the copy.
+
+ Times are CLOCK_MONOTONIC microseconds, the same in every process.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#define PPG_SHM_MAGIC      0x53475050  // "PPGS"
+#define PPG_SHM_VERSION    1
+#define PPG_SHM_STREAMS    64          // streams a ring can name
+#define PPG_SHM_NAME       64          // bytes of a stream name with its terminator
+#define PPG_SHM_RECORDS    65536       // default ring size, 2 MB
+
+// Record types
+#define PPG_SHM_SAMPLE     1
+#define PPG_SHM_BEAT       2
+#define PPG_SHM_RESULT     3
+
+struct ppgShmRecord {
+  std::atomic<uint64_t> seq;  // 2 n + 1 while record n is written, 2 n + 2 once complete, n in a copy from next()
+  uint64_t timeUs;            // when the sample was read, CLOCK_MONOTONIC
+  uint32_t index;             // sample number within the stream
+  uint16_t stream;            // addStream() number
+  uint8_t  type;              // PPG_SHM_
+  uint8_t  flags;             // sample flags from the sensor
+  union {
+    struct { uint32_t red, ir; } sample;
+    struct { uint16_t bpm, bpmAverage; int16_t offset; } beat;  // 0.1 bpm, offset 1/256 sample
+    struct { int16_t heartRate, spo2; int8_t validHeartRate, validSPO2; uint8_t quality, confidence; } result;
+  };
+
+  // All zero past seq, padding and the union bytes a beat or result leaves unused go out
+  // into the segment, they must not carry the writer's stack
+  ppgShmRecord() : seq(0) { memset((char *)this + sizeof(seq), 0, sizeof(ppgShmRecord) - sizeof(seq)); }
+  ppgShmRecord(const ppgShmRecord &r) : seq(0) { *this = r; }
+  ppgShmRecord &operator=(const ppgShmRecord &r);
+};
+
+struct ppgShmHeader {
+  std::atomic<uint32_t> magic;     // set last, once the ring is ready
+  uint32_t version;
+  uint32_t capacity;               // records, a power of two
+  uint32_t recordSize;
+  uint64_t epoch;                  // start of the writer, a new writer means a new ring
+  int32_t  pid;                    // of the writer
+  std::atomic<uint32_t> closed;    // the writer shut down
+  std::atomic<uint16_t> streams;   // names in use
+  char     names[PPG_SHM_STREAMS][PPG_SHM_NAME];
+  alignas(64) std::atomic<uint64_t> head;  // records written
+};
+
+class ppgShmWriter {
+ public:
+  ppgShmWriter(void);
+  ~ppgShmWriter(void);
+
+  // Creates or replaces the ring, capacity is rounded up to a power of two
+  bool create(const char *name, uint32_t capacity = PPG_SHM_RECORDS);
+  // Names the next stream, returns its number for the records or -1 if the ring already
+  // names PPG_SHM_STREAMS
+  int addStream(const char *name);
+  // Stores the record with the next sequence number, one thread at a time
+  void publish(const ppgShmRecord &r);
+  // Tells the readers no more records come and removes the name
+  void close(void);
+
+ private:
+  char _name[PPG_SHM_NAME];
+  ppgShmHeader *_header;
+  ppgShmRecord *_ring;
+  size_t _size;
+};
+
+class ppgShmReader {
+ public:
+  ppgShmReader(void);
+  ~ppgShmReader(void);
+
+  // Maps the ring, reading starts with the next record written or the oldest one still there
+  bool open(const char *name, bool oldest = false);
+  // Copies the next record, false when the reader is caught up
+  bool next(ppgShmRecord &r);
+  // Name given to a stream by the writer
+  const char *streamName(uint16_t stream) const;
+  // The writer closed the ring or exited
+  bool writerGone(void) const;
+
+  uint64_t cursor;    // sequence number of the next record
+  uint64_t received;  // records returned
+  uint64_t overruns;  // records lost because the writer lapped the reader
+  uint32_t restarts;  // times a new writer replaced the ring
+
+ private:
+  ppgShmHeader *_header;
+  ppgShmRecord *_ring;
+  size_t _size;
+  uint64_t _epoch;
+  char _name[PPG_SHM_NAME];
+  bool map(void);
+  void unmap(void);
+};
@@ -0,0 +1,167 @@
+/*
+ Compressed sample stream decoder
+
+ Turns the output of MAX30100.ino with STREAM_COMPRESSED back into R: lines
+ for tools that read the text format. Text lines in the stream are passed
+ through.
+
+   ppg_decode [file]            decode file or stdin to stdout
+   ppg_decode -t [rate] [seconds]  self test on a synthetic recording
+
+ The self test encodes a recording as the sketch would at the given rate,
+ checks that it decodes to the same samples, also with bytes corrupted in
+ transit, and compares the size to the text lines.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "ppgCodec.h"
+#include "synthPPG.h"
+
+struct decodeStats {
+  unsigned long bytes;
+  unsigned long samples;
+};
+
+//  Decode one stream, samples go to out as R: lines and text is copied
+static void decode(FILE *in, FILE *out, ppgDecoder_t *d, decodeStats *stats)
+{
+  int c;
+  while ((c = fgetc(in)) != EOF)
+  {
+    stats->bytes++;
+    uint8_t decoded = ppgDecode(d, (uint8_t)c);
+    if (decoded == PPG_DECODE_TEXT)
+    {
+      if (c != '\r') fputc(c, out);
+    }
+    else if (decoded == PPG_DECODE_BLOCK)
+    {
+      for (uint8_t i = 0; i < d->count; i++) fprintf(out, "R:%u,%u\n", (unsigned)d->redOut[i], (unsigned)d->irOut[i]);
+      stats->samples += d->count;
+    }
+  }
+}
+
+//  Encode a recording at 13 bit, the resolution of the sketch's FAST setting
+static int selfTest(float rate, float seconds)
+{
+  synthPPG ppg(rate, 72.0f, 1);
+  ppg.noise = 0.1f;
+  ppg.wander = 0.3f;
+  //  200us pulse width, 13 bit
+  ppg.dcIR /= 8;
+  ppg.acIR /= 8;
+  ppg.dcRed /= 8;
+  ppg.acRed /= 8;
+  ppg.fullScale = 8191;
+
+  ppgEncoder_t e;
+  ppgEncoderInit(&e);
+  std::vector<uint8_t> stream;
+  std::vector<uint32_t> red, ir;
+  unsigned long textBytes = 0, shortTextBytes = 0;
+  int n = (int)(rate * seconds);
+  for (int i = 0; i < n; i++)
+  {
+    uint32_t r, x;
+    ppg.next(&r, &x);
+    red.push_back(r);
+    ir.push_back(x);
+    char line[96];
+    textBytes += snprintf(line, sizeof(line), "R:%u,%u,H:72,B:1,O:98,V:1,Q:0\r\n", (unsigned)r, (unsigned)x);
+    shortTextBytes += snprintf(line, sizeof(line), "R:%u,%u\n", (unsigned)r, (unsigned)x);
+    uint8_t length = ppgEncode(&e, r, x);
+    stream.insert(stream.end(), e.block, e.block + length);
+  }
+  uint8_t length = ppgEncodeFlush(&e);
+  stream.insert(stream.end(), e.block, e.block + length);
+
+  //  Clean channel, every sample comes back
+  ppgDecoder_t d;
+  ppgDecoderInit(&d);
+  size_t k = 0;
+  bool exact = true;
+  for (size_t i = 0; i < stream.size(); i++)
+  {
+    if (ppgDecode(&d, stream[i]) != PPG_DECODE_BLOCK) continue;
+    for (uint8_t j = 0; j < d.count; j++, k++) exact = exact && (k < red.size()) && (d.redOut[j] == red[k]) && (d.irOut[j] == ir[k]);
+  }
+  exact = exact && (k == red.size()) && (d.dropped == 0);
+
+  //  Noisy channel, a byte in 2000 flipped; nothing decoded may be wrong
+  //  Flips keep the byte positions, a block decoded from the noisy stream must end
+  //  where one ends in the clean stream and hold its samples
+  std::vector<long> firstAt(stream.size(), -1);
+  for (size_t pos = 0, first = 0; pos < stream.size(); )
+  {
+    size_t end = pos + PPG_CODEC_HEADER + stream[pos + 4];
+    firstAt[end] = first;
+    first += stream[pos + 2] & 0x1F;
+    pos = end + 1;
+  }
+  std::vector<uint8_t> noisy(stream);
+  srand(7);
+  int flipped = 0;
+  for (size_t i = 0; i < noisy.size(); i++)
+  {
+    if (rand() % 2000 == 0)
+    {
+      noisy[i] ^= 1 << (rand() % 8);
+      flipped++;
+    }
+  }
+  ppgDecoderInit(&d);
+  unsigned long recovered = 0, wrong = 0;
+  for (size_t i = 0; i < noisy.size(); i++)
+  {
+    if (ppgDecode(&d, noisy[i]) != PPG_DECODE_BLOCK) continue;
+    long first = firstAt[i];
+    for (uint8_t j = 0; j < d.count; j++)
+    {
+      if ((first < 0) || (d.redOut[j] != red[first + j]) || (d.irOut[j] != ir[first + j])) wrong++;
+    }
+    recovered += d.count;
+  }
+
+  printf("%.0f samples/s, %d samples\n", rate, n);
+  printf("text R: lines      %6.2f bytes/sample\n", (double)textBytes / n);
+  printf("text R:red,ir      %6.2f bytes/sample\n", (double)shortTextBytes / n);
+  printf("compressed         %6.2f bytes/sample, %.1fx smaller than the R: lines, %.1fx than R:red,ir\n",
+    (double)stream.size() / n, (double)textBytes / stream.size(), (double)shortTextBytes / stream.size());
+  printf("round trip         %s\n", exact ? "exact" : "FAILED");
+  printf("%d bytes corrupted  %lu of %d samples recovered, %lu blocks dropped, %lu wrong\n",
+    flipped, recovered, n, (unsigned long)d.dropped, wrong);
+  return ((exact && wrong == 0) ? 0 : 1);
+}
+
+int main(int argc, char **argv)
+{
+  if ((argc > 1) && (strcmp(argv[1], "-t") == 0))
+  {
+    float rate = (argc > 2) ? atof(argv[2]) : 1000.0f;
+    float seconds = (argc > 3) ? atof(argv[3]) : 60.0f;
+    return (selfTest(rate, seconds));
+  }
+
+  FILE *in = stdin;
+  if (argc > 1)
+  {
+    in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+      perror(argv[1]);
+      return (1);
+    }
+  }
+  ppgDecoder_t d;
+  ppgDecoderInit(&d);
+  decodeStats stats = { 0, 0 };
+  decode(in, stdout, &d, &stats);
+  fprintf(stderr, "%lu bytes, %lu samples, %lu blocks, %lu dropped\n", stats.bytes, stats.samples,
+    (unsigned long)d.blocks, (unsigned long)d.dropped);
+  return (0);
+}
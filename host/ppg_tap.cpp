@@ -0,0 +1,124 @@
+/*
+ Reader of the shared memory ring of ingestd
+
+ Follows the samples, beats and results ingestd publishes with -s, as one of
+ any number of readers, and prints them or writes the samples as CSV for a
+ recorder. Overruns are reported, the reader never holds up the writer.
+
+   ppg_tap [-n name] [-d device] [-o] [-c] [-f] [-t seconds]
+
+   -n name     ring, default /ppg
+   -d device   only the stream of this device, as given to ingestd
+   -o          start with the oldest record still in the ring instead of the next one
+   -c          CSV of the samples: time_us,device,index,red,ir,flags
+   -f          keep waiting for a new writer when ingestd exits
+   -t seconds  stop after this long
+
+ Output without -c, one line per record:
+   <device> R:<red>,<ir>,F:<flags>
+   <device> P:<bpm>,A:<average bpm>             beat, 0.1 bpm
+   <device> H:<bpm>,B:<valid>,O:<spo2>,V:<valid>,Q:<quality>,C:<confidence>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ppgShm.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int sig)
+{
+  stop = 1;
+}
+
+static double seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: ppg_tap [-n name] [-d device] [-o] [-c] [-f] [-t seconds]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *name = "/ppg";
+  const char *device = NULL;
+  bool oldest = false, csv = false, follow = false;
+  double duration = 0.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:ocft:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': name = optarg; break;
+      case 'd': device = optarg; break;
+      case 'o': oldest = true; break;
+      case 'c': csv = true; break;
+      case 'f': follow = true; break;
+      case 't': duration = atof(optarg); break;
+      default: usage();
+    }
+  }
+
+  ppgShmReader tap;
+  double start = seconds();
+  while (!tap.open(name, oldest))
+  {
+    if (!follow || stop)
+    {
+      fprintf(stderr, "%s: no ring, is ingestd running with -s?\n", name);
+      return (1);
+    }
+    sleep(1);
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  if (csv) printf("time_us,device,index,red,ir,flags\n");
+  ppgShmRecord r;
+  while (!stop && ((duration <= 0.0) || (seconds() - start < duration)))
+  {
+    if (!tap.next(r))
+    {
+      if (!follow && tap.writerGone()) break;
+      fflush(stdout);
+      usleep(10000); //ingestd publishes in bursts as the serial data comes in
+      continue;
+    }
+    const char *stream = tap.streamName(r.stream);
+    if ((device != NULL) && (strcmp(stream, device) != 0)) continue;
+    if (csv)
+    {
+      if (r.type == PPG_SHM_SAMPLE)
+        printf("%llu,%s,%u,%u,%u,%u\n", (unsigned long long)r.timeUs, stream, r.index, r.sample.red, r.sample.ir, r.flags);
+      continue;
+    }
+    switch (r.type)
+    {
+      case PPG_SHM_SAMPLE:
+        printf("%s R:%u,%u,F:%u\n", stream, r.sample.red, r.sample.ir, r.flags);
+        break;
+      case PPG_SHM_BEAT:
+        printf("%s P:%u,A:%u\n", stream, r.beat.bpm, r.beat.bpmAverage);
+        break;
+      case PPG_SHM_RESULT:
+        printf("%s H:%d,B:%d,O:%d,V:%d,Q:%u,C:%u\n", stream, r.result.heartRate, r.result.validHeartRate,
+          r.result.spo2, r.result.validSPO2, r.result.quality, r.result.confidence);
+        break;
+    }
+  }
+  fflush(stdout);
+  fprintf(stderr, "S:records %llu,overruns %llu,restarts %u\n", (unsigned long long)tap.received,
+    (unsigned long long)tap.overruns, tap.restarts);
+  return (0);
+}
@@ -0,0 +1,89 @@
+/*
+ Pseudo-terminal feeder
+
+ Stands in for boards running MAX30100.ino: opens N pseudo-terminals and
+ writes synthetic sketch output to each at 50 samples/s, every stream at
+ its own heart rate. The device paths are printed to stdout, one per line.
+
+   pty_feed [-c] [streams] [seconds]
+
+   -c  compressed blocks (ppgCodec.h) and H: lines, as with STREAM_COMPRESSED
+
+   ./pty_feed 32 60 > ports & sleep 1; ./ingestd -q -i 5 $(cat ports)
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "synthPPG.h"
+#include "ppgCodec.h"
+
+static const int SAMPLE_RATE = 50;
+
+int main(int argc, char **argv)
+{
+  bool compressed = (argc > 1) && (strcmp(argv[1], "-c") == 0);
+  if (compressed)
+  {
+    argc--;
+    argv++;
+  }
+  int count = (argc > 1) ? atoi(argv[1]) : 4;
+  int seconds = (argc > 2) ? atoi(argv[2]) : 60;
+
+  std::vector<int> masters;
+  std::vector<synthPPG> signals;
+  std::vector<ppgEncoder_t> encoders(count);
+  for (int i = 0; i < count; i++)
+  {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((master < 0) || (grantpt(master) != 0) || (unlockpt(master) != 0))
+    {
+      perror("posix_openpt");
+      return (1);
+    }
+    //Keep the terminal side open and raw, so it neither hangs up nor echoes
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    masters.push_back(master);
+    signals.push_back(synthPPG(SAMPLE_RATE, 55.0f + 3.0f * (i % 30), i + 1));
+    signals.back().noise = 0.1f;
+    ppgEncoderInit(&encoders[i]);
+    printf("%s\n", ptsname(master));
+  }
+  fflush(stdout);
+
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  for (long n = 0; n < (long)seconds * SAMPLE_RATE; n++)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      uint32_t red, ir;
+      signals[i].next(&red, &ir);
+      if (compressed)
+      {
+        int len = ppgEncode(&encoders[i], red, ir);
+        if (len > 0 && write(masters[i], encoders[i].block, len) < 0) { } //nobody reading, drop
+        if (n % SAMPLE_RATE == 0 && write(masters[i], "H:0,B:0,O:0,V:0,Q:0\r\n", 21) < 0) { }
+        continue;
+      }
+      char line[96];
+      int len = snprintf(line, sizeof(line), "R:%u,%u,H:0,B:0,O:0,V:0,Q:0\r\n", (unsigned)red, (unsigned)ir);
+      if (write(masters[i], line, len) < 0) { } //nobody reading, drop
+    }
+    next += std::chrono::microseconds(1000000 / SAMPLE_RATE);
+    std::this_thread::sleep_until(next);
+  }
+  return (0);
+}
@@ -0,0 +1,204 @@
+/*
+ Long sessions on the simulated sensor in virtual time
+
+ Runs the driver and the sketch's pipeline against MAX30100_Mock with a
+ MAX30100_VirtualClock, so the driver's waits, timeouts and watchdog and the
+ polling loop's delay() move simulated time on at once instead of sleeping.
+ Samples come due with that time and are made at the next FIFO read. An
+ 8 hour session finishes in seconds, with the faults and overflows it should
+ survive injected along the way.
+
+   soak [-h hours] [-i ms] [-f seconds] [-s seconds] [-a] [-b bpm]
+
+   -h hours    simulated session length, default 8
+   -i ms       polling interval, default 20, 5 at the FAST profile
+   -f seconds  break the sensor this often, brownouts and frozen sample
+               clocks in turn, for the watchdog to recover from
+   -s seconds  hold the polling loop up for 1 s this often, the FIFO overflows
+   -a          switch between the SLOW and FAST profiles on motion, the
+               simulated finger moves from 10 to 15 s of every 30
+   -b bpm      simulated heart rate, default 72
+
+ Prints an S:hour line every simulated hour and a summary at the end. Exits
+ with 1 if a fault was not recovered from or a transaction failed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "MAX30100.h"
+#include "pipeline.h"
+#include "MAX30100_Mock.h"
+#include "acquisitionProfile.h"
+
+typedef MAX30100::sample_t sample_t;
+
+//  Same stages as the sketch
+typedef ppgPipeline<
+  ppgDecimateTo<50>,
+  ppgQuality<MAX30100::Format>,
+  ppgDCRemove,
+  ppgLowPass,
+  ppgBeat,
+  ppgSampleSink,
+  ppgDecimate<2>,
+  ppgSpO2<100, 25, sample_t>
+> Pipeline;
+enum { RATE, QUALITY, DC, LOWPASS, BEAT, PRINT, DECIMATE, SPO2 };
+
+static MAX30100 sensor;
+static Pipeline pipeline;
+static bool adaptive = false;
+static profileManager_t profile;
+static uint8_t appliedProfile = PROFILE_SLOW;
+
+//  What the session produced
+struct soakStats {
+  unsigned long frames;
+  unsigned long results, validHR, validSPO2;
+  double sumHR, sumSPO2;
+  unsigned long switches;
+  uint32_t longestOutage;
+};
+static soakStats stats;
+
+static void countFrame(const ppgFrame &f)
+{
+  stats.frames++;
+  if (adaptive && profileManagerUpdate(&profile, f.quality, f.flags))
+  {
+    const acquisitionProfile_t &p = acquisitionProfiles[profile.wanted];
+    if (sensor.setAcquisition(p.sampleRate, p.pulseWidth, p.highres)) appliedProfile = profile.wanted;
+  }
+}
+
+static void newResult(const ppgResult &result)
+{
+  if (result.confidence < 100) return; //provisional
+  stats.results++;
+  if (result.validHeartRate)
+  {
+    stats.validHR++;
+    stats.sumHR += result.heartRate;
+  }
+  if (result.validSPO2)
+  {
+    stats.validSPO2++;
+    stats.sumSPO2 += result.spo2;
+  }
+}
+
+static void restartStages(uint8_t flags)
+{
+  if (flags & MAX30100_FLAG_RATE)
+  {
+    profileManagerSwitched(&profile);
+    stats.switches++;
+  }
+  const acquisitionProfile_t &p = acquisitionProfiles[profile.current];
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - p.bits;
+  if (flags & MAX30100_FLAG_RESTART) pipeline.retune(p.sampleRate);
+  else pipeline.retune<RATE>(p.sampleRate);
+  if ((flags & MAX30100_FLAG_RESTART) && sensor.getLastOutage() > stats.longestOutage) stats.longestOutage = sensor.getLastOutage();
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-h hours] [-i ms] [-f seconds] [-s seconds] [-a] [-b bpm]\n", name);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  double hours = 8.0, faultSeconds = 0.0, stallSeconds = 0.0;
+  unsigned long interval = 20;
+  float bpm = 72.0f;
+  int opt;
+  while ((opt = getopt(argc, argv, "h:i:f:s:ab:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'h': hours = atof(optarg); break;
+      case 'i': interval = strtoul(optarg, NULL, 10); break;
+      case 'f': faultSeconds = atof(optarg); break;
+      case 's': stallSeconds = atof(optarg); break;
+      case 'a': adaptive = true; break;
+      case 'b': bpm = atof(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (hours <= 0.0 || interval == 0) usage(argv[0]);
+
+  MAX30100_Mock simulated(bpm);
+  MAX30100_VirtualClock clock(simulated);
+  sensor.setClock(clock);
+  if (!sensor.begin(simulated))
+  {
+    fprintf(stderr, "MAX30100 was not found, I2C status %u\n", sensor.getLastError());
+    return (1);
+  }
+
+  //  Sketch's settings
+  const acquisitionProfile_t &slow = acquisitionProfiles[PROFILE_SLOW];
+  sensor.setup(0x07, MAX30100_MODE_SPO2, slow.sampleRate, slow.pulseWidth, slow.highres);
+  sensor.enableAutoGain();
+  sensor.enableWatchdog();
+
+  pipeline.stage<PRINT>().onSample(countFrame);
+  pipeline.stage<SPO2>().onResult(newResult);
+  pipeline.onRetune(MAX30100_FLAG_RATE | MAX30100_FLAG_RESTART, restartStages);
+  pipeline.stage<RATE>().shift = MAX30100::Format::BITS - slow.bits;
+  pipeline.begin(slow.sampleRate);
+  profileManagerInit(&profile, PROFILE_SLOW, 50);
+
+  unsigned long startUs = micros(); //real time
+  unsigned long start = clock.millis();
+  unsigned long end = start + (unsigned long)(hours * 3600000.0);
+  unsigned long lastFault = start, lastStall = start, nextHour = start + 3600000UL;
+  unsigned long samples = 0;
+  unsigned faults = 0, stalls = 0;
+  float wander = simulated.ppg.wander;
+  while (clock.millis() < end)
+  {
+    unsigned long now = clock.millis();
+    if (adaptive)
+    {
+      unsigned long t = (now - start) % 30000;
+      simulated.ppg.wander = (t >= 10000 && t < 15000) ? 40.0f : wander;
+    }
+    if (faultSeconds > 0.0 && now - lastFault >= faultSeconds * 1000.0 && end - now > 2000) //time to recover left
+    {
+      lastFault = now;
+      if (faults++ % 2 == 0) simulated.reset(); //brownout, power on defaults
+      else simulated.frozen = true;             //sample clock stopped, settings intact
+    }
+    if (stallSeconds > 0.0 && now - lastStall >= stallSeconds * 1000.0)
+    {
+      lastStall = now;
+      stalls++;
+      clock.delay(1000); //a blocked loop, the FIFO fills and drops samples
+    }
+    if (now >= nextHour)
+    {
+      fprintf(stderr, "S:hour %lu,samples %lu,lost %u,restarts %u,results %lu\n", (now - start) / 3600000UL, samples,
+        simulated.samplesLost, sensor.getRestarts(), stats.results);
+      nextHour += 3600000UL;
+    }
+    samples += pipeline.poll(sensor);
+    clock.delay(appliedProfile == PROFILE_FAST ? (interval + 3) / 4 : interval);
+  }
+  double elapsed = (micros() - startUs) / 1e6;
+  double simulatedSeconds = (clock.millis() - start) / 1e3;
+
+  printf("simulated %.1f h in %.2f s, %.0fx real time\n", simulatedSeconds / 3600.0, elapsed,
+    elapsed > 0 ? simulatedSeconds / elapsed : 0.0);
+  printf("samples: %u made, %lu read, %u lost to full FIFO (overflow counter sum %u, it stops at 15 per read), %lu frames, %lu profile switches\n",
+    simulated.samplesMade, samples, simulated.samplesLost, sensor.getFIFOOverflows(), stats.frames, stats.switches);
+  printf("faults: %u injected, %u restarts, longest outage %lu ms, %u loop stalls, %u i2c errors\n",
+    faults, sensor.getRestarts(), (unsigned long)stats.longestOutage, stalls, sensor.getErrorCount());
+  printf("results: %lu, heart rate valid %.1f%% mean %.1f bpm, SpO2 valid %.1f%% mean %.1f%%\n", stats.results,
+    stats.results ? 100.0 * stats.validHR / stats.results : 0.0, stats.validHR ? stats.sumHR / stats.validHR : 0.0,
+    stats.results ? 100.0 * stats.validSPO2 / stats.results : 0.0, stats.validSPO2 ? stats.sumSPO2 / stats.validSPO2 : 0.0);
+  return ((sensor.getRestarts() < faults || sensor.getErrorCount() > 0) ? 1 : 0);
+}
@@ -0,0 +1,101 @@
+/*
+ Producer / consumer demo of spscQueue
+
+ An acquisition thread delivers a synthetic 1000 samples/s PPG through an
+ spscQueue to a processing thread that runs the pipeline of the sketch and
+ stalls now and then, as a long SpO2 window or a blocked serial port would.
+
+   spsc_demo [seconds] [stallMs]
+
+ With the queue sized for the longest stall no sample is lost: stalls stay
+ 0 and every sample pushed is processed, in order.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "MAX30100_Sample.h"
+#include "pipeline.h"
+#include "spscQueue.h"
+#include "synthPPG.h"
+
+static const int SAMPLE_RATE = 1000;
+
+typedef ppgPipeline<
+  ppgQuality<MAX30100_Format>,
+  ppgDCRemove,
+  ppgLowPass,
+  ppgBeat,
+  ppgDecimate<SAMPLE_RATE / FreqS>,
+  ppgSpO2<BUFFER_SIZE, FreqS, uint16_t>
+> Pipeline;
+enum { QUALITY, DC, LOWPASS, BEAT, DECIMATE, SPO2 };
+
+static spscQueue<ppgSample, 512> samples;
+static std::atomic<bool> running(true);
+static long beats = 0, results = 0;
+
+static void onBeat(const ppgBeatEvent &beat) { beats++; }
+static void onResult(const ppgResult &result) { results++; }
+
+// Sensor side: one sample every millisecond, the flags carry a sequence number
+static void acquisition(int seconds)
+{
+  synthPPG ppg(SAMPLE_RATE, 72.0f);
+  ppg.noise = 0.1f;
+  std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+  for (long i = 0; i < (long)seconds * SAMPLE_RATE; i++)
+  {
+    uint32_t red, ir;
+    ppg.next(&red, &ir);
+    ppgSample s = { red, ir, (uint8_t)i };
+    samples.push(s);
+    next += std::chrono::microseconds(1000000 / SAMPLE_RATE);
+    std::this_thread::sleep_until(next);
+  }
+  running = false;
+}
+
+int main(int argc, char **argv)
+{
+  int seconds = (argc > 1) ? atoi(argv[1]) : 10;
+  int stallMs = (argc > 2) ? atoi(argv[2]) : 200;
+
+  static Pipeline pipeline;
+  pipeline.stage<BEAT>().onBeat(onBeat);
+  pipeline.stage<SPO2>().onResult(onResult);
+  pipeline.begin(SAMPLE_RATE);
+
+  std::thread producer(acquisition, seconds);
+
+  // Processing side: drain, and every second stall as if busy elsewhere
+  long processed = 0, outOfOrder = 0;
+  uint8_t expect = 0;
+  std::chrono::steady_clock::time_point nextStall = std::chrono::steady_clock::now();
+  while (running || samples.size())
+  {
+    ppgSample s;
+    while (samples.pop(s))
+    {
+      if (s.flags != expect) outOfOrder++;
+      expect = s.flags + 1;
+      pipeline.push(s.red, s.ir, 0);
+      processed++;
+    }
+    if (std::chrono::steady_clock::now() >= nextStall)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(stallMs));
+      nextStall += std::chrono::seconds(1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  producer.join();
+
+  printf("pushed %lu, processed %ld, out of order %ld\n", (unsigned long)samples.stats.pushed, processed, outOfOrder);
+  printf("high water %u of 512, stalls %u\n", (unsigned)samples.stats.highWater, (unsigned)samples.stats.stalls);
+  printf("beats %ld, SpO2 windows %ld\n", beats, results);
+  return (samples.stats.stalls ? 1 : 0);
+}
@@ -0,0 +1,15 @@
+/*
+ Build time check of MAXIM_STACK_BYTES
+
+ algorithm.o is compiled with -fstack-usage. The Makefile adds up the frames
+ GCC reports for the functions on the deepest call path of
+ maxim_heart_rate_and_oxygen_saturation() into algorithm_stack.h, and this
+ file fails to compile if the figure in algorithm.h is smaller. A function
+ that was inlined has no frame of its own, its locals are in its caller's.
+*/
+
+#include "algorithm.h"
+#include "algorithm_stack.h"
+
+static_assert(MAXIM_MEASURED_STACK_BYTES <= MAXIM_STACK_BYTES,
+              "MAXIM_STACK_BYTES is below the stack -fstack-usage reports, update the tally in algorithm.h");
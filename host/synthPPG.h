@@ -0,0 +1,69 @@
+/*
+ Synthetic PPG for the host tools
+
+ Red and IR photoplethysmogram with a systolic and a dicrotic wave per beat,
+ beat to beat jitter, respiratory baseline wander and white noise. The
+ generator is deterministic for a given seed so runs can be compared.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+struct synthPPG {
+  float sampleRate;    // samples/s
+  float bpm;           // mean heart rate
+  float jitter;        // beat to beat variation, fraction of the interval
+  float noise;         // white noise, fraction of the pulsatile amplitude
+  float wander;        // respiratory baseline wander, fraction of the pulsatile amplitude
+  float dcIR, acIR;    // IR level and pulsatile amplitude in counts
+  float dcRed, acRed;  // red level and pulsatile amplitude in counts
+  float fullScale;     // ADC limit
+
+  float phase;         // position within the current beat, 0..1
+  float interval;      // length of the current beat in s
+  float t;             // time in s
+  uint32_t rng;
+
+  synthPPG(float fs, float heartRate, uint32_t seed = 1)
+    : sampleRate(fs), bpm(heartRate), jitter(0.0f), noise(0.0f), wander(0.0f),
+      dcIR(30000.0f), acIR(300.0f), dcRed(25000.0f), acRed(150.0f), fullScale(65535.0f),
+      phase(0.0f), interval(60.0f / heartRate), t(0.0f), rng(seed) {}
+
+  // uniform in [0, 1)
+  float uniform(void) {
+    rng = rng * 1664525UL + 1013904223UL;
+    return ((rng >> 8) * (1.0f / 16777216.0f));
+  }
+
+  float gaussian(void) {
+    float u1 = uniform() + 1e-7f, u2 = uniform();
+    return (sqrtf(-2.0f * logf(u1)) * cosf(6.2831853f * u2));
+  }
+
+  // pulse shape over one beat, 0..1
+  static float pulse(float p) {
+    float a = (p - 0.15f) / 0.08f;
+    float b = (p - 0.45f) / 0.10f;
+    return (expf(-0.5f * a * a) + 0.35f * expf(-0.5f * b * b));
+  }
+
+  float clamp(float x) const {
+    return (x < 0.0f ? 0.0f : (x > fullScale ? fullScale : x));
+  }
+
+  // next sample pair, blood absorbs so the signal dips with every beat
+  void next(uint32_t *red, uint32_t *ir) {
+    float shape = pulse(phase);
+    float base = wander * sinf(6.2831853f * 0.25f * t);
+    *ir  = (uint32_t)clamp(dcIR  - acIR  * (shape + base + noise * gaussian()));
+    *red = (uint32_t)clamp(dcRed - acRed * (shape + base + noise * gaussian()));
+    t += 1.0f / sampleRate;
+    phase += 1.0f / (sampleRate * interval);
+    if (phase >= 1.0f) {
+      phase -= 1.0f;
+      interval = 60.0f / bpm * (1.0f + jitter * (2.0f * uniform() - 1.0f));
+    }
+  }
+};
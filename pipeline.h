@@ -0,0 +1,560 @@
+/*
+ Sample Processing Pipeline
+
+ Chains the processing steps of a sketch at compile time:
+
+   ppgPipeline<ppgDCRemove, ppgLowPass, ppgBeat, ppgDecimate<2>, ppgSpO2<100, 25, sample_t> > pipeline;
+
+ Every sample read from the sensor travels as one ppgFrame through the
+ stages in order. A stage reads and adds fields of the frame and returns
+ false to stop it, for example while decimating. The chain is resolved at
+ compile time, poll() inlines into a single loop over the FIFO burst with
+ no virtual calls and no copies of the frame between the stages.
+
+ Results leave through callbacks registered on the stages, so a sketch
+ calls poll() from loop() instead of spinning on available().
+
+ A stage provides
+   uint16_t begin(uint16_t sampleRate)  returns the rate of the frames it passes on
+   void reset(void)                     forgets the signal, e.g. after a finger change
+   bool process(ppgFrame &f)            false stops the frame at this stage
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#include <string.h>
+#include "MAX30100_Sample.h"
+#include "heartRate.h"
+#include "algorithm.h"
+#include "signalQuality.h"
+
+// One sample pair on its way through the pipeline
+struct ppgFrame {
+  uint32_t red;      // raw sample, averaged after ppgDecimate
+  uint32_t ir;
+  uint32_t redDC;    // DC levels, set by ppgDCRemove
+  uint32_t irDC;
+  int16_t  redAC;    // DC free signal, IR low pass filtered by ppgLowPass
+  int16_t  irAC;
+  uint16_t irDelay;  // group delay of irAC in 1/256 frame, each averaging and filter stage adds its own
+  uint32_t index;    // sample number at the rate of the current stage
+  uint8_t  flags;    // MAX30100_FLAG_ bits from the driver
+  uint8_t  quality;  // SQ_ code from ppgQuality, SQ_GOOD without
+  bool     beat;     // set by ppgBeat on the sample a beat was detected
+};
+
+// Sample pair as read from the sensor, for handing over between acquisition and processing.
+// Queue ppgSampleOf<MAX30100::sample_t> on small cores, 5 instead of 9 bytes an item.
+template<typename sample_t>
+struct ppgSampleOf {
+  sample_t red;
+  sample_t ir;
+  uint8_t  flags;
+};
+typedef ppgSampleOf<uint32_t> ppgSample;
+
+// Heart beat found by ppgBeat
+struct ppgBeatEvent {
+  uint32_t index;       // sample number of the beat at the ppgBeat rate
+  int16_t  offset;      // 1/256 sample, the beat happened at index + offset / 256
+  uint16_t bpm;         // rate from the last beat interval, 0.1 bpm
+  uint16_t bpmAverage;  // average of the last PPG_BEAT_AVERAGE rates, 0.1 bpm
+};
+
+// Window result of ppgSpO2
+struct ppgResult {
+  int32_t spo2;
+  int32_t heartRate;
+  int8_t  validSPO2;
+  int8_t  validHeartRate;
+  uint8_t quality;      // SQ_ code of the window, no calculation unless SQ_GOOD
+  uint8_t confidence;   // percent of a full window the result is based on, below 100 for provisional results
+};
+
+typedef void (*ppgFrameCallback)(const ppgFrame &f);
+typedef void (*ppgBeatCallback)(const ppgBeatEvent &beat);
+typedef void (*ppgResultCallback)(const ppgResult &result);
+
+// Stages
+
+// Signal quality index, see signalQuality.h
+template<class Format>
+struct ppgQuality {
+  signalQuality_t sq;
+  uint16_t begin(uint16_t sampleRate) {
+    signalQualityInit(&sq, (1UL << Format::BITS) - 1);
+    return (sampleRate);
+  }
+  void reset(void) { signalQualityReset(&sq); }
+  inline bool process(ppgFrame &f) {
+    f.quality = signalQualityUpdate(&sq, f.red, f.ir);
+    return (true);
+  }
+};
+
+// DC removal with averageDCEstimator(), 16 bit samples
+// A channel restarts from its sample when the driver flags a change of its LED current.
+struct ppgDCRemove {
+  int32_t redReg;
+  int32_t irReg;
+  uint16_t begin(uint16_t sampleRate) {
+    reset();
+    return (sampleRate);
+  }
+  void reset(void) { redReg = 0; irReg = 0; }
+  inline bool process(ppgFrame &f) {
+    if (f.flags & MAX30100_FLAG_RED_CURRENT) redReg = (int32_t)f.red << 15; //DC level stepped
+    if (f.flags & MAX30100_FLAG_IR_CURRENT) irReg = (int32_t)f.ir << 15;
+    f.redDC = averageDCEstimator(&redReg, f.red);
+    f.irDC  = averageDCEstimator(&irReg, f.ir);
+    f.redAC = f.red - f.redDC;
+    f.irAC  = f.ir - f.irDC;
+    return (true);
+  }
+};
+
+// DC removal with warmDCEstimator(), settles within 8 samples after a start or a finger change,
+// and after a change of a channel's LED current, which starts that channel over
+struct ppgDCRemoveWarm {
+  dcEstimator_t redDC;
+  dcEstimator_t irDC;
+  uint16_t begin(uint16_t sampleRate) {
+    reset();
+    return (sampleRate);
+  }
+  void reset(void) { dcEstimatorInit(&redDC); dcEstimatorInit(&irDC); }
+  inline bool process(ppgFrame &f) {
+    if (f.flags & MAX30100_FLAG_RED_CURRENT) dcEstimatorInit(&redDC);
+    if (f.flags & MAX30100_FLAG_IR_CURRENT) dcEstimatorInit(&irDC);
+    f.redDC = warmDCEstimator(&redDC, f.red);
+    f.irDC  = warmDCEstimator(&irDC, f.ir);
+    f.redAC = f.red - f.redDC;
+    f.irAC  = f.ir - f.irDC;
+    return (true);
+  }
+};
+
+// Low pass FIR of the PBA algorithm on the IR AC signal
+struct ppgLowPass {
+  lowPassFIR_t fir;
+  uint16_t begin(uint16_t sampleRate) {
+    reset();
+    return (sampleRate);
+  }
+  void reset(void) { lowPassFIRInit(&fir); }
+  inline bool process(ppgFrame &f) {
+    f.irAC = lowPassFIRFilter(&fir, f.irAC);
+    f.irDelay += LOWPASS_FIR_DELAY << 8;
+    return (true);
+  }
+};
+
+// Shorter low pass, beats 4 samples sooner for more noise let through
+struct ppgLowPassShort {
+  lowPassFIR_t fir;
+  uint16_t begin(uint16_t sampleRate) {
+    reset();
+    return (sampleRate);
+  }
+  void reset(void) { lowPassFIRInit(&fir); }
+  inline bool process(ppgFrame &f) {
+    f.irAC = lowPassFIRShort(&fir, f.irAC);
+    f.irDelay += LOWPASS_FIR_SHORT_DELAY << 8;
+    return (true);
+  }
+};
+
+// Zero crossing beat detector of the PBA algorithm
+// ppgDCRemove, ppgLowPass, ppgBeat together give the same beats as checkForBeat()
+// Beat times are interpolated between the samples around the crossing and moved back
+// by the delay of the low pass, the rates come from these times.
+#define PPG_BEAT_AVERAGE 4   // beats in the average rate
+#define PPG_BEAT_MIN_BPM 20  // intervals outside are not averaged
+#define PPG_BEAT_MAX_BPM 255
+
+struct ppgBeat {
+  beatEdge_t edge;
+  uint16_t rate;
+  uint32_t lastBeat;                  // index of the previous beat, 0 if none
+  int16_t  lastOffset;
+  uint16_t bpms[PPG_BEAT_AVERAGE];
+  uint8_t  bpmSpot;
+  ppgBeatCallback callback;
+
+  ppgBeat() : callback(NULL) {}
+  void onBeat(ppgBeatCallback fn) { callback = fn; }
+  uint16_t begin(uint16_t sampleRate) {
+    rate = sampleRate;
+    reset();
+    return (sampleRate);
+  }
+  void reset(void) {
+    beatEdgeInit(&edge);
+    lastBeat = 0;
+    lastOffset = 0;
+    for (uint8_t i = 0; i < PPG_BEAT_AVERAGE; i++) bpms[i] = 0;
+    bpmSpot = 0;
+  }
+  inline bool process(ppgFrame &f) {
+    f.beat = detectBeatEdge(&edge, f.irAC);
+    if (f.beat) beat(f.index, beatEdgeOffset(&edge, f.irDelay));
+    return (true);
+  }
+  void beat(uint32_t index, int16_t offset) {
+    ppgBeatEvent event;
+    event.index = index;
+    event.offset = offset;
+    event.bpm = 0;
+    int32_t interval = (int32_t)(index - lastBeat) * 256 + offset - lastOffset; //1/256 sample
+    if ((lastBeat > 0) && (index > lastBeat) && (interval > 0)) {
+      uint32_t bpm = (600UL * 256 * rate) / (uint32_t)interval;
+      if ((bpm >= PPG_BEAT_MIN_BPM * 10) && (bpm <= PPG_BEAT_MAX_BPM * 10)) {
+        event.bpm = bpm;
+        bpms[bpmSpot++] = bpm;
+        bpmSpot %= PPG_BEAT_AVERAGE;
+      }
+    }
+    lastBeat = index;
+    lastOffset = offset;
+    uint32_t sum = 0;
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < PPG_BEAT_AVERAGE; i++) {
+      if (bpms[i]) {
+        sum += bpms[i];
+        count++;
+      }
+    }
+    event.bpmAverage = count ? sum / count : 0;
+    if (callback) callback(event);
+  }
+};
+
+// Averages N frames into one, divides the rate by N
+template<uint8_t N>
+struct ppgDecimate {
+  uint32_t redSum, irSum, redDCSum, irDCSum;
+  int32_t  redACSum, irACSum;
+  uint8_t  flags;
+  bool     beat;
+  uint8_t  count;
+  uint16_t begin(uint16_t sampleRate) {
+    reset();
+    return (sampleRate / N);
+  }
+  void reset(void) {
+    redSum = irSum = redDCSum = irDCSum = 0;
+    redACSum = irACSum = 0;
+    flags = 0;
+    beat = false;
+    count = 0;
+  }
+  inline bool process(ppgFrame &f) {
+    redSum += f.red;     irSum += f.ir;
+    redDCSum += f.redDC; irDCSum += f.irDC;
+    redACSum += f.redAC; irACSum += f.irAC;
+    flags |= f.flags;
+    beat |= f.beat;
+    if (++count < N) return (false);
+    f.red = redSum / N;     f.ir = irSum / N;
+    f.redDC = redDCSum / N; f.irDC = irDCSum / N;
+    f.redAC = redACSum / N; f.irAC = irACSum / N;
+    f.flags = flags;
+    f.index /= N;
+    f.irDelay = f.irDelay / N + ((N - 1) << 7) / N; //the average lags the last frame by (N - 1) / 2
+    f.beat = beat;
+    reset();
+    return (true);
+  }
+};
+
+// Averages the frames down to RATE whatever the sensor rate, for sensors that switch rate
+// while running. The factor follows from the rate given to begin(), the frames keep their
+// own count across begin() so the stages after it can go on through a retune<>(). Samples taken at a lower ADC resolution are shifted up by shift bits, so the
+// stages after it see one full scale across the switch.
+// The factor is a whole number, sampleRate / RATE. A rate that is not a multiple of RATE
+// comes out faster: 167 samples/s averages 3 frames into 55.7 samples/s, and the stages
+// after it are told 55. Every sensor rate from 200 samples/s up is a multiple of 50.
+// Its frames start the IR delay at the lag of the average, (n - 1) / 2 input frames.
+template<uint16_t RATE>
+struct ppgDecimateTo {
+  uint32_t redSum, irSum;
+  uint16_t n;       // frames averaged into one
+  uint16_t count;
+  uint32_t index;
+  uint8_t  shift;   // set by the caller before begin(), kept by reset()
+  uint8_t  flags;
+
+  ppgDecimateTo() : index(0), shift(0) {}
+  uint16_t begin(uint16_t sampleRate) {
+    n = (sampleRate > RATE) ? sampleRate / RATE : 1;
+    reset();
+    return (sampleRate / n);
+  }
+  void reset(void) {
+    redSum = irSum = 0;
+    flags = 0;
+    count = 0;
+  }
+  inline bool process(ppgFrame &f) {
+    redSum += f.red;
+    irSum += f.ir;
+    flags |= f.flags;
+    if (++count < n) return (false);
+    f.red = (redSum << shift) / n;
+    f.ir = (irSum << shift) / n;
+    f.flags = flags;
+    f.index = index++;
+    f.irDelay = ((n - 1) << 7) / n; //the average lags the last frame by (n - 1) / 2
+    reset();
+    return (true);
+  }
+};
+
+// Sliding window SpO2 and heart rate with maxim_heart_rate_and_oxygen_saturation()
+// A result every SHIFT frames over the last WINDOW frames, at the frame rate given to begin().
+// Windows holding a frame whose quality is not SQ_GOOD are reported invalid without
+// calculation, with the quality of the latest such frame.
+// With provisional results on, until the first window of good frames after a start or reset
+// the good frames at the end of the buffer are calculated every SHIFT / 4 frames from SHIFT
+// frames on, and reported as soon as they hold two valleys, with the share of the window
+// they cover as confidence.
+template<uint16_t WINDOW, uint16_t SHIFT, typename sample_t>
+struct ppgSpO2 {
+  sample_t irBuffer[WINDOW];
+  sample_t redBuffer[WINDOW];
+  int32_t  workspace[MAXIM_WORKSPACE_BYTES(WINDOW) / sizeof(int32_t)];
+  uint16_t fill;
+  uint16_t goodFrames;   // frames in a row up to the latest with SQ_GOOD, at most WINDOW
+  uint8_t  badQuality;   // quality of the latest frame that was not SQ_GOOD
+  uint16_t rate;         // frames per second, for the valley distance and the heart rate
+  bool     filled;       // a full window of good frames was calculated since the reset
+  bool     provisionalResults;
+  ppgResult result;
+  ppgResultCallback callback;
+
+  ppgSpO2() : provisionalResults(false), callback(NULL) {}
+  void onResult(ppgResultCallback fn) { callback = fn; }
+  void provisional(bool on) { provisionalResults = on; }
+  uint16_t begin(uint16_t sampleRate) {
+    rate = sampleRate;
+    result.spo2 = 0;
+    result.heartRate = 0;
+    result.validSPO2 = 0;
+    result.validHeartRate = 0;
+    result.quality = SQ_SETTLING;
+    result.confidence = 0;
+    reset();
+    return (sampleRate / SHIFT);
+  }
+  void reset(void) {
+    fill = 0;
+    filled = false;
+    goodFrames = 0;
+    badQuality = SQ_SETTLING;
+  }
+  // SQ_GOOD if every frame in the buffer had it
+  uint8_t windowQuality(void) const { return ((goodFrames >= fill) ? SQ_GOOD : badQuality); }
+  inline bool process(ppgFrame &f) {
+    redBuffer[fill] = f.red;
+    irBuffer[fill] = f.ir;
+    if (f.quality == SQ_GOOD) {
+      if (goodFrames < WINDOW) goodFrames++;
+    } else {
+      goodFrames = 0;
+      badQuality = f.quality;
+    }
+    if (++fill < WINDOW) {
+      if (provisionalResults && !filled && (goodFrames >= SHIFT) && (goodFrames % (SHIFT >= 4 ? SHIFT / 4 : 1) == 0)) {
+        estimate();
+      }
+      return (false);
+    }
+    uint8_t quality = windowQuality();
+    bool estimated = false;
+    if (quality == SQ_GOOD) filled = true;
+    else if (provisionalResults && !filled && (goodFrames >= SHIFT)) estimated = estimate();
+    if (!estimated) calculate(quality);
+    //dumping the first SHIFT sets of samples and shift the rest to the top
+    memmove(redBuffer, redBuffer + SHIFT, (WINDOW - SHIFT) * sizeof(sample_t));
+    memmove(irBuffer, irBuffer + SHIFT, (WINDOW - SHIFT) * sizeof(sample_t));
+    fill = WINDOW - SHIFT;
+    return (true);
+  }
+  void calculate(uint8_t quality) {
+    result.quality = quality;
+    if (quality == SQ_GOOD) {
+      maxim_heart_rate_and_oxygen_saturation(irBuffer, (int32_t)WINDOW, redBuffer, (int32_t)rate, &result.spo2, &result.validSPO2,
+        &result.heartRate, &result.validHeartRate, workspace, sizeof(workspace));
+    } else {
+      result.validSPO2 = 0;
+      result.validHeartRate = 0;
+    }
+    result.confidence = 100;
+    if (callback) callback(result);
+  }
+  // Partial window of the good frames at the end of the buffer, reported only once the heart
+  // rate is valid. Returns true if it was reported.
+  bool estimate(void) {
+    uint16_t n = (goodFrames < fill) ? goodFrames : fill;
+    ppgResult partial;
+    maxim_heart_rate_and_oxygen_saturation(irBuffer + fill - n, (int32_t)n, redBuffer + fill - n, (int32_t)rate, &partial.spo2,
+      &partial.validSPO2, &partial.heartRate, &partial.validHeartRate, workspace, sizeof(workspace));
+    if (!partial.validHeartRate) return (false); //fewer than two valleys so far
+    partial.quality = SQ_GOOD;
+    partial.confidence = (uint32_t)n * 100 / WINDOW;
+    result = partial;
+    if (callback) callback(result);
+    return (true);
+  }
+};
+
+// Hands every frame to a callback, for printing or logging
+struct ppgSampleSink {
+  ppgFrameCallback callback;
+  ppgSampleSink() : callback(NULL) {}
+  void onSample(ppgFrameCallback fn) { callback = fn; }
+  uint16_t begin(uint16_t sampleRate) { return (sampleRate); }
+  void reset(void) {}
+  inline bool process(ppgFrame &f) {
+    if (callback) callback(f);
+    return (true);
+  }
+};
+
+// Composition
+
+template<class... Stages> struct ppgChain;
+
+template<>
+struct ppgChain<> {
+  uint16_t begin(uint16_t sampleRate) { return (sampleRate); }
+  uint16_t beginFirst(uint8_t, uint16_t sampleRate) { return (sampleRate); }
+  void reset(void) {}
+  inline void push(ppgFrame &) {}
+};
+
+template<class Head, class... Tail>
+struct ppgChain<Head, Tail...> {
+  Head head;
+  ppgChain<Tail...> tail;
+  uint16_t begin(uint16_t sampleRate) { return (tail.begin(head.begin(sampleRate))); }
+  // Starts the first n stages, returns the rate the last of them hands on
+  uint16_t beginFirst(uint8_t n, uint16_t sampleRate) {
+    if (n == 0) return (sampleRate);
+    return (tail.beginFirst(n - 1, head.begin(sampleRate)));
+  }
+  void reset(void) { head.reset(); tail.reset(); }
+  inline void push(ppgFrame &f) {
+    if (head.process(f)) tail.push(f);
+  }
+};
+
+// Type and reference of stage I
+template<uint8_t I, class Chain> struct ppgChainAt;
+
+template<class Head, class... Tail>
+struct ppgChainAt<0, ppgChain<Head, Tail...> > {
+  typedef Head type;
+  static Head &get(ppgChain<Head, Tail...> &c) { return (c.head); }
+};
+
+template<uint8_t I, class Head, class... Tail>
+struct ppgChainAt<I, ppgChain<Head, Tail...> > {
+  typedef ppgChainAt<I - 1, ppgChain<Tail...> > next;
+  typedef typename next::type type;
+  static type &get(ppgChain<Head, Tail...> &c) { return (next::get(c.tail)); }
+};
+
+template<class... Stages>
+struct ppgPipeline {
+  typedef ppgChain<Stages...> chain_t;
+  chain_t chain;
+  uint32_t count;  // samples taken from the sensor
+  uint8_t  retuneFlag;
+  void (*retuneCallback)(uint8_t flags);
+
+  ppgPipeline() : count(0), retuneFlag(0), retuneCallback(NULL) {}
+
+  // Stage I for registering callbacks and reading its state
+  template<uint8_t I>
+  typename ppgChainAt<I, chain_t>::type &stage(void) { return (ppgChainAt<I, chain_t>::get(chain)); }
+
+  // Start all stages, sampleRate is the sensor rate
+  void begin(uint16_t sampleRate) {
+    count = 0;
+    chain.begin(sampleRate);
+  }
+
+  // Called with the sample's flags before a sample carrying any of flags enters the stages,
+  // e.g. MAX30100_FLAG_RATE to retune() them at the new sensor rate, MAX30100_FLAG_RESTART
+  // to start them over after the gap of a watchdog restart
+  void onRetune(uint8_t flags, void (*callback)(uint8_t flags)) {
+    retuneFlag = flags;
+    retuneCallback = callback;
+  }
+
+  // Restarts all stages at a new sensor rate, the sample count goes on
+  void retune(uint16_t sampleRate) { chain.begin(sampleRate); }
+
+  // Restarts stages 0 to LAST at a new sensor rate, the stages after LAST keep their state.
+  // For a LAST that hands on one rate whatever the sensor rate, e.g. ppgDecimateTo
+  template<uint8_t LAST>
+  void retune(uint16_t sampleRate) { chain.beginFirst(LAST + 1, sampleRate); }
+
+  void reset(void) { chain.reset(); }
+
+  // Feeds one sample pair, for sources other than the driver
+  inline void push(uint32_t red, uint32_t ir, uint8_t flags) {
+    if ((flags & retuneFlag) && retuneCallback) retuneCallback(flags);
+    ppgFrame f;
+    f.red = red;
+    f.ir = ir;
+    f.redDC = f.irDC = 0;
+    f.redAC = f.irAC = 0;
+    f.irDelay = 0;
+    f.index = count++;
+    f.flags = flags;
+    f.quality = SQ_GOOD;
+    f.beat = false;
+    chain.push(f);
+  }
+
+  // Runs every sample the driver holds for the consumer through the stages
+  // Returns the number of samples processed
+  template<class Sensor>
+  uint16_t drain(Sensor &sensor, uint8_t consumer = 0) {
+    uint16_t n = 0;
+    while (sensor.available(consumer)) {
+      push(sensor.getFIFORed(consumer), sensor.getFIFOIR(consumer), sensor.getFIFOFlags(consumer));
+      sensor.nextSample(consumer);
+      n++;
+    }
+    return (n);
+  }
+
+  // Moves the samples acquired so far from a queue through the stages, at most limit of them
+  // Queue provides value_type and bool pop(value_type &), e.g. spscQueue<ppgSample, N>
+  template<class Queue>
+  uint16_t drainQueue(Queue &queue, uint16_t limit = 0xFFFF) {
+    uint16_t n = 0;
+    typename Queue::value_type s;
+    while ((n < limit) && queue.pop(s)) {
+      push(s.red, s.ir, s.flags);
+      n++;
+    }
+    return (n);
+  }
+
+  // Reads new samples from the sensor and processes them, call from loop()
+  template<class Sensor>
+  uint16_t poll(Sensor &sensor, uint8_t consumer = 0) {
+    sensor.check();
+    return (drain(sensor, consumer));
+  }
+};
@@ -0,0 +1,243 @@
+/*
+ Compressed Sample Stream
+
+ Deltas are taken modulo 2^20 and sign extended, so any sample of up to 20
+ bits round trips exactly and every delta fits in PPG_CODEC_MAX_VARINT bytes.
+*/
+
+#include "ppgCodec.h"
+
+#define PPG_CODEC_BITS  20
+#define PPG_CODEC_MASK  ((1UL << PPG_CODEC_BITS) - 1)
+
+//  CRC-8, polynomial x^8 + x^2 + x + 1
+static uint8_t ppgCRC8(const uint8_t *data, uint8_t len)
+{
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t b = 0; b < 8; b++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+  }
+  return (crc);
+}
+
+//  Difference of two samples as zigzag code: 0, -1, 1, -2, 2 ... become 0, 1, 2, 3, 4 ...
+static uint32_t ppgZigzag(uint32_t value, uint32_t previous)
+{
+  uint32_t d = (value - previous) & PPG_CODEC_MASK;
+  if (d & (1UL << (PPG_CODEC_BITS - 1))) return (((PPG_CODEC_MASK - d) << 1) | 1); //negative
+  return (d << 1);
+}
+
+static uint32_t ppgUnzigzag(uint32_t code, uint32_t previous)
+{
+  uint32_t d = (code & 1) ? PPG_CODEC_MASK - (code >> 1) : (code >> 1);
+  return ((previous + d) & PPG_CODEC_MASK);
+}
+
+static void ppgPutVarint(ppgEncoder_t *e, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    e->block[e->length++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  e->block[e->length++] = (uint8_t)v;
+}
+
+//  Start with a keyframe
+void ppgEncoderInit(ppgEncoder_t *e)
+{
+  e->length = 0;
+  e->count = 0;
+  e->seq = 0;
+  e->sinceKey = 0;
+  e->forceKey = false;
+  e->red = 0;
+  e->ir = 0;
+}
+
+//  Make the next block a keyframe, e.g. when a receiver connects
+//  A block being filled goes out as it is, the one after it starts with absolute values
+void ppgEncoderKeyframe(ppgEncoder_t *e)
+{
+  e->forceKey = true;
+}
+
+//  Close the block, returns its length in bytes, 0 if it was empty
+uint8_t ppgEncodeFlush(ppgEncoder_t *e)
+{
+  if (e->count == 0) return (0);
+  e->block[2] |= e->count;
+  e->block[4] = e->length - PPG_CODEC_HEADER;
+  e->block[e->length] = ppgCRC8(&e->block[2], e->length - 2);
+  e->length++;
+  e->count = 0;
+  e->seq++;
+  if (++e->sinceKey >= PPG_CODEC_KEY_INTERVAL) e->sinceKey = 0;
+  return (e->length);
+}
+
+//  Add a sample pair
+//  Returns the length of e->block when this sample completed it, 0 otherwise
+uint8_t ppgEncode(ppgEncoder_t *e, uint32_t red, uint32_t ir)
+{
+  red &= PPG_CODEC_MASK;
+  ir &= PPG_CODEC_MASK;
+  if (e->count == 0)
+  {
+    bool key = (e->sinceKey == 0) || e->forceKey;
+    if (key)
+    {
+      e->sinceKey = 0; //the interval counts from this keyframe
+      e->forceKey = false;
+    }
+    e->block[0] = PPG_CODEC_SYNC0;
+    e->block[1] = PPG_CODEC_SYNC1;
+    e->block[2] = key ? PPG_CODEC_KEYFRAME : 0;
+    e->block[3] = e->seq;
+    e->length = PPG_CODEC_HEADER;
+    if (key)
+    {
+      //  Absolute values, the chain of deltas starts over
+      e->red = red;
+      e->ir = ir;
+      ppgPutVarint(e, red);
+      ppgPutVarint(e, ir);
+      e->count = 1;
+      return ((e->count == PPG_CODEC_BLOCK_SAMPLES) ? ppgEncodeFlush(e) : 0);
+    }
+  }
+  ppgPutVarint(e, ppgZigzag(red, e->red));
+  ppgPutVarint(e, ppgZigzag(ir, e->ir));
+  e->red = red;
+  e->ir = ir;
+  e->count++;
+  return ((e->count == PPG_CODEC_BLOCK_SAMPLES) ? ppgEncodeFlush(e) : 0);
+}
+
+void ppgDecoderInit(ppgDecoder_t *d)
+{
+  d->length = 0;
+  d->seq = 0;
+  d->synced = false;
+  d->red = 0;
+  d->ir = 0;
+  d->count = 0;
+  d->blocks = 0;
+  d->dropped = 0;
+}
+
+//  Read a varint at *pos, false if it runs past end or is too long
+static bool ppgGetVarint(const uint8_t *block, uint8_t *pos, uint8_t end, uint32_t *v)
+{
+  *v = 0;
+  for (uint8_t i = 0; i < PPG_CODEC_MAX_VARINT; i++)
+  {
+    if (*pos >= end) return (false);
+    uint8_t b = block[(*pos)++];
+    *v |= (uint32_t)(b & 0x7F) << (7 * i);
+    if (!(b & 0x80)) return (true);
+  }
+  return (false);
+}
+
+//  Unpack a complete block whose CRC checked out
+static uint8_t ppgDecodeBlock(ppgDecoder_t *d)
+{
+  uint8_t info = d->block[2];
+  uint8_t seq = d->block[3];
+  uint8_t count = info & 0x1F;
+  bool key = (info & PPG_CODEC_KEYFRAME) != 0;
+  if (!key && (!d->synced || seq != d->seq))
+  {
+    //  Deltas to a block we did not get, wait for the next keyframe
+    d->synced = false;
+    d->seq = seq + 1;
+    d->dropped++;
+    return (PPG_DECODE_DROPPED);
+  }
+  uint8_t pos = PPG_CODEC_HEADER;
+  uint8_t end = PPG_CODEC_HEADER + d->block[4];
+  uint32_t red = d->red, ir = d->ir;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t r, x;
+    if (!ppgGetVarint(d->block, &pos, end, &r) || !ppgGetVarint(d->block, &pos, end, &x))
+    {
+      d->synced = false;
+      d->dropped++;
+      return (PPG_DECODE_DROPPED);
+    }
+    if (key && (i == 0))
+    {
+      red = r;
+      ir = x;
+    }
+    else
+    {
+      red = ppgUnzigzag(r, red);
+      ir = ppgUnzigzag(x, ir);
+    }
+    d->redOut[i] = red;
+    d->irOut[i] = ir;
+  }
+  d->red = red;
+  d->ir = ir;
+  d->count = count;
+  d->seq = seq + 1;
+  d->synced = true;
+  d->blocks++;
+  return (PPG_DECODE_BLOCK);
+}
+
+//  Feed the next byte of the stream
+//  Returns one of the PPG_DECODE_ codes
+uint8_t ppgDecode(ppgDecoder_t *d, uint8_t c)
+{
+  if (d->length == 0)
+  {
+    if (c != PPG_CODEC_SYNC0) return (PPG_DECODE_TEXT);
+    d->block[d->length++] = c;
+    return (PPG_DECODE_BUSY);
+  }
+  if (d->length == 1)
+  {
+    if (c != PPG_CODEC_SYNC1)
+    {
+      //  Stray sync byte, look at this one afresh
+      d->length = 0;
+      return (ppgDecode(d, c));
+    }
+    d->block[d->length++] = c;
+    return (PPG_DECODE_BUSY);
+  }
+  d->block[d->length++] = c;
+  if (d->length < PPG_CODEC_HEADER) return (PPG_DECODE_BUSY);
+  if (d->length == PPG_CODEC_HEADER)
+  {
+    //  Header complete, check it describes a block we can hold
+    uint8_t count = d->block[2] & 0x1F;
+    if ((count == 0) || (count > PPG_CODEC_BLOCK_SAMPLES) || (d->block[4] > PPG_CODEC_MAX_BLOCK - PPG_CODEC_HEADER - 1))
+    {
+      d->length = 0;
+      d->synced = false;
+      d->dropped++;
+      return (PPG_DECODE_DROPPED);
+    }
+    return (PPG_DECODE_BUSY);
+  }
+  if (d->length < PPG_CODEC_HEADER + d->block[4] + 1) return (PPG_DECODE_BUSY);
+
+  //  Whole block received
+  uint8_t len = d->length;
+  d->length = 0;
+  if (ppgCRC8(&d->block[2], len - 3) != d->block[len - 1])
+  {
+    d->synced = false;
+    d->dropped++;
+    return (PPG_DECODE_DROPPED);
+  }
+  return (ppgDecodeBlock(d));
+}
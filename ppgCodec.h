@@ -0,0 +1,83 @@
+/*
+ Compressed Sample Stream
+
+ Consecutive PPG samples differ by a few counts on top of a large DC level,
+ the text R: lines spend most of their 30 odd bytes on digits that do not
+ change. The encoder sends the difference to the previous sample of the same
+ channel instead, zigzag mapped so small negative steps stay small and
+ written as a varint of 7 bits per byte. Noise level steps take one byte per
+ channel.
+
+ Samples go out in blocks:
+
+   0xA5 0x5A  info  seq  len  payload[len]  crc
+
+   info     bit 7 keyframe, bits 0..4 samples in the block
+   seq      block counter, a gap tells the decoder it lost the chain of deltas
+   payload  per sample red then IR, zigzag varint of the delta to the previous
+            sample; in a keyframe the first sample is the absolute value
+   crc      CRC-8 (polynomial 0x07) over info, seq, len and payload
+
+ Every PPG_CODEC_KEY_INTERVAL blocks is a keyframe, after a lost or corrupt
+ block the decoder picks up again there. The sync bytes are not ASCII, so
+ blocks and text lines can share one serial port; the decoder hands every
+ byte outside a block back as text.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#define PPG_CODEC_SYNC0          0xA5
+#define PPG_CODEC_SYNC1          0x5A
+#define PPG_CODEC_KEYFRAME       0x80 // info bit
+#ifndef PPG_CODEC_BLOCK_SAMPLES
+#define PPG_CODEC_BLOCK_SAMPLES  16   // samples per block, at most 31
+#endif
+#ifndef PPG_CODEC_KEY_INTERVAL
+#define PPG_CODEC_KEY_INTERVAL   8    // blocks from one keyframe to the next
+#endif
+#define PPG_CODEC_MAX_VARINT     3    // bytes for 21 bits, covers 18 bit samples and their deltas
+#define PPG_CODEC_HEADER         5    // sync, info, seq, len
+#define PPG_CODEC_MAX_BLOCK      (PPG_CODEC_HEADER + 2 * PPG_CODEC_MAX_VARINT * PPG_CODEC_BLOCK_SAMPLES + 1)
+
+// Decoder results, per byte
+#define PPG_DECODE_TEXT     0 // not part of a block, pass the byte on as text
+#define PPG_DECODE_BUSY     1 // taken into the current block
+#define PPG_DECODE_BLOCK    2 // block complete, samples in red[] and ir[]
+#define PPG_DECODE_DROPPED  3 // block complete but corrupt, or its deltas have no reference
+
+typedef struct {
+  uint8_t  block[PPG_CODEC_MAX_BLOCK]; // block being filled, sent when complete
+  uint8_t  length;                     // bytes in block
+  uint8_t  count;                      // samples in block
+  uint8_t  seq;                        // number of the next block
+  uint8_t  sinceKey;                   // blocks sent since the last keyframe
+  bool     forceKey;                   // ppgEncoderKeyframe() asked for one, the next block takes it
+  uint32_t red, ir;                    // previous sample
+} ppgEncoder_t;
+
+typedef struct {
+  uint8_t  block[PPG_CODEC_MAX_BLOCK]; // block being received
+  uint8_t  length;                     // bytes received, 0 while looking for sync
+  uint8_t  seq;                        // number of the block expected next
+  bool     synced;                     // red and ir hold the last sample of the previous block
+  uint32_t red, ir;                    // previous sample
+  uint32_t redOut[PPG_CODEC_BLOCK_SAMPLES]; // decoded samples of the last block
+  uint32_t irOut[PPG_CODEC_BLOCK_SAMPLES];
+  uint8_t  count;                      // samples in redOut and irOut
+  uint32_t blocks;                     // blocks decoded
+  uint32_t dropped;                    // blocks lost to corruption or a gap
+} ppgDecoder_t;
+
+void ppgEncoderInit(ppgEncoder_t *e);
+uint8_t ppgEncode(ppgEncoder_t *e, uint32_t red, uint32_t ir);
+uint8_t ppgEncodeFlush(ppgEncoder_t *e);
+void ppgEncoderKeyframe(ppgEncoder_t *e);
+
+void ppgDecoderInit(ppgDecoder_t *d);
+uint8_t ppgDecode(ppgDecoder_t *d, uint8_t c);
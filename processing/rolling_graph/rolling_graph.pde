@@ -32,15 +32,21 @@ final int WIDTH = 1600;
 final int HEIGHT = 600;
 final int CHANNELS = 2;
 final color[] colors = {color(0, 0, 0), color(255, 0, 0), color(0, 255, 0), color(0, 0, 255)};
-
-
-float[][] series  = new float[CHANNELS][WIDTH/4];
-    int[] seriesT = new int[WIDTH/4];
+// Samples across the graph, more than WIDTH only costs memory, not frame time
+final int SAMPLES = WIDTH/4;
+final int LABEL_MS = 250;  // the text is rebuilt this often
+
+Trace[] traces = new Trace[CHANNELS];
+int[] seriesT = new int[SAMPLES];
+String[] labels = new String[CHANNELS];
+String[] maxLabels = new String[CHANNELS];
+String rateLabel = "";
+String spO2Label = "";
+int lastLabelTime = 0;
 float heartRate = 0;
 int spO2 = 0;
 boolean beatDetected = false;
 boolean spO2Detected = false;
-int ptr = 0;
 float sample;
 
 Serial myPort;
@@ -48,7 +54,7 @@ PrintWriter output;
 
 void settings()
 {
-  size(WIDTH, HEIGHT);
+  size(WIDTH, HEIGHT, P2D);  // batches the trace shapes
 }
 
 void setup ()
@@ -66,6 +72,12 @@ void setup ()
   myPort = new Serial(this, attemptPort, 115200);
   myPort.bufferUntil(10); // Buffer until LF is received
   myPort.clear();
+
+  for (int s=0 ; s < CHANNELS ; ++s) {
+    traces[s] = new Trace(SAMPLES, WIDTH);
+    labels[s] = "";
+    maxLabels[s] = "";
+  }
   
   stroke(0);
   fill(0);
@@ -85,59 +97,42 @@ void draw ()
   
   line(0, height/2, width, height/2);
 
-  float[] maxv = new float[CHANNELS];  // max of each channel
-  float[] minv = new float[CHANNELS];  // min of each channel
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    maxv[s] = 0;                       // set max to minimum of sensor range
-    minv[s] = 9999999;                 // initilaize minimum above sensor range
-  }    
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    float[] samples = series[s];
-    // maxv = max(maxv, abs(max(samples)), abs(min(samples)));
-    // maxv[s] = max(maxv[s], max(samples));
-    // minv[s] = min(minv[s], min(samples));
-    maxv[s] = max(samples);
-    minv[s] = min(samples);
-    if (ABSMAX != -1) {
-      maxv[s] = min(maxv[s], ABSMAX);
-    }
-    if (ABSMIN != -1) {
-      minv[s] = max(minv[s], ABSMIN);
-    }
-  }
+  boolean relabel = millis() - lastLabelTime >= LABEL_MS;
+  if (relabel) { lastLabelTime = millis(); }
+  textSize(32);
 
-  // Avoids map() errors
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    if (maxv[s] == 0) {    maxv[s] =  1;  }
-  }
+  synchronized (traces) {
+    for (int s=0 ; s < CHANNELS ; ++s) {
+      Trace t = traces[s];
+      // Range from the sliding extremes, kept up to date as samples arrive
+      float maxv = t.max();
+      float minv = t.min();
+      if (ABSMAX != -1) {
+        maxv = min(maxv, ABSMAX);
+      }
+      if (ABSMIN != -1) {
+        minv = max(minv, ABSMIN);
+      }
 
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    stroke(colors[s]);
-
-    float[] samples = series[s];
-    float seriesMax = max(samples);
-    float seriesMin = min(samples);
-    
-    textSize(32);
-    text("ch " + s + " cur:" + samples[ptr] + " max:" + maxv[s] + " min:" + minv[s] , 0, 32 + 32 * s);
-
-    boolean maxDisplayed = false;
-    for (int i = 0 ; i < WIDTH/4 ; ++i) {
-      if (i > 0) {
-        float ipy = HEIGHT - map(samples[i-1], minv[s], maxv[s], 0, HEIGHT);
-        float iy  = HEIGHT - map(samples[i],   minv[s], maxv[s], 0, HEIGHT);
-        
-        if (abs(samples[i] - seriesMax) < 0.001 && !maxDisplayed) {
-          text("v=" + samples[i], i*4, iy);
-          maxDisplayed = true;
-        }
-          
-        line(i*4 - 1, ipy, i*4, iy);
+      stroke(colors[s]);
+      t.draw(0, 0, WIDTH, HEIGHT, minv, maxv);
+
+      if (relabel) {
+        labels[s] = "ch " + s + " cur:" + t.current() + " max:" + maxv + " min:" + minv;
+        maxLabels[s] = "v=" + t.max();
+      }
+      text(labels[s], 0, 32 + 32 * s);
+      if (maxv > minv) {
+        text(maxLabels[s], t.maxX(0, WIDTH), HEIGHT - map(t.max(), minv, maxv, 0, HEIGHT));
       }
     }
   }
-  if (beatDetected==true) { text("Rate: " + heartRate, 0, 96); }
-  if (spO2Detected==true) { text("SpO2: " + spO2 + "%", 0, 128); }
+  if (relabel) {
+    rateLabel = "Rate: " + heartRate;
+    spO2Label = "SpO2: " + spO2 + "%";
+  }
+  if (beatDetected==true) { text(rateLabel, 0, 96); }
+  if (spO2Detected==true) { text(spO2Label, 0, 128); }
 }
   
 void serialEvent (Serial myPort)
@@ -155,18 +150,15 @@ void serialEvent (Serial myPort)
   //println(sValues);
   
   if (sValues[0].substring(0, 2).equals("R:")) {
-    sample = float(sValues[0].substring(2));
-    //println(sample);
-    if (!Float.isNaN(sample)) {
-      series[0][ptr] = sample;
-    }
-    sample = float(sValues[1]);
-    //println(sample);
-    if (!Float.isNaN(sample)) {
-    series[1][ptr] = sample;
+    synchronized (traces) {
+      seriesT[traces[0].ptr] = millis();
+      sample = float(sValues[0].substring(2));
+      //println(sample);
+      traces[0].add(Float.isNaN(sample) ? traces[0].current() : sample);
+      sample = float(sValues[1]);
+      //println(sample);
+      traces[1].add(Float.isNaN(sample) ? traces[1].current() : sample);
     }
-    seriesT[ptr] = millis();
-    ptr = (ptr + 1) % (WIDTH/4);
   }
   
   for (int i=2 ; i < sValues.length ; ++i) {
@@ -196,8 +188,8 @@ void keyPressed() {
     int h = hour();
     String myName = String.valueOf(y) + "_" + String.valueOf(m) + "_" + String.valueOf(d) + "_" + String.valueOf(h) + "_" + String.valueOf(mi) + "_" + String.valueOf(s) ;
     output = createWriter("Hunt"+ myName + ".csv"); 
-    for(int i=0; i < WIDTH/4; i ++){
-      output.println(seriesT[i] + "," + series[0][i] + "," + series[1][i]);
+    for(int i=0; i < SAMPLES; i ++){
+      output.println(seriesT[i] + "," + traces[0].values[i] + "," + traces[1].values[i]);
     }
     output.flush(); // Writes the remaining data to the file
     output.close(); // Close the file
@@ -0,0 +1,128 @@
+// One channel of the rolling graph
+//
+// Samples are written in sweep order, the newest overwrites the oldest. With
+// every sample
+//  - the minimum and maximum of the window are kept in two monotonic deques,
+//    the front of each is the extreme, autoscaling never scans the window
+//  - the pixel column the sample falls in extends its own min and max, the
+//    column starts over when the sweep enters it
+// Drawing walks the columns instead of the samples and emits a single shape,
+// the frame time depends on the plot width, not on the sample rate.
+
+class Trace {
+  final int capacity;   // samples in the window
+  final int columns;    // pixel columns, at most one per sample
+  final float[] values;
+  int ptr = 0;          // slot of the next sample
+  int count = 0;        // samples received, sequence number of the next one
+
+  final float[] colMin; // per column, NaN until the sweep reached it
+  final float[] colMax;
+
+  // Monotonic deques, sequence numbers and values, decreasing for the maximum
+  // and increasing for the minimum
+  final int[] maxSeq, minSeq;
+  final float[] maxVal, minVal;
+  int maxHead = 0, maxSize = 0;
+  int minHead = 0, minSize = 0;
+
+  Trace(int capacity, int width) {
+    this.capacity = capacity;
+    this.columns = min(capacity, width);
+    values = new float[capacity];
+    colMin = new float[columns];
+    colMax = new float[columns];
+    for (int c = 0; c < columns; ++c) {
+      colMin[c] = Float.NaN;
+      colMax[c] = Float.NaN;
+    }
+    maxSeq = new int[capacity];
+    minSeq = new int[capacity];
+    maxVal = new float[capacity];
+    minVal = new float[capacity];
+  }
+
+  int column(int slot) {
+    return (int)((long)slot * columns / capacity);
+  }
+
+  void add(float v) {
+    int seq = count++;
+    values[ptr] = v;
+
+    // First slot of the column starts it over
+    int col = column(ptr);
+    int first = (int)(((long)col * capacity + columns - 1) / columns);
+    if (ptr == first || Float.isNaN(colMin[col])) {
+      colMin[col] = v;
+      colMax[col] = v;
+    } else {
+      colMin[col] = min(colMin[col], v);
+      colMax[col] = max(colMax[col], v);
+    }
+    ptr = (ptr + 1) % capacity;
+
+    // Drop what left the window, then what the new sample dominates
+    int oldest = seq - capacity + 1;
+    while (maxSize > 0 && maxSeq[maxHead] < oldest) { maxHead = (maxHead + 1) % capacity; maxSize--; }
+    while (maxSize > 0 && maxVal[(maxHead + maxSize - 1) % capacity] <= v) maxSize--;
+    int tail = (maxHead + maxSize) % capacity;
+    maxSeq[tail] = seq;
+    maxVal[tail] = v;
+    maxSize++;
+
+    while (minSize > 0 && minSeq[minHead] < oldest) { minHead = (minHead + 1) % capacity; minSize--; }
+    while (minSize > 0 && minVal[(minHead + minSize - 1) % capacity] >= v) minSize--;
+    tail = (minHead + minSize) % capacity;
+    minSeq[tail] = seq;
+    minVal[tail] = v;
+    minSize++;
+  }
+
+  float current() {
+    return values[(ptr + capacity - 1) % capacity];
+  }
+
+  float max() {
+    return maxSize > 0 ? maxVal[maxHead] : 0;
+  }
+
+  float min() {
+    return minSize > 0 ? minVal[minHead] : 0;
+  }
+
+  // x of the column holding the maximum
+  float maxX(float x0, float w) {
+    if (maxSize == 0) return x0;
+    return x0 + (column(maxSeq[maxHead] % capacity) + 0.5) * w / columns;
+  }
+
+  // Vertical extent of each column, joined to the next, as one shape
+  // The join from the column written last to the oldest data is left out
+  void draw(float x0, float y0, float w, float h, float lo, float hi) {
+    if (hi <= lo) hi = lo + 1;
+    float scale = h / (hi - lo);
+    int newest = column((ptr + capacity - 1) % capacity);
+    boolean joined = false;
+    float px = 0, py = 0;
+    beginShape(LINES);
+    for (int c = 0; c < columns; ++c) {
+      if (Float.isNaN(colMin[c])) { joined = false; continue; }
+      float x = x0 + (c + 0.5) * w / columns;
+      float top = y0 + h - (colMax[c] - lo) * scale;
+      float bottom = y0 + h - (colMin[c] - lo) * scale;
+      if (joined && c != newest + 1) {
+        vertex(px, py);
+        vertex(x, top);
+      }
+      if (bottom != top) {
+        vertex(x, top);
+        vertex(x, bottom);
+      }
+      px = x;
+      py = bottom;
+      joined = true;
+    }
+    endShape();
+  }
+}
@@ -33,9 +33,19 @@ final int HEIGHT = 600;
 final int CHANNELS = 2;
 final color[] colors = {color(0, 0, 0), color(255, 0, 0), color(0, 255, 0), color(0, 0, 255)};
 
-float[][] series1 = new float[CHANNELS][WIDTH/4];
-float[][] series2 = new float[CHANNELS][WIDTH/4];
-int[]     seriesT = new int[WIDTH/4];
+// Samples across the graph, more than WIDTH only costs memory, not frame time
+final int SAMPLES = WIDTH/4;
+final int LABEL_MS = 250;  // the text is rebuilt this often
+
+Trace[] traces1 = new Trace[CHANNELS];
+Trace[] traces2 = new Trace[CHANNELS];
+int[]   seriesT = new int[SAMPLES];
+String[] labels1 = new String[CHANNELS];
+String[] labels2 = new String[CHANNELS];
+String[] maxLabels1 = new String[CHANNELS];
+String[] maxLabels2 = new String[CHANNELS];
+String[] resultLabels = {"", "", "", ""};
+int lastLabelTime = 0;
 
 float heartRate1 = 0;
 float heartRate2 = 0;
@@ -48,8 +58,6 @@ boolean spO2Detected2 = false;
 boolean synced = false;
 boolean portOneStarted = false;
 boolean portTwoStarted = false;
-int ptr1 = 0;
-int ptr2 = 0;
 int expectedNextPort = 1;
 float sample;
 
@@ -60,7 +68,7 @@ PrintWriter output;
 
 void settings()
 {
-  size(WIDTH, HEIGHT);
+  size(WIDTH, HEIGHT, P2D);  // batches the trace shapes
 }
 
 void setup ()
@@ -91,6 +99,12 @@ void setup ()
   
   portTwo.clear();
   portOne.clear();
+
+  for (int s=0 ; s < CHANNELS ; ++s) {
+    traces1[s] = new Trace(SAMPLES, WIDTH);
+    traces2[s] = new Trace(SAMPLES, WIDTH);
+    labels1[s] = labels2[s] = maxLabels1[s] = maxLabels2[s] = "";
+  }
   
   stroke(0);
   fill(0);
@@ -105,119 +119,56 @@ void draw ()
   
   line(0, height/2, width, height/2);
 
-  float[] maxv1 = new float[CHANNELS];  // max of each channel
-  float[] minv1 = new float[CHANNELS];  // min of each channel
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    maxv1[s] = 0;                       // set max to minimum of sensor range
-    minv1[s] = 9999999;                 // initilaize minimum above sensor range
-  }    
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    float[] samples1 = series1[s];
-    // maxv = max(maxv, abs(max(samples)), abs(min(samples)));
-    // maxv[s] = max(maxv[s], max(samples));
-    // minv[s] = min(minv[s], min(samples));
-    maxv1[s] = max(samples1);
-    minv1[s] = min(samples1);
-    if (ABSMAX != -1) {
-      maxv1[s] = min(maxv1[s], ABSMAX);
-    }
-    if (ABSMIN != -1) {
-      minv1[s] = max(minv1[s], ABSMIN);
-    }
-  }
-
-  float[] maxv2 = new float[CHANNELS];  // max of each channel
-  float[] minv2 = new float[CHANNELS];  // min of each channel
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    maxv2[s] = 0;                       // set max to minimum of sensor range
-    minv2[s] = 9999999;                 // initilaize minimum above sensor range
-  }    
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    float[] samples2 = series2[s];
-    // maxv = max(maxv, abs(max(samples)), abs(min(samples)));
-    // maxv[s] = max(maxv[s], max(samples));
-    // minv[s] = min(minv[s], min(samples));
-    maxv2[s] = max(samples2);
-    minv2[s] = min(samples2);
-    if (ABSMAX != -1) {
-      maxv2[s] = min(maxv2[s], ABSMAX);
-    }
-    if (ABSMIN != -1) {
-      minv2[s] = max(minv2[s], ABSMIN);
-    }
-  }
+  boolean relabel = millis() - lastLabelTime >= LABEL_MS;
+  if (relabel) { lastLabelTime = millis(); }
+  textSize(32);
 
+  //DISPLAY PORT 1, bottom half
+  drawTraces(traces1, labels1, maxLabels1, HEIGHT/2, relabel);
+  //DISPLAY PORT 2, top half
+  drawTraces(traces2, labels2, maxLabels2, 0, relabel);
 
-  //DISPLAY PORT 1
-  
-  // Avoids map() errors
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    if (maxv1[s] == 0) {    maxv1[s] =  1;  }
-    if (maxv2[s] == 0) {    maxv2[s] =  1;  }
+  if (relabel) {
+    resultLabels[0] = "Rate1: " + heartRate1;
+    resultLabels[1] = "SpO21: " + spO21 + "%";
+    resultLabels[2] = "Rate2: " + heartRate2;
+    resultLabels[3] = "SpO22: " + spO22 + "%";
   }
+  if (beatDetected1 == true) { text(resultLabels[0], 0,  96+HEIGHT/2); }
+  if (spO2Detected1 == true) { text(resultLabels[1], 0, 128+HEIGHT/2); }
+  if (beatDetected2 == true) { text(resultLabels[2], 0,  96); }
+  if (spO2Detected2 == true) { text(resultLabels[3], 0, 128); }
+}
 
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    stroke(colors[s]);
-
-    float[] samples1 = series1[s];
-    float seriesMax1 = max(samples1);
-    float seriesMin1 = min(samples1);
-    
-    textSize(32);
-    text("ch " + s + " cur:" + samples1[ptr1] + " max:" + maxv1[s] + " min:" + minv1[s], 0, 32 + 32 * s + HEIGHT/2);
-
-    boolean maxDisplayed1 = false;
-    for (int i = 0 ; i < WIDTH/4 ; ++i) {
-      if (i > 0) {
-        float ipy = HEIGHT - map(samples1[i-1], minv1[s], maxv1[s], 0, HEIGHT/2);
-        float iy  = HEIGHT - map(samples1[i],   minv1[s], maxv1[s], 0, HEIGHT/2);
-        
-        if (abs(samples1[i] - seriesMax1) < 0.001 && !maxDisplayed1) {
-          text("v=" + samples1[i], i*4, iy);
-          maxDisplayed1 = true;
-        }
-          
-        line(i*4 - 1, ipy, i*4, iy);
+// Both channels of one board in a band HEIGHT/2 high starting at top
+void drawTraces(Trace[] traces, String[] labels, String[] maxLabels, int top, boolean relabel)
+{
+  synchronized (traces) {
+    for (int s=0 ; s < CHANNELS ; ++s) {
+      Trace t = traces[s];
+      // Range from the sliding extremes, kept up to date as samples arrive
+      float maxv = t.max();
+      float minv = t.min();
+      if (ABSMAX != -1) {
+        maxv = min(maxv, ABSMAX);
+      }
+      if (ABSMIN != -1) {
+        minv = max(minv, ABSMIN);
       }
-    }
-  }
-  if (beatDetected1 == true) { text("Rate1: " + heartRate1, 0,  96+HEIGHT/2); }
-  if (spO2Detected1 == true) { text("SpO21: " + spO21 + "%", 0, 128+HEIGHT/2); }
-  
-  
-  //DISPLAY PORT 2
-
-  // Avoids map() errors
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    if (maxv2[s] == 0) {    maxv2[s] =  1;  }
-  }
 
-  for (int s=0 ; s < CHANNELS ; ++s) {
-    stroke(colors[s]);
+      stroke(colors[s]);
+      t.draw(0, top, WIDTH, HEIGHT/2, minv, maxv);
 
-    float[] samples2 = series2[s];
-    float seriesMax2 = max(samples2);
-    float seriesMin2 = min(samples2);
-    
-    text("ch " + s + " cur:" + samples2[ptr2] + " max:" + maxv2[s] + " min:" + minv2[s], 0, 32 + 32 * s);
-
-    boolean maxDisplayed2 = false;
-    for (int i = 0 ; i < WIDTH/4 ; ++i) {
-      if (i > 0) {
-        float ipy = HEIGHT/2 - map(samples2[i-1], minv2[s], maxv2[s], 0, HEIGHT/2);
-        float iy  = HEIGHT/2 - map(samples2[i],   minv2[s], maxv2[s], 0, HEIGHT/2);
-        
-        if (abs(samples2[i] - seriesMax2) < 0.001 && !maxDisplayed2) {
-          text("v=" + samples2[i], i*4, iy);
-          maxDisplayed2 = true;
-        }
-          
-        line(i*4 - 1, ipy, i*4, iy);
+      if (relabel) {
+        labels[s] = "ch " + s + " cur:" + t.current() + " max:" + maxv + " min:" + minv;
+        maxLabels[s] = "v=" + t.max();
+      }
+      text(labels[s], 0, 32 + 32 * s + top);
+      if (maxv > minv) {
+        text(maxLabels[s], t.maxX(0, WIDTH), top + HEIGHT/2 - map(t.max(), minv, maxv, 0, HEIGHT/2));
       }
     }
   }
-  if (beatDetected2==true) { text("Rate2: " + heartRate2,  0, HEIGHT/2+96); }
-  if (spO2Detected2==true) { text("SpO22: " + spO22 + "%", 0, HEIGHT/2+128); }
 }
   
 void serialEvent (Serial thisPort)
@@ -246,18 +197,15 @@ void serialEvent (Serial thisPort)
     if (thisPort == portOne) {        
       if (expectedNextPort == 1){
         if (sValues[0].substring(0, 2).equals("R:")) {
-          sample = float(sValues[0].substring(2));
-          //println(sample);
-          if (!Float.isNaN(sample)) {
-            series1[0][ptr1] = sample;
+          synchronized (traces1) {
+            seriesT[traces1[0].ptr] = millis();
+            sample = float(sValues[0].substring(2));
+            //println(sample);
+            traces1[0].add(Float.isNaN(sample) ? traces1[0].current() : sample);
+            sample = float(sValues[1]);
+            //println(sample);
+            traces1[1].add(Float.isNaN(sample) ? traces1[1].current() : sample);
           }
-          sample = float(sValues[1]);
-          //println(sample);
-          if (!Float.isNaN(sample)) {
-          series1[1][ptr1] = sample;
-          }
-          seriesT[ptr1] = millis();
-          ptr1 = (ptr1 + 1) % (WIDTH/4);
        } // R
        for (int i=2 ; i < sValues.length ; ++i) {
          if (sValues[i].substring(0, 2).equals("H:")) {
@@ -279,18 +227,14 @@ void serialEvent (Serial thisPort)
     if (thisPort == portTwo) {        
       if (expectedNextPort == 2){
         if (sValues[0].substring(0, 2).equals("R:")) {
-          sample = float(sValues[0].substring(2));
-          //println(sample);
-          if (!Float.isNaN(sample)) {
-            series2[0][ptr1] = sample;
-          }
-          sample = float(sValues[1]);
-          //println(sample);
-          if (!Float.isNaN(sample)) {
-          series2[1][ptr1] = sample;
+          synchronized (traces2) {
+            sample = float(sValues[0].substring(2));
+            //println(sample);
+            traces2[0].add(Float.isNaN(sample) ? traces2[0].current() : sample);
+            sample = float(sValues[1]);
+            //println(sample);
+            traces2[1].add(Float.isNaN(sample) ? traces2[1].current() : sample);
           }
-          //seriesT[ptr1] = millis();
-          ptr2 = (ptr2 + 1) % (WIDTH/4);
        } // R
        for (int i=2 ; i < sValues.length ; ++i) {
          if (sValues[i].substring(0, 2).equals("H:")) {
@@ -326,8 +270,8 @@ void keyPressed() {
     int h = hour();
     String myName = String.valueOf(y) + "_" + String.valueOf(m) + "_" + String.valueOf(d) + "_" + String.valueOf(h) + "_" + String.valueOf(mi) + "_" + String.valueOf(s) ;
     output = createWriter("Hunt"+ myName + ".csv"); 
-    for(int i=0; i < WIDTH; i ++){
-      output.println(seriesT[i] + "," + series1[0][i] + "," + series1[1][i] + "," + series2[0][i] + "," + series2[1][i]);
+    for(int i=0; i < SAMPLES; i ++){
+      output.println(seriesT[i] + "," + traces1[0].values[i] + "," + traces1[1].values[i] + "," + traces2[0].values[i] + "," + traces2[1].values[i]);
     }
     output.flush(); // Writes the remaining data to the file
     output.close(); // Finishes the file
@@ -0,0 +1,74 @@
+/*
+ Signal Quality Index
+ 
+ Finger presence, clipping, motion and perfusion from a running DC level and
+ a running mean absolute deviation. A few additions and shifts per sample, so
+ it can gate the window based calculations in algorithm.cpp.
+*/
+
+#include "signalQuality.h"
+
+//  Start with empty averages
+void signalQualityInit(signalQuality_t *sq, uint32_t fullScale)
+{
+  sq->fullScale = fullScale;
+  signalQualityReset(sq);
+}
+
+//  Forget the averages, for example after the LED current changed
+void signalQualityReset(signalQuality_t *sq)
+{
+  sq->dc = 0;
+  sq->ac = 0;
+  sq->settle = SQ_SETTLE_SAMPLES;
+  sq->clipHold = 0;
+  sq->quality = SQ_SETTLING;
+}
+
+//  Process next sample pair
+//  Returns the SQ_ code of the signal so far
+uint8_t signalQualityUpdate(signalQuality_t *sq, uint32_t red, uint32_t ir)
+{
+  //  Clipping on either channel
+  uint32_t clipLevel = sq->fullScale / 100 * SQ_CLIP_PERCENT;
+  if ((red >= clipLevel) | (ir >= clipLevel)) sq->clipHold = SQ_CLIP_HOLD;
+  else if (sq->clipHold > 0) sq->clipHold--;
+
+  //  Seed the DC level with the first sample, it would take long to climb from zero
+  if (sq->settle == SQ_SETTLE_SAMPLES) sq->dc = (int32_t)ir << 8;
+
+  //  DC level and deviation from it
+  sq->dc += ((((int32_t)ir << 8) - sq->dc) >> 4);
+  int32_t deviation = ((int32_t)ir << 8) - sq->dc;
+  if (deviation < 0) deviation = -deviation;
+  sq->ac += ((deviation - sq->ac) >> 4);
+
+  if (sq->settle > 0)
+  {
+    sq->settle--;
+    sq->quality = SQ_SETTLING;
+    return (sq->quality);
+  }
+
+  //  Perfusion index limits compared without division
+  //  Peak to peak of a sine is about 3x its mean absolute deviation
+  //  Once ac3 <= dc, the products fit 32 bit for samples up to 18 bit
+  uint32_t dc = sq->dc >> 8;
+  uint32_t ac3 = 3 * (uint32_t)(sq->ac >> 8);
+  if (dc < sq->fullScale / 100 * SQ_FINGER_PERCENT) sq->quality = SQ_NO_FINGER;
+  else if (sq->clipHold > 0) sq->quality = SQ_CLIPPING;
+  else if (ac3 > dc || ac3 * 10000 > dc * SQ_MAX_PERFUSION) sq->quality = SQ_MOTION;
+  else if (ac3 * 10000 < dc * SQ_MIN_PERFUSION) sq->quality = SQ_LOW_PERFUSION;
+  else sq->quality = SQ_GOOD;
+  return (sq->quality);
+}
+
+//  Perfusion index of the IR channel in 0.01%
+uint16_t signalQualityPerfusion(const signalQuality_t *sq)
+{
+  uint32_t dc = sq->dc >> 8;
+  uint32_t ac3 = 3 * (uint32_t)(sq->ac >> 8);
+  if (dc == 0) return (0);
+  if (ac3 > dc) return (10000);
+  return ((uint16_t)(ac3 * 10000 / dc));
+}
@@ -0,0 +1,48 @@
+/*
+ Signal Quality Index
+ 
+ Cheap per sample checks that tell whether a PPG window is worth the full
+ heart rate and SpO2 calculation: finger presence from the IR DC level,
+ clipping, perfusion index and motion.
+
+ All averages are exponential with the same 1/16 factor as averageDCEstimator().
+ The pulsatile (AC) level is the mean absolute deviation from the DC level,
+ which is a variance estimate that needs neither squares nor roots.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+// Quality codes, the first condition that applies is reported
+#define SQ_GOOD           0  // compute heart rate and SpO2
+#define SQ_SETTLING       1  // averages not yet meaningful after start or reset
+#define SQ_NO_FINGER      2  // IR DC level below SQ_FINGER_PERCENT of full scale
+#define SQ_CLIPPING       3  // a sample reached the ADC limit recently
+#define SQ_MOTION         4  // pulsatile level above SQ_MAX_PERFUSION, gross movement
+#define SQ_LOW_PERFUSION  5  // pulsatile level below SQ_MIN_PERFUSION
+
+#define SQ_FINGER_PERCENT   5    // IR DC level with a finger on the sensor, percent of full scale
+#define SQ_CLIP_PERCENT     98   // samples above are treated as clipped, percent of full scale
+#define SQ_MIN_PERFUSION    10   // perfusion index in 0.01%
+#define SQ_MAX_PERFUSION    1000 // perfusion index in 0.01%
+#define SQ_SETTLE_SAMPLES   64   // four time constants of the averages
+#define SQ_CLIP_HOLD        64   // samples a clipped sample keeps the window bad
+
+typedef struct {
+  uint32_t fullScale;   // largest ADC value
+  int32_t  dc;          // IR DC level, 8 fractional bits
+  int32_t  ac;          // mean absolute deviation of IR from dc, 8 fractional bits
+  uint8_t  settle;      // samples until the averages are meaningful
+  uint8_t  clipHold;    // samples until a clipped sample is forgotten
+  uint8_t  quality;     // last reported SQ_ code
+} signalQuality_t;
+
+void signalQualityInit(signalQuality_t *sq, uint32_t fullScale);
+void signalQualityReset(signalQuality_t *sq);
+uint8_t signalQualityUpdate(signalQuality_t *sq, uint32_t red, uint32_t ir);
+uint16_t signalQualityPerfusion(const signalQuality_t *sq);
@@ -0,0 +1,135 @@
+/*
+ Single Producer Single Consumer Queue
+
+ Lock free hand over of samples from acquisition (ISR, RTOS task or host
+ thread) to processing. The producer only writes head, the consumer only
+ writes tail, so neither side ever waits for the other. A processing burst
+ fills the queue instead of leaving the sensor FIFO unread.
+
+ The indices run freely and are masked on access, SIZE must be a power of
+ two. On cached cores each index gets its own cache line so the two sides
+ do not invalidate each other's line with every sample. On AVR a single
+ byte store is atomic and there is no cache, the indices are plain volatile
+ bytes and SIZE is limited to 128.
+
+ The producer keeps its own copy of the consumer position and only looks
+ at the consumer's index when that copy says the queue is full or at a new
+ high water mark.
+
+ Statistics are written by the producer only. On AVR read them with
+ interrupts disabled when the producer is an ISR.
+*/
+
+#pragma once
+
+#if (ARDUINO >= 100)
+ #include "Arduino.h"
+#else
+ #include "WProgram.h"
+#endif
+
+#if defined(__AVR__)
+ #define SPSC_CACHE_LINE 1
+ typedef uint8_t spscIndex_t;
+ // Index shared between the two sides, a byte is read and written in one instruction
+ struct spscIndex {
+   volatile spscIndex_t value;
+   inline spscIndex_t load(void) const { return (value); }
+   inline spscIndex_t acquire(void) const {
+     spscIndex_t v = value;
+     asm volatile("" ::: "memory"); //data is read after the index
+     return (v);
+   }
+   inline void release(spscIndex_t v) {
+     asm volatile("" ::: "memory"); //data is written before the index
+     value = v;
+   }
+ };
+#else
+ #include <atomic>
+ #ifndef SPSC_CACHE_LINE
+ #define SPSC_CACHE_LINE 64
+ #endif
+ typedef uint16_t spscIndex_t;
+ struct spscIndex {
+   std::atomic<spscIndex_t> value;
+   inline spscIndex_t load(void) const { return (value.load(std::memory_order_relaxed)); }
+   inline spscIndex_t acquire(void) const { return (value.load(std::memory_order_acquire)); }
+   inline void release(spscIndex_t v) { value.store(v, std::memory_order_release); }
+ };
+#endif
+
+// Producer side statistics
+struct spscStats {
+  uint32_t pushed;     // items accepted
+  uint16_t stalls;     // items refused because the queue was full
+  spscIndex_t highWater; // most items waiting at once
+};
+
+template<class T, uint16_t SIZE>
+struct spscQueue {
+  static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+  static_assert(SIZE <= (spscIndex_t)~(spscIndex_t)0 / 2 + 1, "SIZE too large for the index type");
+  static const spscIndex_t MASK = SIZE - 1;
+  typedef T value_type;
+
+  // Producer line
+  alignas(SPSC_CACHE_LINE) spscIndex head;  // next slot to write
+  spscIndex_t tailCache;                    // consumer position last seen by the producer
+  spscStats stats;
+  // Consumer line
+  alignas(SPSC_CACHE_LINE) spscIndex tail;  // next slot to read
+  spscIndex_t headCache;                    // producer position last seen by the consumer
+  // Data
+  alignas(SPSC_CACHE_LINE) T items[SIZE];
+
+  spscQueue() { clear(); }
+
+  // Not safe while either side runs
+  void clear(void) {
+    head.release(0);
+    tail.release(0);
+    tailCache = 0;
+    headCache = 0;
+    stats.pushed = 0;
+    stats.stalls = 0;
+    stats.highWater = 0;
+  }
+
+  // Producer: append item, false if the queue is full and the item was dropped
+  bool push(const T &item) {
+    spscIndex_t h = head.load();
+    spscIndex_t used = (spscIndex_t)(h - tailCache);
+    if (used >= stats.highWater) {
+      //Possibly full or a new high water mark, look again where the consumer is
+      tailCache = tail.acquire();
+      used = (spscIndex_t)(h - tailCache);
+      if (used >= SIZE) {
+        stats.stalls++;
+        return (false);
+      }
+    }
+    items[h & MASK] = item;
+    head.release((spscIndex_t)(h + 1));
+    stats.pushed++;
+    if (used + 1 > stats.highWater) stats.highWater = used + 1;
+    return (true);
+  }
+
+  // Consumer: take the oldest item, false if the queue is empty
+  bool pop(T &item) {
+    spscIndex_t t = tail.load();
+    if (t == headCache) {
+      headCache = head.acquire();
+      if (t == headCache) return (false);
+    }
+    item = items[t & MASK];
+    tail.release((spscIndex_t)(t + 1));
+    return (true);
+  }
+
+  // Either side: items waiting, a snapshot
+  spscIndex_t size(void) const {
+    return ((spscIndex_t)(head.acquire() - tail.acquire()));
+  }
+};